@@ -340,9 +340,20 @@ CommandEditVar::CommandEditVar(std::string tok, cplx c, ParsedFunc<cplx>* f)
     oldVal = f->GetVar(tok)->GetVal();
 }
 
-void CommandEditVar::exec() { func->SetVariable(token, newVal); }
+void CommandEditVar::exec() { SetValue(newVal); }
 
-void CommandEditVar::undo() { func->SetVariable(token, oldVal); }
+void CommandEditVar::undo() { SetValue(oldVal); }
+
+void CommandEditVar::SetValue(cplx val)
+{
+    if (!func->IsCurrent(handle)) handle = func->GetVarHandle(token);
+    // Variables the program doesn't use have no handle, but still keep a
+    // value.
+    if (handle.IsValid())
+        func->SetVariable(handle, val);
+    else
+        func->SetVariable(token, val);
+}
 
 CommandAddAnim::CommandAddAnim(std::shared_ptr<Animation> s, InputPlane* in)
     : subject(s), parent(in)
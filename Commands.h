@@ -583,10 +583,13 @@ public:
     virtual void SetPositionParam(cplx c) { newVal = c; }
 
 private:
+    void SetValue(cplx val);
+
     std::string token;
     cplx newVal;
     cplx oldVal;
     ParsedFunc<cplx>* func;
+    VarHandle handle; // Looked up again whenever func is recompiled.
 
     template <class Archive>
     void serialize(Archive& ar, const unsigned int version)
@@ -89,16 +89,30 @@ void Contour::PopulateMenu(ToolPanel* TP)
     TP->FitInside();
 }
 
+void Contour::InterpolateBatch(const std::vector<double>& t,
+                               std::vector<cplx>& out)
+{
+    out.resize(t.size());
+    for (size_t i = 0; i < t.size(); i++)
+        out[i] = Interpolate(t[i]);
+}
+
 Contour* Contour::Map(ParsedFunc<cplx>& f, int res)
 {
     ContourPolygon* C = new ContourPolygon(color, "f(" + name + ")");
     C->Reserve(res + 1);
     double tStep = 1.0 / res;
     const double TOL = 1e-9;
-    for (double t = 0; t < 1.0 + TOL; t += tStep)
-    {
-        C->AddPoint(f(Interpolate(t)));
-    }
+    std::vector<double> t;
+    t.reserve(res + 1);
+    for (double s = 0; s < 1.0 + TOL; s += tStep)
+        t.push_back(s);
+
+    std::vector<cplx> pts;
+    InterpolateBatch(t, pts);
+    f.EvalBatch(pts.data(), pts.data(), pts.size(), mapCache);
+    for (auto& p : pts)
+        C->AddPoint(p);
     return C;
 }
 
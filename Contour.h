@@ -19,6 +19,7 @@
 
 #include "Commands.h"
 #include "ComplexPlane.h"
+#include "SubtreeCache.h"
 #include "Utilities.h"
 
 struct Axes;
@@ -96,6 +97,11 @@ public:
     // Parameterizing the contour as g(t) with 0 < t < 1, returns g(t).
     virtual cplx Interpolate(double t) = 0;
 
+    // Interpolates every t at once. Contours whose Interpolate evaluates a
+    // function override this to evaluate it in one batch.
+    virtual void InterpolateBatch(const std::vector<double>& t,
+                                  std::vector<cplx>& out);
+
     // Default function creates a Polygon by applying f to the subDiv points.
     // Overrides may return a polypmorphic pointer to any type of contour.
     virtual Contour* Map(ParsedFunc<cplx>& f, int res);
@@ -124,6 +130,10 @@ protected:
 
     cplx center;
 
+    // Parameter-free parts of the mapped function at the points Map() last
+    // used, so animating a parameter doesn't recompute them.
+    SubtreeCache<cplx> mapCache;
+
 private:
     template <class Archive>
     void serialize(Archive& ar, const unsigned int version)
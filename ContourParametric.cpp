@@ -14,38 +14,41 @@ ContourParametric::ContourParametric(std::string func, int res, wxColor col,
     f.SetIV("t");
 }
 
-void ContourParametric::Draw(wxDC* dc, ComplexPlane* canvas)
+void ContourParametric::SampleCurve(double tStep, std::vector<cplx>& pts)
 {
-    double tStep = 1.0 / canvas->GetRes();
     const double TOL = 1e-9;
-    double tLast = tStart;
-    for (double t = tStart + tStep; t < tEnd + TOL; t += tStep)
+    pts.clear();
+    for (double t = tStart; t < tEnd + TOL; t += tStep)
+        pts.push_back(t);
+    f.EvalBatch(pts.data(), pts.data(), pts.size());
+}
+
+void ContourParametric::Draw(wxDC* dc, ComplexPlane* canvas)
+{
+    std::vector<cplx> pts;
+    SampleCurve(1.0 / canvas->GetRes(), pts);
+    for (size_t i = 1; i < pts.size(); i++)
     {
-        DrawClippedLine(canvas->ComplexToScreen(f(tLast)),
-            canvas->ComplexToScreen(f(t)), dc, canvas);
-        tLast = t;
+        DrawClippedLine(canvas->ComplexToScreen(pts[i - 1]),
+            canvas->ComplexToScreen(pts[i]), dc, canvas);
     }
 }
 
 bool ContourParametric::IsPointOnContour(cplx pt, ComplexPlane* canvas, int pixPrecision)
 {
-    auto checkDist = [&](cplx pt, double t1, double t2) {
-        auto pt1 = f(t1);
-        auto pt2 = f(t2);
+    auto checkDist = [&](cplx pt, cplx pt1, cplx pt2) {
         auto d = DistancePointToLine(pt, pt1, pt2);
         return ((d < canvas->ScreenXToLength(pixPrecision) ||
             d < canvas->ScreenYToLength(pixPrecision)) &&
             IsInsideBox(pt, pt1, pt2));
     };
 
-    double tStep = 1.0 / canvas->GetRes();
-    const double TOL = 1e-9;
-    double tLast = tStart;
-    for (double t = tStart + tStep; t < tEnd + TOL; t += tStep)
+    std::vector<cplx> pts;
+    SampleCurve(1.0 / canvas->GetRes(), pts);
+    for (size_t i = 1; i < pts.size(); i++)
     {
-        if (checkDist(pt, tLast, t))
+        if (checkDist(pt, pts[i - 1], pts[i]))
             return true;
-        tLast = t;
     }
     return false;
 }
@@ -55,6 +58,15 @@ cplx ContourParametric::Interpolate(double t)
     return f(t * tEnd + (1 - t) * tStart);
 }
 
+void ContourParametric::InterpolateBatch(const std::vector<double>& t,
+                                         std::vector<cplx>& out)
+{
+    out.resize(t.size());
+    for (size_t i = 0; i < t.size(); i++)
+        out[i] = t[i] * tEnd + (1 - t[i]) * tStart;
+    f.EvalBatch(out.data(), out.data(), out.size());
+}
+
 void ContourParametric::PopulateMenu(ToolPanel* TP)
 {
     auto panel = TP->intermediate;
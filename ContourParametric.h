@@ -24,6 +24,7 @@ public:
     void AddPoint(cplx c) {}
 
     cplx Interpolate(double t);
+    void InterpolateBatch(const std::vector<double>& t, std::vector<cplx>& out);
     void SetFunction(std::string func) { f = parser.Parse(func); }
     auto GetFunctionPtr() { return &f; }
     void Finalize() { CalcCenter(); }
@@ -63,6 +64,9 @@ private:
     Parser<cplx> parser;
     ParsedFunc<cplx> f;
 
+    // Evaluates f at tStart, tStart + tStep, ..., up to tEnd.
+    void SampleCurve(double tStep, std::vector<cplx>& pts);
+
     template <class Archive>
     void serialize(Archive& ar, const unsigned int version)
     {
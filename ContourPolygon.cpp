@@ -163,6 +163,10 @@ Contour* ContourPolygon::Map(ParsedFunc<cplx>& f, int res)
     CalcSideLengths();
     double lengthTraversed = sideLengths[0];
 
+    // Points are collected first so f can be applied to all of them at once.
+    std::vector<cplx> pts;
+    pts.reserve(C->points.capacity());
+
     // Parameterize the contour in terms of perimeter, e.g. t is the
     // proportion of the contour traversed from the first point.
     for (double i = 0; i <= res; i++)
@@ -173,7 +177,7 @@ Contour* ContourPolygon::Map(ParsedFunc<cplx>& f, int res)
             // t just passed the edge of one side.
             sideIndex++;
             lengthTraversed += sideLengths[sideIndex];
-            C->AddPoint(f(points[sideIndex])); // add the endpoint of each segment
+            pts.push_back(points[sideIndex]); // add the endpoint of each segment
         }
         // Within one side, linearly interpolate the points
         // such that we get res points in total.
@@ -183,13 +187,17 @@ Contour* ContourPolygon::Map(ParsedFunc<cplx>& f, int res)
                 double sideParam = abs(t * perimeter - lengthTraversed) /
                     sideLengths[sideIndex];
                 if (sideIndex < points.size() - 1)
-                    C->AddPoint(f(points[(__int64)sideIndex + 1] *
-                    (1 - sideParam) + points[sideIndex] * sideParam));
+                    pts.push_back(points[(__int64)sideIndex + 1] *
+                    (1 - sideParam) + points[sideIndex] * sideParam);
                 else
-                    C->AddPoint(f(points[0] * (1 - sideParam) +
-                        points[sideIndex] * sideParam));
+                    pts.push_back(points[0] * (1 - sideParam) +
+                        points[sideIndex] * sideParam);
             }
     }
+    f.EvalBatch(pts.data(), pts.data(), pts.size(), mapCache);
+    for (auto& p : pts)
+        C->AddPoint(p);
+
     // Degenerate polygons may occur but are discarded by the code above.
     // In that case, put in two points so the drawing
     // functions have what they expect.
@@ -0,0 +1,311 @@
+#pragma once
+#include "SpecialFunctions.h"
+#include "zeta.h"
+
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+// Dual number val + d*eps, with eps^2 = 0. Evaluating an expression at
+// Dual(z, 1) gives f(z) in val and f'(z) in d, exactly as far as floating
+// point allows, in a single pass. Program<T> can run on Dual<T> registers,
+// see EvalContext<T>::EvalDerivative().
+template <typename T> class Dual
+{
+public:
+    Dual() : val(), d() {}
+    Dual(const T& v, const T& dv = T()) : val(v), d(dv) {}
+
+    T val;
+    T d;
+
+    Dual& operator+=(const Dual& b)
+    {
+        val += b.val;
+        d += b.d;
+        return *this;
+    }
+    Dual& operator-=(const Dual& b)
+    {
+        val -= b.val;
+        d -= b.d;
+        return *this;
+    }
+    Dual& operator*=(const Dual& b)
+    {
+        d   = d * b.val + val * b.d;
+        val = val * b.val;
+        return *this;
+    }
+    Dual& operator/=(const Dual& b)
+    {
+        val = val / b.val;
+        d   = (d - val * b.d) / b.val;
+        return *this;
+    }
+};
+
+template <typename T> inline Dual<T> operator+(Dual<T> a, const Dual<T>& b)
+{
+    return a += b;
+}
+template <typename T> inline Dual<T> operator-(Dual<T> a, const Dual<T>& b)
+{
+    return a -= b;
+}
+template <typename T> inline Dual<T> operator*(Dual<T> a, const Dual<T>& b)
+{
+    return a *= b;
+}
+template <typename T> inline Dual<T> operator/(Dual<T> a, const Dual<T>& b)
+{
+    return a /= b;
+}
+template <typename T> inline Dual<T> operator-(const Dual<T>& a)
+{
+    return Dual<T>(-a.val, -a.d);
+}
+template <typename T> inline Dual<T> operator/(double a, const Dual<T>& b)
+{
+    return Dual<T>(T(a)) / b;
+}
+template <typename T> inline bool operator==(const Dual<T>& a, const Dual<T>& b)
+{
+    return a.val == b.val && a.d == b.d;
+}
+
+// Elementary functions. Each applies the chain rule to the derivative of
+// the corresponding std function.
+
+template <typename T> inline Dual<T> exp(const Dual<T>& a)
+{
+    using std::exp;
+    T e = exp(a.val);
+    return Dual<T>(e, e * a.d);
+}
+template <typename T> inline Dual<T> log(const Dual<T>& a)
+{
+    using std::log;
+    return Dual<T>(log(a.val), a.d / a.val);
+}
+template <typename T> inline Dual<T> sqrt(const Dual<T>& a)
+{
+    using std::sqrt;
+    T s = sqrt(a.val);
+    return Dual<T>(s, a.d / (2.0 * s));
+}
+template <typename T> inline Dual<T> sin(const Dual<T>& a)
+{
+    using std::cos;
+    using std::sin;
+    return Dual<T>(sin(a.val), cos(a.val) * a.d);
+}
+template <typename T> inline Dual<T> cos(const Dual<T>& a)
+{
+    using std::cos;
+    using std::sin;
+    return Dual<T>(cos(a.val), -sin(a.val) * a.d);
+}
+template <typename T> inline Dual<T> tan(const Dual<T>& a)
+{
+    using std::tan;
+    T t = tan(a.val);
+    return Dual<T>(t, (1.0 + t * t) * a.d);
+}
+template <typename T> inline Dual<T> sinh(const Dual<T>& a)
+{
+    using std::cosh;
+    using std::sinh;
+    return Dual<T>(sinh(a.val), cosh(a.val) * a.d);
+}
+template <typename T> inline Dual<T> cosh(const Dual<T>& a)
+{
+    using std::cosh;
+    using std::sinh;
+    return Dual<T>(cosh(a.val), sinh(a.val) * a.d);
+}
+template <typename T> inline Dual<T> tanh(const Dual<T>& a)
+{
+    using std::tanh;
+    T t = tanh(a.val);
+    return Dual<T>(t, (1.0 - t * t) * a.d);
+}
+template <typename T> inline Dual<T> asin(const Dual<T>& a)
+{
+    using std::asin;
+    using std::sqrt;
+    return Dual<T>(asin(a.val), a.d / sqrt(1.0 - a.val * a.val));
+}
+template <typename T> inline Dual<T> acos(const Dual<T>& a)
+{
+    using std::acos;
+    using std::sqrt;
+    return Dual<T>(acos(a.val), -a.d / sqrt(1.0 - a.val * a.val));
+}
+template <typename T> inline Dual<T> atan(const Dual<T>& a)
+{
+    using std::atan;
+    return Dual<T>(atan(a.val), a.d / (1.0 + a.val * a.val));
+}
+template <typename T> inline Dual<T> asinh(const Dual<T>& a)
+{
+    using std::asinh;
+    using std::sqrt;
+    return Dual<T>(asinh(a.val), a.d / sqrt(a.val * a.val + 1.0));
+}
+// Written with two square roots so the branch cut matches std::acosh.
+template <typename T> inline Dual<T> acosh(const Dual<T>& a)
+{
+    using std::acosh;
+    using std::sqrt;
+    return Dual<T>(acosh(a.val),
+                   a.d / (sqrt(a.val - 1.0) * sqrt(a.val + 1.0)));
+}
+template <typename T> inline Dual<T> atanh(const Dual<T>& a)
+{
+    using std::atanh;
+    return Dual<T>(atanh(a.val), a.d / (1.0 - a.val * a.val));
+}
+
+// A constant exponent avoids log(a), so powers of zero still get a
+// derivative.
+template <typename T> inline Dual<T> pow(const Dual<T>& a, const Dual<T>& b)
+{
+    using std::log;
+    using std::pow;
+    T p = pow(a.val, b.val);
+    if (b.d == T()) return Dual<T>(p, b.val * pow(a.val, b.val - 1.0) * a.d);
+    return Dual<T>(p, p * (b.d * log(a.val) + b.val * a.d / a.val));
+}
+
+template <typename T> inline Dual<T> zeta(const Dual<T>& a)
+{
+    auto [val, deriv] = zeta_with_derivative(a.val);
+    return Dual<T>(val, deriv * a.d);
+}
+
+template <typename T> inline Dual<T> Gamma(const Dual<T>& a)
+{
+    T g = Gamma(a.val);
+    return Dual<T>(g, g * Digamma(a.val) * a.d);
+}
+template <typename T> inline Dual<T> LogGamma(const Dual<T>& a)
+{
+    return Dual<T>(LogGamma(a.val), Digamma(a.val) * a.d);
+}
+template <typename T> inline Dual<T> Digamma(const Dual<T>& a)
+{
+    return Dual<T>(Digamma(a.val), Trigamma(a.val) * a.d);
+}
+template <typename T> inline Dual<T> Erf(const Dual<T>& a)
+{
+    using std::exp;
+    const double TWO_OVER_SQRT_PI = 1.1283791670955126;
+    return Dual<T>(Erf(a.val), TWO_OVER_SQRT_PI * exp(-a.val * a.val) * a.d);
+}
+template <typename T> inline Dual<T> Erfc(const Dual<T>& a)
+{
+    using std::exp;
+    const double TWO_OVER_SQRT_PI = 1.1283791670955126;
+    return Dual<T>(Erfc(a.val),
+                   -TWO_OVER_SQRT_PI * exp(-a.val * a.val) * a.d);
+}
+// K' = (E - (1 - m) K) / 2m(1 - m) and E' = (E - K) / 2m, which tend to
+// pi/8 and -pi/8 at m = 0.
+template <typename T> inline Dual<T> EllipticK(const Dual<T>& a)
+{
+    const T m = a.val, K = EllipticK(m), E = EllipticE(m);
+    if (m == T()) return Dual<T>(K, M_PI / 8 * a.d);
+    return Dual<T>(K, (E - (1.0 - m) * K) / (2.0 * m * (1.0 - m)) * a.d);
+}
+template <typename T> inline Dual<T> EllipticE(const Dual<T>& a)
+{
+    const T m = a.val, K = EllipticK(m), E = EllipticE(m);
+    if (m == T()) return Dual<T>(E, -M_PI / 8 * a.d);
+    return Dual<T>(E, (E - K) / (2.0 * m) * a.d);
+}
+
+// The order of a Bessel function is an integer, so only z has a derivative.
+template <typename T>
+inline Dual<T> BesselJ(const Dual<T>& n, const Dual<T>& z)
+{
+    const T below = BesselJ(n.val - 1.0, z.val);
+    const T above = BesselJ(n.val + 1.0, z.val);
+    return Dual<T>(BesselJ(n.val, z.val), (below - above) / 2.0 * z.d);
+}
+template <typename T>
+inline Dual<T> BesselI(const Dual<T>& n, const Dual<T>& z)
+{
+    const T below = BesselI(n.val - 1.0, z.val);
+    const T above = BesselI(n.val + 1.0, z.val);
+    return Dual<T>(BesselI(n.val, z.val), (below + above) / 2.0 * z.d);
+}
+
+// d/dz Li_s(z) = Li_(s-1)(z) / z, which is 1 at z = 0. The derivative in s
+// is taken by central differences, like functions that aren't built in.
+template <typename T>
+inline Dual<T> Polylog(const Dual<T>& s, const Dual<T>& z)
+{
+    const double h = 1e-6;
+    Dual<T> result(Polylog(s.val, z.val));
+    if (z.d != T())
+    {
+        const T dz = z.val == T() ? T(1.0)
+                                  : Polylog(s.val - 1.0, z.val) / z.val;
+        result.d += dz * z.d;
+    }
+    if (s.d != T())
+        result.d += (Polylog(s.val + h, z.val) - Polylog(s.val - h, z.val)) /
+                    (2 * h) * s.d;
+    return result;
+}
+
+// Functions known only as a std::function, i.e. not built in, are
+// differentiated by central differences in each argument.
+template <typename T>
+inline Dual<T> ApplyCallable(const std::function<T(const T*)>& f,
+                             const Dual<T>* args, unsigned int arity)
+{
+    constexpr unsigned int MAX_ARITY = 8;
+    const double h                   = 1e-6;
+
+    T x[MAX_ARITY];
+    for (unsigned int j = 0; j < arity; j++)
+        x[j] = args[j].val;
+
+    Dual<T> result(f(x));
+    for (unsigned int j = 0; j < arity; j++)
+    {
+        if (args[j].d == T()) continue;
+        const T xj = x[j];
+        x[j]       = xj + h;
+        T fPlus    = f(x);
+        x[j]       = xj - h;
+        T fMinus   = f(x);
+        x[j]       = xj;
+        result.d += (fPlus - fMinus) / (2 * h) * args[j].d;
+    }
+    return result;
+}
+
+// For sums and products: a term is negligible once it changes neither the
+// value nor the derivative.
+template <typename T>
+inline bool Negligible(const Dual<T>& change, const Dual<T>& scale)
+{
+    using std::abs;
+    const double eps = std::numeric_limits<double>::epsilon();
+    return abs(change.val) <= eps * abs(scale.val) &&
+           abs(change.d) <= eps * abs(scale.d);
+}
+
+template <typename T> inline bool LoopBound(const Dual<T>& x, double& bound)
+{
+    if constexpr (std::is_arithmetic_v<T>)
+        bound = x.val;
+    else
+        bound = x.val.real();
+    return true;
+}
@@ -1,7 +1,6 @@
 #include "Grid.h"
 
-//#include <thread>
-//#include <execution>
+#include <thread>
 
 BOOST_CLASS_EXPORT_IMPLEMENT(TransformedGrid)
 
@@ -52,16 +51,59 @@ void TransformedGrid::MapGrid(const Grid& grid, ParsedFunc<cplx>& f)
     lines.clear();
     lines.reserve(grid.lines.size());
 
+    // Evaluate every point of every line in one batch.
+    const size_t perLine = (size_t)res + 1;
+    std::vector<cplx> pts;
+    pts.reserve(grid.lines.size() * perLine);
     for (auto& v : grid.lines)
     {
         auto p1 = v->GetCtrlPoint(0);
         auto p2 = v->GetCtrlPoint(1);
-        lines.push_back(std::make_unique<ContourPolygon>());
-        double t;
         for (double i = 0; i <= res; i++)
         {
-            t        = i / res;
-            cplx p_i = f(p1 * t + p2 * (1 - t));
+            double t = i / res;
+            pts.push_back(p1 * t + p2 * (1 - t));
+        }
+    }
+    std::vector<cplx> out(pts.size());
+    EvalContext<cplx> context = f.CreateContext();
+    // Precision is chosen once for the whole grid, not per thread or batch.
+    cache.Prepare(context, pts.data(), pts.size(),
+                  context.ChoosePrecision(pts.data(), pts.size()));
+
+    // Large grids are split between threads, each with its own context on
+    // the shared compiled function.
+    const size_t threadCount =
+        std::min<size_t>(std::thread::hardware_concurrency(),
+                         pts.size() / MIN_POINTS_PER_THREAD);
+    if (threadCount > 1)
+    {
+        std::vector<std::thread> threads;
+        const size_t chunk = (pts.size() + threadCount - 1) / threadCount;
+        for (size_t first = 0; first < pts.size(); first += chunk)
+        {
+            size_t count = std::min(chunk, pts.size() - first);
+            threads.emplace_back(
+                [this, &out, first, count](EvalContext<cplx> context) {
+                    cache.EvalRange(context, out.data(), first, count);
+                },
+                context);
+        }
+        for (auto& th : threads)
+            th.join();
+    }
+    else
+        cache.EvalRange(context, out.data(), 0, pts.size());
+
+    for (size_t k = 0; k < grid.lines.size(); k++)
+    {
+        auto p1 = grid.lines[k]->GetCtrlPoint(0);
+        auto p2 = grid.lines[k]->GetCtrlPoint(1);
+        lines.push_back(std::make_unique<ContourPolygon>());
+        for (size_t i = 0; i < perLine; i++)
+        {
+            double t = (double)i / res;
+            cplx p_i = out[k * perLine + i];
 
             // In the case of division by zero, move along the gridline
             // a bit further until we find a defined point.
@@ -75,52 +117,4 @@ void TransformedGrid::MapGrid(const Grid& grid, ParsedFunc<cplx>& f)
             lines.back()->AddPoint(p_i);
         }
     }
-    // Multithreaded version of the same code. Functions, but isn't noticeably
-    //  faster. Drawing is probably the bottleneck.
-
-    // auto size = grid->lines.size();
-    // for (int i= 0; i < size; i++)
-    //   lines.push_back(new ContourPolygon());
-
-    // std::vector<ParsedFunc<cplx>> funcs;
-    // std::vector<std::thread> threads;
-    // auto threadCount = std::thread::hardware_concurrency();
-    //
-    // copy function once per thread because it isn't thread safe
-    // (for testing purposes. copies would be precalculated in real code)
-    // for (size_t thrd = 0; thrd < threadCount; thrd++)
-    //   funcs.push_back(f);
-    // for (size_t thrd = 0; thrd < threadCount; thrd++) {
-    //   threads.emplace_back([this, &grid, &funcs, size, thrd, threadCount]() {
-    //      double t;
-    //      for (size_t k = thrd; k < size; k += threadCount) {
-    //         for (double i = 0; i <= res; i++) {
-    //            t      = i / res;
-    //            auto v = grid->lines[k];
-    //            lines[k]->AddPoint(funcs[thrd](v->GetCtrlPoint(0) * t +
-    //                                 v->GetCtrlPoint(1) * (1 - t)));
-
-    //            // In the case of division by zero, move along the gridline
-    //            // a bit further until we find a defined point.
-    //            // Rarely should this take more than one step.
-    //            while (isnan(lines[k]->GetCtrlPoint(i).real())) {
-    //               lines[k]->RemovePoint(i);
-    //               double t_avoid_pole = i / res / 100;
-    //               lines[k]->AddPoint(
-    //                   funcs[thrd](v->GetCtrlPoint(0) * (t + t_avoid_pole) +
-    //                     v->GetCtrlPoint(1) * (1 - t - t_avoid_pole)));
-    //            }
-    //            while (isnan(lines[k]->GetCtrlPoint(i).imag())) {
-    //               lines[k]->RemovePoint(i);
-    //               double t_avoid_pole = i / res / 100;
-    //               lines[k]->AddPoint(
-    //                   funcs[thrd](v->GetCtrlPoint(0) * (t + t_avoid_pole) +
-    //                     v->GetCtrlPoint(1) * (1 - t - t_avoid_pole)));
-    //            }
-    //         }
-    //      }
-    //   });
-    //}
-    // for (auto& th : threads)
-    //   th.join();
 }
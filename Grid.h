@@ -18,6 +18,7 @@
 
 #include "ContourLine.h"
 #include "ContourPolygon.h"
+#include "SubtreeCache.h"
 
 typedef std::complex<double> cplx;
 
@@ -79,6 +80,13 @@ public:
 private:
     std::vector<std::unique_ptr<ContourPolygon>> lines;
 
+    // While only parameters change, the grid points stay the same, and the
+    // parts of f which don't depend on them are kept here.
+    SubtreeCache<cplx> cache;
+
+    // Below this many points per thread, MapGrid stays on one thread.
+    static constexpr size_t MIN_POINTS_PER_THREAD = 4096;
+
     template <class Archive>
     void serialize(Archive& ar, const unsigned int version)
     {
@@ -322,7 +322,7 @@ void InputPlane::OnMouseRightUp(wxMouseEvent& mouse)
     }
     ComplexPlane::OnMouseRightUp(mouse);
     for (auto out : outputs)
-        out->CalcZerosAndPoles();
+        out->TrackZerosAndPoles();
     Redraw();
 }
 
@@ -342,7 +342,7 @@ void InputPlane::OnMouseWheel(wxMouseEvent& mouse)
         for (auto out : outputs)
         {
             out->movedViewPort = true;
-            out->CalcZerosAndPoles();
+            out->TrackZerosAndPoles();
         }
         grid.CalcVisibleGrid();
         Redraw();
@@ -401,7 +401,7 @@ void InputPlane::OnPaint(wxPaintEvent& paint)
             if (A->animateGrid) animateGrid = true;
         }
         if (showZeros)
-            for (auto out : outputs) out->CalcZerosAndPoles();
+            for (auto out : outputs) out->TrackZerosAndPoles();
     }
     if (animateGrid)
     {
@@ -742,7 +742,7 @@ bool InputPlane::DrawFrame(wxBitmap& image, double t)
         dc.SetPen(pen);
         for (auto out : outputs)
         {
-            out->CalcZerosAndPoles();
+            out->CalcZerosAndPolesNow();
             for (auto& P : out->zerosAndPoles)
             {
                 P->Draw(&dc, this);
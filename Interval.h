@@ -0,0 +1,404 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <limits>
+
+// Interval [lo, hi] of real numbers. Every operation returns an interval
+// containing the result for every choice of points in its arguments, with
+// the bounds rounded outwards so floating point error can't shrink it.
+// Anything that can't be bounded (overflow, division by an interval
+// containing zero, NaN) gives the whole real line.
+struct Interval
+{
+    Interval() = default;
+    Interval(double x) : lo(x), hi(x) {}
+    Interval(double l, double h) : lo(l), hi(h) {}
+
+    static Interval Entire()
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        return Interval(-inf, inf);
+    }
+
+    // [lo, hi] widened by ulps units in the last place each way. Library
+    // functions, which aren't correctly rounded, use more than one.
+    static Interval Outward(double lo, double hi, int ulps = 1)
+    {
+        if (std::isnan(lo) || std::isnan(hi)) return Entire();
+        const double inf = std::numeric_limits<double>::infinity();
+        for (int k = 0; k < ulps; k++)
+        {
+            lo = std::nextafter(lo, -inf);
+            hi = std::nextafter(hi, inf);
+        }
+        return Interval(lo, hi);
+    }
+
+    bool Contains(double x) const { return lo <= x && x <= hi; }
+    bool IsBounded() const { return std::isfinite(lo) && std::isfinite(hi); }
+    double Mag() const { return std::max(std::abs(lo), std::abs(hi)); }
+    // Distance from 0 to the nearest point.
+    double Mig() const
+    {
+        return Contains(0) ? 0 : std::min(std::abs(lo), std::abs(hi));
+    }
+
+    double lo = 0;
+    double hi = 0;
+};
+
+inline Interval operator+(const Interval& a, const Interval& b)
+{
+    return Interval::Outward(a.lo + b.lo, a.hi + b.hi);
+}
+inline Interval operator-(const Interval& a, const Interval& b)
+{
+    return Interval::Outward(a.lo - b.hi, a.hi - b.lo);
+}
+inline Interval operator-(const Interval& a) { return Interval(-a.hi, -a.lo); }
+inline Interval operator*(const Interval& a, const Interval& b)
+{
+    double p[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+    for (double x : p)
+    {
+        // 0 * inf
+        if (std::isnan(x)) return Interval::Entire();
+    }
+    return Interval::Outward(*std::min_element(p, p + 4),
+                             *std::max_element(p, p + 4));
+}
+inline Interval operator/(const Interval& a, const Interval& b)
+{
+    if (b.Contains(0)) return Interval::Entire();
+    double q[4] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+    for (double x : q)
+    {
+        if (std::isnan(x)) return Interval::Entire();
+    }
+    return Interval::Outward(*std::min_element(q, q + 4),
+                             *std::max_element(q, q + 4));
+}
+
+// a squared. Unlike a * a, this never goes below zero.
+inline Interval Sqr(const Interval& a)
+{
+    const double lo = a.Mig();
+    const double hi = a.Mag();
+    Interval r      = Interval::Outward(lo * lo, hi * hi);
+    r.lo            = std::max(r.lo, 0.0);
+    return r;
+}
+
+inline Interval exp(const Interval& a)
+{
+    Interval r = Interval::Outward(std::exp(a.lo), std::exp(a.hi), 2);
+    r.lo       = std::max(r.lo, 0.0);
+    return r;
+}
+// Points below zero are ignored; only used here for moduli.
+inline Interval log(const Interval& a)
+{
+    return Interval::Outward(std::log(std::max(a.lo, 0.0)), std::log(a.hi), 2);
+}
+inline Interval sqrt(const Interval& a)
+{
+    Interval r =
+        Interval::Outward(std::sqrt(std::max(a.lo, 0.0)), std::sqrt(a.hi));
+    r.lo = std::max(r.lo, 0.0);
+    return r;
+}
+inline Interval sinh(const Interval& a)
+{
+    return Interval::Outward(std::sinh(a.lo), std::sinh(a.hi), 2);
+}
+inline Interval cosh(const Interval& a)
+{
+    Interval r = Interval::Outward(std::cosh(a.Mig()), std::cosh(a.Mag()), 2);
+    r.lo = std::max(r.lo, 1.0);
+    return r;
+}
+
+// Range of sin or cos, each with period 2pi, over a. peak is where f is 1;
+// it is -1 half a period later. Turning points that may lie just outside a
+// are counted as inside, which only widens the result.
+inline Interval PeriodicRange(const Interval& a, double (*f)(double),
+                              double peak)
+{
+    const double twoPi = 2 * M_PI;
+    // A whole period, or too large to reduce accurately.
+    if (!(a.hi - a.lo < twoPi) || a.Mag() > 1e15) return Interval(-1, 1);
+
+    const double tol = 8 * std::numeric_limits<double>::epsilon() *
+                       std::max(1.0, a.Mag());
+    const double flo = f(a.lo);
+    const double fhi = f(a.hi);
+    Interval r =
+        Interval::Outward(std::min(flo, fhi), std::max(flo, fhi), 2);
+
+    const double top = peak + twoPi * std::ceil((a.lo - tol - peak) / twoPi);
+    if (top <= a.hi + tol) r.hi = 1;
+    const double bottom =
+        peak + M_PI + twoPi * std::ceil((a.lo - tol - peak - M_PI) / twoPi);
+    if (bottom <= a.hi + tol) r.lo = -1;
+    r.lo = std::max(r.lo, -1.0);
+    r.hi = std::min(r.hi, 1.0);
+    return r;
+}
+inline Interval sin(const Interval& a)
+{
+    return PeriodicRange(a, [](double x) { return std::sin(x); }, M_PI / 2);
+}
+inline Interval cos(const Interval& a)
+{
+    return PeriodicRange(a, [](double x) { return std::cos(x); }, 0);
+}
+
+// Rectangle re + im*i in the complex plane. Program<T> can run on these in
+// place of std::complex<double>, giving a box which contains f(z) for every
+// z in the input box; see EvalContext<T>::ChoosePrecision(). Bounds can be
+// loose, particularly for wide boxes, but never too tight. Functions with
+// no useful bounds here (zeta, the other special functions and
+// user-defined functions) give the whole plane.
+//
+// There's deliberately no real() and imag(), so the interpreter doesn't
+// treat this as std::complex.
+struct ComplexInterval
+{
+    ComplexInterval() = default;
+    ComplexInterval(double x) : re(x), im(0) {}
+    ComplexInterval(const std::complex<double>& z) : re(z.real()), im(z.imag())
+    {
+    }
+    ComplexInterval(const Interval& r, const Interval& i) : re(r), im(i) {}
+    // The box with opposite corners a and b.
+    ComplexInterval(const std::complex<double>& a,
+                    const std::complex<double>& b)
+        : re(std::min(a.real(), b.real()), std::max(a.real(), b.real())),
+          im(std::min(a.imag(), b.imag()), std::max(a.imag(), b.imag()))
+    {
+    }
+
+    static ComplexInterval Entire()
+    {
+        return ComplexInterval(Interval::Entire(), Interval::Entire());
+    }
+
+    bool Contains(const std::complex<double>& z) const
+    {
+        return re.Contains(z.real()) && im.Contains(z.imag());
+    }
+    bool Intersects(const ComplexInterval& b) const
+    {
+        return re.lo <= b.re.hi && b.re.lo <= re.hi && im.lo <= b.im.hi &&
+               b.im.lo <= im.hi;
+    }
+    bool IsBounded() const { return re.IsBounded() && im.IsBounded(); }
+
+    Interval re;
+    Interval im;
+};
+
+inline ComplexInterval operator+(const ComplexInterval& a,
+                                 const ComplexInterval& b)
+{
+    return ComplexInterval(a.re + b.re, a.im + b.im);
+}
+inline ComplexInterval operator-(const ComplexInterval& a,
+                                 const ComplexInterval& b)
+{
+    return ComplexInterval(a.re - b.re, a.im - b.im);
+}
+inline ComplexInterval operator-(const ComplexInterval& a)
+{
+    return ComplexInterval(-a.re, -a.im);
+}
+inline ComplexInterval operator*(const ComplexInterval& a,
+                                 const ComplexInterval& b)
+{
+    return ComplexInterval(a.re * b.re - a.im * b.im,
+                           a.re * b.im + a.im * b.re);
+}
+// a * conj(b) / |b|^2.
+inline ComplexInterval operator/(const ComplexInterval& a,
+                                 const ComplexInterval& b)
+{
+    Interval d = Sqr(b.re) + Sqr(b.im);
+    return ComplexInterval((a.re * b.re + a.im * b.im) / d,
+                           (a.im * b.re - a.re * b.im) / d);
+}
+inline ComplexInterval operator/(double a, const ComplexInterval& b)
+{
+    return ComplexInterval(a) / b;
+}
+
+// |z| over a box.
+inline Interval Modulus(const ComplexInterval& a)
+{
+    return Interval::Outward(std::hypot(a.re.Mig(), a.im.Mig()),
+                             std::hypot(a.re.Mag(), a.im.Mag()));
+}
+// Principal argument over a box. Boxes touching the negative real axis
+// could be on either side of the branch cut, so get [-pi, pi]. Otherwise the
+// extremes are at the corners.
+inline Interval Arg(const ComplexInterval& a)
+{
+    if (a.re.lo <= 0 && a.im.Contains(0))
+        return Interval::Outward(-M_PI, M_PI);
+    double c[4] = {std::atan2(a.im.lo, a.re.lo), std::atan2(a.im.lo, a.re.hi),
+                   std::atan2(a.im.hi, a.re.lo), std::atan2(a.im.hi, a.re.hi)};
+    return Interval::Outward(*std::min_element(c, c + 4),
+                             *std::max_element(c, c + 4), 2);
+}
+inline ComplexInterval FromPolar(const Interval& r, const Interval& theta)
+{
+    return ComplexInterval(r * cos(theta), r * sin(theta));
+}
+
+inline ComplexInterval exp(const ComplexInterval& a)
+{
+    Interval e = exp(a.re);
+    return ComplexInterval(e * cos(a.im), e * sin(a.im));
+}
+inline ComplexInterval log(const ComplexInterval& a)
+{
+    return ComplexInterval(log(Modulus(a)), Arg(a));
+}
+inline ComplexInterval sqrt(const ComplexInterval& a)
+{
+    return FromPolar(sqrt(Modulus(a)), Arg(a) * Interval(0.5));
+}
+
+inline ComplexInterval sin(const ComplexInterval& a)
+{
+    return ComplexInterval(sin(a.re) * cosh(a.im), cos(a.re) * sinh(a.im));
+}
+inline ComplexInterval cos(const ComplexInterval& a)
+{
+    return ComplexInterval(cos(a.re) * cosh(a.im), -(sin(a.re) * sinh(a.im)));
+}
+inline ComplexInterval tan(const ComplexInterval& a) { return sin(a) / cos(a); }
+inline ComplexInterval sinh(const ComplexInterval& a)
+{
+    return ComplexInterval(sinh(a.re) * cos(a.im), cosh(a.re) * sin(a.im));
+}
+inline ComplexInterval cosh(const ComplexInterval& a)
+{
+    return ComplexInterval(cosh(a.re) * cos(a.im), sinh(a.re) * sin(a.im));
+}
+inline ComplexInterval tanh(const ComplexInterval& a)
+{
+    return sinh(a) / cosh(a);
+}
+
+// The inverse functions use the principal-branch identities in terms of log
+// and sqrt, which agree with the std versions off their branch cuts. Boxes
+// on a cut are covered on both sides by Arg().
+inline ComplexInterval asinh(const ComplexInterval& a)
+{
+    return log(a + sqrt(a * a + ComplexInterval(1.0)));
+}
+inline ComplexInterval asin(const ComplexInterval& a)
+{
+    const ComplexInterval i(std::complex<double>(0, 1));
+    return -i * asinh(i * a);
+}
+inline ComplexInterval acos(const ComplexInterval& a)
+{
+    return ComplexInterval(M_PI / 2) - asin(a);
+}
+inline ComplexInterval acosh(const ComplexInterval& a)
+{
+    const ComplexInterval one(1.0);
+    return log(a + sqrt(a + one) * sqrt(a - one));
+}
+inline ComplexInterval atanh(const ComplexInterval& a)
+{
+    const ComplexInterval one(1.0);
+    return ComplexInterval(0.5) * (log(one + a) - log(one - a));
+}
+inline ComplexInterval atan(const ComplexInterval& a)
+{
+    const ComplexInterval i(std::complex<double>(0, 1));
+    return -i * atanh(i * a);
+}
+
+// Small integer exponents, which are common, are done by repeated
+// multiplication; anything else as exp(b log a).
+inline ComplexInterval pow(const ComplexInterval& a, const ComplexInterval& b)
+{
+    const double n = b.re.lo;
+    if (b.re.hi == n && b.im.lo == 0 && b.im.hi == 0 && n == std::floor(n) &&
+        std::abs(n) <= 64)
+    {
+        ComplexInterval result(1.0);
+        ComplexInterval base = a;
+        for (unsigned int k = (unsigned int)std::abs(n); k; k >>= 1)
+        {
+            if (k & 1) result = result * base;
+            if (k > 1) base = base * base;
+        }
+        return n < 0 ? 1.0 / result : result;
+    }
+    return exp(b * log(a));
+}
+
+inline ComplexInterval zeta(const ComplexInterval&)
+{
+    return ComplexInterval::Entire();
+}
+
+// The same goes for the rest of the special functions.
+#define ENTIRE_FUNC(f)                                                         \
+    inline ComplexInterval f(const ComplexInterval&)                           \
+    {                                                                          \
+        return ComplexInterval::Entire();                                      \
+    }
+#define ENTIRE_FUNC2(f)                                                        \
+    inline ComplexInterval f(const ComplexInterval&, const ComplexInterval&)   \
+    {                                                                          \
+        return ComplexInterval::Entire();                                      \
+    }
+ENTIRE_FUNC(Gamma)
+ENTIRE_FUNC(LogGamma)
+ENTIRE_FUNC(Digamma)
+ENTIRE_FUNC(Erf)
+ENTIRE_FUNC(Erfc)
+ENTIRE_FUNC(EllipticK)
+ENTIRE_FUNC(EllipticE)
+ENTIRE_FUNC2(BesselJ)
+ENTIRE_FUNC2(BesselI)
+ENTIRE_FUNC2(Polylog)
+#undef ENTIRE_FUNC
+#undef ENTIRE_FUNC2
+
+// Nothing is known about functions that aren't built in.
+template <typename T>
+inline ComplexInterval ApplyCallable(const std::function<T(const T*)>& f,
+                                     const ComplexInterval* args,
+                                     unsigned int arity)
+{
+    return ComplexInterval::Entire();
+}
+
+// Loops stop once a term can't change the sum by more than rounding does.
+inline bool Negligible(const ComplexInterval& change,
+                       const ComplexInterval& scale)
+{
+    const double eps = std::numeric_limits<double>::epsilon();
+    return std::max(change.re.Mag(), change.im.Mag()) <=
+           eps * std::max(scale.re.Mig(), scale.im.Mig());
+}
+
+// The number of terms in a loop has to be known, so its bounds must be
+// single numbers, or within rounding of an integer.
+inline bool LoopBound(const ComplexInterval& x, double& bound)
+{
+    const Interval& b = x.re;
+    bound             = std::round(b.lo);
+    if (b.lo == b.hi) bound = b.lo;
+    return b.lo == b.hi || (std::round(b.hi) == bound &&
+                            b.hi - b.lo <= 1e-9 * std::max(1.0, b.Mag()));
+}
@@ -591,6 +591,7 @@ void MainFrame::OnExportAnimatedGif(wxCommandEvent& event)
         oa << *output << *input;
         boost::archive::text_iarchive ia(ss);
         ia >> *op >> *ip;
+        op->UseNativeFunction();
         ip->UpdateGrid();
         ip->RecalcAll();
 
@@ -0,0 +1,74 @@
+#pragma once
+#include "SpecialFunctions.h"
+#include "zeta.h"
+
+#include <boost/multiprecision/cpp_complex.hpp>
+
+#include <complex>
+#include <functional>
+
+// Complex numbers with more precision than double, for deep zooms where
+// double precision turns into visible noise. cplx32 has about the precision
+// of double-double arithmetic, cplx64 twice that. Both are much slower than
+// double, so they're only used where needed; see
+// EvalContext<T>::ChoosePrecision(). Program<T> can run on either.
+template <unsigned int Digits>
+using cplx_mp = boost::multiprecision::number<
+    boost::multiprecision::complex_adaptor<
+        boost::multiprecision::cpp_bin_float<Digits>>,
+    boost::multiprecision::et_off>;
+typedef cplx_mp<32> cplx32;
+typedef cplx_mp<64> cplx64;
+
+// Rounds to the nearest std::complex<double>.
+template <unsigned int Digits>
+inline std::complex<double> ToDouble(const cplx_mp<Digits>& z)
+{
+    return std::complex<double>((double)z.real(), (double)z.imag());
+}
+
+// zeta, the other special functions and functions that aren't built in are
+// only known in double precision.
+template <unsigned int Digits>
+inline cplx_mp<Digits> zeta(const cplx_mp<Digits>& s)
+{
+    return cplx_mp<Digits>(zeta(ToDouble(s)));
+}
+
+#define DOUBLE_FUNC(f)                                                         \
+    template <unsigned int Digits>                                             \
+    inline cplx_mp<Digits> f(const cplx_mp<Digits>& z)                         \
+    {                                                                          \
+        return cplx_mp<Digits>(f(ToDouble(z)));                                \
+    }
+#define DOUBLE_FUNC2(f)                                                        \
+    template <unsigned int Digits>                                             \
+    inline cplx_mp<Digits> f(const cplx_mp<Digits>& a,                         \
+                             const cplx_mp<Digits>& z)                         \
+    {                                                                          \
+        return cplx_mp<Digits>(f(ToDouble(a), ToDouble(z)));                   \
+    }
+DOUBLE_FUNC(Gamma)
+DOUBLE_FUNC(LogGamma)
+DOUBLE_FUNC(Digamma)
+DOUBLE_FUNC(Erf)
+DOUBLE_FUNC(Erfc)
+DOUBLE_FUNC(EllipticK)
+DOUBLE_FUNC(EllipticE)
+DOUBLE_FUNC2(BesselJ)
+DOUBLE_FUNC2(BesselI)
+DOUBLE_FUNC2(Polylog)
+#undef DOUBLE_FUNC
+#undef DOUBLE_FUNC2
+
+template <unsigned int Digits>
+inline cplx_mp<Digits> ApplyCallable(
+    const std::function<std::complex<double>(const std::complex<double>*)>& f,
+    const cplx_mp<Digits>* args, unsigned int arity)
+{
+    constexpr unsigned int MAX_ARITY = 8;
+    std::complex<double> x[MAX_ARITY];
+    for (unsigned int j = 0; j < arity; j++)
+        x[j] = ToDouble(args[j]);
+    return cplx_mp<Digits>(f(x));
+}
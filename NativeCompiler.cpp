@@ -0,0 +1,430 @@
+#include "NativeCompiler.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef _WIN32
+const char* LIBRARY_EXTENSION = ".dll";
+const char* DEFAULT_COMMAND = "cl /nologo /O2 /LD /EHsc /std:c++17 /arch:AVX2 "
+                              "{src} /Fe{out} /Fo{obj} > NUL";
+#else
+const char* LIBRARY_EXTENSION = ".so";
+const char* DEFAULT_COMMAND =
+    "c++ -O2 -shared -fPIC -std=c++17 {src} -o {out} > /dev/null 2>&1";
+#endif
+const char* KERNEL_SYMBOL = "ccontour_kernel";
+
+// Loads the library and returns its kernel, or nullptr.
+NativeKernelFn LoadKernel(const std::filesystem::path& lib,
+                          std::shared_ptr<void>& handle)
+{
+#ifdef _WIN32
+    HMODULE module = LoadLibraryW(lib.c_str());
+    if (!module) return nullptr;
+    handle = std::shared_ptr<void>(module, [](void* m) {
+        FreeLibrary(static_cast<HMODULE>(m));
+    });
+    return reinterpret_cast<NativeKernelFn>(
+        GetProcAddress(module, KERNEL_SYMBOL));
+#else
+    void* module = dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!module) return nullptr;
+    handle = std::shared_ptr<void>(module, [](void* m) { dlclose(m); });
+    return reinterpret_cast<NativeKernelFn>(dlsym(module, KERNEL_SYMBOL));
+#endif
+}
+
+// The per-user directory for cached kernels, or an empty path if there is
+// none: %LOCALAPPDATA% on Windows, otherwise $XDG_CACHE_HOME or ~/.cache.
+std::filesystem::path DefaultCacheDirectory()
+{
+#ifdef _WIN32
+    if (const char* local = std::getenv("LOCALAPPDATA"); local && *local)
+        return std::filesystem::path(local) / "CContour" / "Kernels";
+#else
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg == '/')
+        return std::filesystem::path(xdg) / "ccontour" / "kernels";
+    if (const char* home = std::getenv("HOME"); home && *home == '/')
+        return std::filesystem::path(home) / ".cache" / "ccontour" /
+               "kernels";
+#endif
+    return {};
+}
+
+// Whether only the current user could have written path, so a library
+// there is safe to load. Windows owners and ACLs aren't checked; instead
+// only the default directory, which is private to the user there, and what
+// is in it are trusted.
+bool IsPrivate(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    const std::filesystem::path dir = DefaultCacheDirectory();
+    if (dir.empty()) return false;
+    const std::filesystem::path rel =
+        path.lexically_normal().lexically_relative(dir.lexically_normal());
+    return !rel.empty() && *rel.begin() != "..";
+#else
+    struct stat info;
+    return lstat(path.c_str(), &info) == 0 && info.st_uid == geteuid() &&
+           !(info.st_mode & (S_IWGRP | S_IWOTH));
+#endif
+}
+
+// Creates dir, readable only by the current user, if it doesn't exist, and
+// returns whether it's private.
+bool PrepareDirectory(const std::filesystem::path& dir)
+{
+    std::error_code err;
+    if (dir.empty()) return false;
+    if (std::filesystem::create_directories(dir, err))
+        std::filesystem::permissions(dir, std::filesystem::perms::owner_all,
+                                     err);
+    return IsPrivate(dir);
+}
+
+// path as a single word for the shell std::system() runs, or an empty
+// string if it can't be quoted safely there: cmd.exe expands %VAR% even
+// between quotes.
+std::string QuotePath(const std::filesystem::path& path)
+{
+    const std::string s = path.string();
+#ifdef _WIN32
+    if (s.find_first_of("\"%") != std::string::npos) return "";
+    return "\"" + s + "\"";
+#else
+    std::string quoted = "'";
+    for (char c : s)
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    return quoted + "'";
+#endif
+}
+
+// 64-bit FNV-1a, as hex.
+std::string HashSource(const std::string& src)
+{
+    unsigned long long h = 14695981039346656037ull;
+    for (unsigned char c : src)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    std::ostringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << h;
+    return ss.str();
+}
+
+void ReplaceAll(std::string& s, const std::string& from, const std::string& to)
+{
+    for (size_t pos = s.find(from); pos != std::string::npos;
+         pos = s.find(from, pos + to.size()))
+        s.replace(pos, from.size(), to);
+}
+
+// C++ expression for a one-argument operation, or nullptr if the kernel
+// can't compute it.
+const char* UnaryTemplate(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::neg: return "-{a}";
+    case OpCode::exp: return "std::exp({a})";
+    case OpCode::log: return "std::log({a})";
+    case OpCode::sqrt: return "std::sqrt({a})";
+    case OpCode::sin: return "std::sin({a})";
+    case OpCode::cos: return "std::cos({a})";
+    case OpCode::tan: return "std::tan({a})";
+    case OpCode::sinh: return "std::sinh({a})";
+    case OpCode::cosh: return "std::cosh({a})";
+    case OpCode::tanh: return "std::tanh({a})";
+    case OpCode::asin: return "std::asin({a})";
+    case OpCode::acos: return "std::acos({a})";
+    case OpCode::atan: return "std::atan({a})";
+    case OpCode::asinh: return "std::asinh({a})";
+    case OpCode::acosh: return "std::acosh({a})";
+    case OpCode::atanh: return "std::atanh({a})";
+    case OpCode::sec: return "1.0 / std::cos({a})";
+    case OpCode::csc: return "1.0 / std::sin({a})";
+    case OpCode::cot: return "std::cos({a}) / std::sin({a})";
+    case OpCode::sech: return "1.0 / std::cosh({a})";
+    case OpCode::csch: return "1.0 / std::sinh({a})";
+    case OpCode::coth: return "std::cosh({a}) / std::sinh({a})";
+    case OpCode::asec: return "std::acos(1.0 / {a})";
+    case OpCode::acsc: return "std::asin(1.0 / {a})";
+    case OpCode::acot: return "std::atan(1.0 / {a})";
+    case OpCode::asech: return "std::acosh(1.0 / {a})";
+    case OpCode::acsch: return "std::asinh(1.0 / {a})";
+    case OpCode::acoth: return "std::atanh(1.0 / {a})";
+    default: return nullptr;
+    }
+}
+
+const char* BinaryTemplate(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::add: return "{a} + {b}";
+    case OpCode::sub: return "{a} - {b}";
+    case OpCode::mul: return "{a} * {b}";
+    case OpCode::div: return "{a} / {b}";
+    case OpCode::pow: return "std::pow({a}, {b})";
+    case OpCode::powr: return "std::pow({a}, {b}.real())";
+    default: return nullptr;
+    }
+}
+
+// Writes a statement for each instruction in [first, last), nesting the
+// bodies of loops inside them, and names the register each one writes.
+// Returns false if some operation can't be compiled. count numbers the
+// variables.
+bool EmitCode(const Program<cplx>& P, const Instruction* first,
+              const Instruction* last, const std::string& indent,
+              std::vector<std::string>& names, size_t& count,
+              std::ostringstream& src)
+{
+    for (const Instruction* it = first; it != last; ++it)
+    {
+        const Instruction& I = *it;
+        if (IsLoopOp(I.op))
+        {
+            // Same steps and stopping test as Program<cplx>::RunLoop().
+            const Program<cplx>::Loop& L = P.GetLoops()[I.a];
+            const bool product           = I.op == OpCode::prod;
+            const std::string total      = "t" + std::to_string(count++);
+            const std::string inner      = indent + "        ";
+            src << indent << "cplx " << total << "(" << (product ? 1 : 0)
+                << ".0);\n"
+                << indent << "{\n"
+                << indent << "    const double from = " << names[L.from]
+                << ".real(), to = " << names[L.to] << ".real();\n"
+                << indent << "    const bool canStop = to - from >= "
+                << Program<cplx>::EXACT_LOOP_TERMS << ";\n"
+                << indent << "    unsigned int quiet = 0;\n"
+                << indent << "    for (size_t j = 0; j < "
+                << Program<cplx>::MAX_LOOP_ITERATIONS
+                << " && from + j <= to; j++)\n"
+                << indent << "    {\n";
+            names[L.index] = "k" + std::to_string(count++);
+            src << inner << "const cplx " << names[L.index]
+                << "(from + j, 0.0);\n";
+            const auto& body = P.GetLoopCode();
+            if (!EmitCode(P, body.data() + L.begin, body.data() + L.end, inner,
+                          names, count, src))
+                return false;
+
+            const std::string& term = names[L.term];
+            std::string change      = term;
+            std::string scale       = total;
+            std::string start       = "0.0";
+            if (product)
+            {
+                change = "(" + term + " - 1.0)";
+                scale  = "cplx(1.0)";
+                start  = "1.0";
+            }
+            src << inner << total << (product ? " *= " : " += ") << term
+                << ";\n"
+                << inner << "quiet = std::max(std::abs(" << change
+                << ".real()), std::abs(" << change << ".imag())) <=\n"
+                << inner << "                eps * std::max(std::abs("
+                << scale << ".real()), std::abs(" << scale
+                << ".imag())) &&\n"
+                << inner << "                " << total << " != cplx(" << start
+                << ") ? quiet + 1 : 0;\n"
+                << inner << "if (canStop && quiet == "
+                << Program<cplx>::CONVERGED_TERMS << ") break;\n"
+                << indent << "    }\n"
+                << indent << "}\n";
+            names[I.dst] = total;
+            continue;
+        }
+
+        std::string expr;
+        if (const char* t = UnaryTemplate(I.op))
+            expr = t;
+        else if (const char* t = BinaryTemplate(I.op))
+        {
+            expr = t;
+            ReplaceAll(expr, "{b}", names[I.b]);
+        }
+        else
+            return false;
+        ReplaceAll(expr, "{a}", names[I.a]);
+
+        names[I.dst] = "t" + std::to_string(count++);
+        src << indent << "const cplx " << names[I.dst] << " = " << expr
+            << ";\n";
+    }
+    return true;
+}
+} // namespace
+
+NativeCompiler& NativeCompiler::Get()
+{
+    static NativeCompiler compiler;
+    return compiler;
+}
+
+NativeCompiler::NativeCompiler()
+{
+    cacheDir = DefaultCacheDirectory();
+    const char* env = std::getenv("CCONTOUR_CXX");
+    compilerCommand = env ? env : DEFAULT_COMMAND;
+}
+
+void NativeCompiler::SetCacheDirectory(const std::filesystem::path& dir)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    cacheDir = dir;
+}
+
+void NativeCompiler::SetCompilerCommand(const std::string& cmd)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    compilerCommand = cmd;
+}
+
+std::string NativeCompiler::EmitSource(const Program<cplx>& P, int ivSlot)
+{
+    const unsigned int leafCount =
+        (unsigned int)(P.GetConstants().size() + P.GetVarNames().size());
+    std::vector<std::string> names(P.GetRegisterCount());
+
+    std::ostringstream src;
+    src << "#include <algorithm>\n#include <cmath>\n#include <complex>\n"
+           "#include <cstddef>\n#include <limits>\n"
+           "typedef std::complex<double> cplx;\n"
+           "const double eps = std::numeric_limits<double>::epsilon();\n"
+           "#ifdef _WIN32\n"
+           "#define KERNEL_EXPORT extern \"C\" __declspec(dllexport)\n"
+           "#else\n#define KERNEL_EXPORT extern \"C\"\n#endif\n\n"
+           "KERNEL_EXPORT void "
+        << KERNEL_SYMBOL
+        << "(const double* leaves, const double* inRe, const double* inIm,\n"
+           "    size_t inStride, double* outRe, double* outIm, size_t "
+           "outStride, size_t n)\n{\n";
+    for (unsigned int r = 0; r < leafCount; r++)
+    {
+        names[r] = "r" + std::to_string(r);
+        if ((int)r == ivSlot) continue;
+        src << "    const cplx " << names[r] << "(leaves[" << 2 * r
+            << "], leaves[" << 2 * r + 1 << "]);\n";
+    }
+    src << "    for (size_t k = 0; k < n; k++)\n    {\n";
+    if (ivSlot >= 0)
+        src << "        const cplx " << names[ivSlot]
+            << "(inRe[k * inStride], inIm[k * inStride]);\n";
+
+    // Every instruction gets its own variable, and the optimizer takes care
+    // of register allocation.
+    const auto& code = P.GetCode();
+    size_t count     = 0;
+    if (!EmitCode(P, code.data(), code.data() + code.size(), "        ",
+                  names, count, src))
+        return "";
+
+    const std::string& result = names[P.GetResultRegister()];
+    src << "        outRe[k * outStride] = " << result << ".real();\n"
+        << "        outIm[k * outStride] = " << result << ".imag();\n"
+        << "    }\n}\n";
+    return src.str();
+}
+
+std::shared_ptr<const NativeKernel>
+NativeCompiler::Request(const Program<cplx>& P, int ivSlot)
+{
+    std::string src = EmitSource(P, ivSlot);
+    if (src.empty()) return nullptr;
+    std::string name = "kernel_" + HashSource(src);
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto it = kernels.begin(); it != kernels.end();)
+        it = it->second.expired() ? kernels.erase(it) : std::next(it);
+    if (auto it = kernels.find(name); it != kernels.end())
+        return it->second.lock();
+    // Libraries are only loaded from, and built in, a directory nobody else
+    // can write to, and whose path can be passed to the compiler.
+    if (!PrepareDirectory(cacheDir) || QuotePath(cacheDir).empty())
+        return nullptr;
+
+    auto kernel    = std::make_shared<NativeKernel>();
+    kernel->ivSlot = ivSlot;
+    kernels[name]  = kernel;
+
+    std::filesystem::path lib = cacheDir / (name + LIBRARY_EXTENSION);
+    std::error_code err;
+    if (std::filesystem::exists(lib, err) && IsPrivate(lib))
+    {
+        kernel->fn.store(LoadKernel(lib, kernel->library),
+                         std::memory_order_release);
+        if (kernel->fn) return kernel;
+    }
+
+    // Everything is built under a name of its own, and the library only
+    // renamed into place once complete, so neither a crash nor another
+    // instance building the same kernel can leave a partial one behind.
+    static std::atomic<unsigned int> builds{0};
+    std::ostringstream stem;
+    stem << name << ".tmp" << std::hex << std::random_device()() << builds++;
+    const std::filesystem::path tmp = cacheDir / stem.str();
+    std::filesystem::path srcFile   = tmp;
+    std::filesystem::path tmpLib    = tmp;
+    std::filesystem::path objFile   = tmp;
+    srcFile += ".cpp";
+    tmpLib += LIBRARY_EXTENSION;
+    objFile += ".obj";
+    std::string cmd = compilerCommand;
+    ReplaceAll(cmd, "{src}", QuotePath(srcFile));
+    ReplaceAll(cmd, "{out}", QuotePath(tmpLib));
+    ReplaceAll(cmd, "{obj}", QuotePath(objFile));
+
+    std::thread([kernel, src, cmd, srcFile, objFile, tmpLib, lib]() {
+        std::error_code err;
+        bool built = false;
+        {
+            std::ofstream out(srcFile);
+            out << src;
+            out.close();
+            built = out && std::system(cmd.c_str()) == 0;
+        }
+        std::filesystem::remove(srcFile, err);
+        std::filesystem::remove(objFile, err);
+        if (built) std::filesystem::rename(tmpLib, lib, err);
+        if (!built || err)
+        {
+            std::filesystem::remove(tmpLib, err);
+            return;
+        }
+        std::shared_ptr<void> handle;
+        NativeKernelFn fn = LoadKernel(lib, handle);
+        if (!fn) return;
+        // library is set before fn is published, and only released with
+        // the kernel.
+        kernel->library = handle;
+        kernel->fn.store(fn, std::memory_order_release);
+    }).detach();
+
+    return kernel;
+}
+
+void CompileNative(ParsedFunc<cplx>& f)
+{
+    const Program<cplx>& P = f.GetProgram();
+    f.SetNativeKernel(NativeCompiler::Get().Request(P, P.GetVarSlot(f.GetIV())));
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "NativeKernel.h"
+#include "Parser.h"
+
+typedef std::complex<double> cplx;
+
+// Optional native backend for ParsedFunc<cplx>. A compiled Program is turned
+// into C++ source, built into a shared library by the system compiler on a
+// background thread, and loaded into a NativeKernel. Libraries are cached on
+// disk, named by a hash of the generated source, so a function used again in
+// a later session loads immediately without recompiling. By default they
+// go in a per-user cache directory (under %LOCALAPPDATA% on Windows,
+// $XDG_CACHE_HOME or ~/.cache elsewhere), and nothing is loaded or built
+// unless that directory belongs to the current user and only they can write
+// to it. Windows ownership isn't checked, so only the default directory is
+// used there.
+//
+// The compiler command comes from the CCONTOUR_CXX environment variable if
+// set, otherwise a platform default ("cl" on Windows, which must be on the
+// PATH, e.g. from a developer command prompt). {src}, {out} and {obj} in the
+// command are replaced with file paths, already quoted for the shell. If
+// compiling fails, the kernel simply never becomes ready and the interpreter
+// carries on.
+class NativeCompiler
+{
+public:
+    static NativeCompiler& Get();
+
+    // Returns a kernel for P reading its input into register ivSlot, which
+    // becomes ready once compiled or loaded. Returns nullptr if P uses
+    // something only the interpreter has, i.e. zeta and the other special
+    // functions, or user functions, or if there's no private cache
+    // directory.
+    std::shared_ptr<const NativeKernel> Request(const Program<cplx>& P,
+                                                int ivSlot);
+
+    // The C++ source for P, or an empty string if it can't be compiled.
+    static std::string EmitSource(const Program<cplx>& P, int ivSlot);
+
+    void SetCacheDirectory(const std::filesystem::path& dir);
+    void SetCompilerCommand(const std::string& cmd);
+
+private:
+    NativeCompiler();
+
+    std::filesystem::path cacheDir;
+    std::string compilerCommand;
+    std::mutex lock;
+    std::map<std::string, std::weak_ptr<NativeKernel>> kernels;
+};
+
+// Attaches a native kernel to f, which it starts using as soon as the kernel
+// is ready. The kernel is dropped if f is recompiled.
+void CompileNative(ParsedFunc<cplx>& f);
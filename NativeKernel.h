@@ -0,0 +1,22 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Entry point of a Program<cplx> compiled to native code by NativeCompiler.
+// The arguments mirror Program<T>::RunBatch. leaves holds the constant and
+// variable registers as interleaved real and imaginary parts.
+typedef void (*NativeKernelFn)(const double* leaves, const double* inRe,
+                               const double* inIm, size_t inStride,
+                               double* outRe, double* outIm, size_t outStride,
+                               size_t n);
+
+// A kernel which may still be compiling. fn stays null until the library has
+// loaded and never changes after that, so evaluators can check it without
+// locking and keep interpreting in the meantime.
+struct NativeKernel
+{
+    std::atomic<NativeKernelFn> fn{nullptr};
+    std::shared_ptr<void> library; // Unloads the library when released.
+    int ivSlot = -1;               // Register the kernel reads input into.
+};
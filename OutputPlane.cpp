@@ -2,6 +2,13 @@
 #include "InputPlane.h"
 #include "ContourPoint.h"
 #include "zf.h"
+#include "NativeCompiler.h"
+#include "PresetKernels.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include <wx/dcgraph.h>
 #include <wx/richtooltip.h>
@@ -86,6 +93,7 @@ void OutputPlane::OnPaint(wxPaintEvent& paint)
     dc.SetPen(pen);
     dc.SetBrush(brush);
 
+    UpdateTolerance();
     // Only recalculate the mapping if the viewport changed.
     if (movedViewPort) { tGrid.MapGrid(in->grid, f); }
 
@@ -189,6 +197,8 @@ void OutputPlane::EnterFunction(std::string s)
     {
         auto g = parser.Parse(s);
         g.eval();
+        // Common functions have hand-written kernels; see PresetKernels.h.
+        UsePresetKernel(g);
         history->RecordCommand(
             std::make_unique<CommandOutputFuncEntry>(g, this));
         f = g;
@@ -207,7 +217,7 @@ void OutputPlane::EnterFunction(std::string s)
     Refresh();
 }
 
-void OutputPlane::CopyFunction(ParsedFunc<cplx> g)
+void OutputPlane::CopyFunction(const ParsedFunc<cplx>& g)
 {
     f             = g;
     movedViewPort = true;
@@ -219,8 +229,11 @@ void OutputPlane::CopyFunction(ParsedFunc<cplx> g)
     Refresh();
 }
 
+void OutputPlane::UseNativeFunction() { CompileNative(f); }
+
 void OutputPlane::MarkAllForRedraw()
 {
+    UpdateTolerance();
     in->RecalcAll();
     auto& inputContours = in->contours;
     contours.resize(inputContours.size());
@@ -231,40 +244,243 @@ void OutputPlane::MarkAllForRedraw()
     }
 }
 
+namespace
+{
+typedef std::vector<std::pair<cplx, int>> ZeroList;
+
+// Deep zooms are searched in higher precision, since in double nearby zeros
+// and poles would be indistinguishable.
+bool IsDeepZoom(cplx UL, cplx LR)
+{
+    constexpr double DEEP_ZOOM = 1e-10;
+    return std::abs(LR - UL) <
+           DEEP_ZOOM * std::max(std::abs(UL), std::abs(LR));
+}
+
+// Runs zf::solve with f over the rectangle with corners UL and LR, passing it
+// cancel and progress. Throws zf::cancelled if cancel is set in the
+// meantime.
+ZeroList
+SolveZerosAndPoles(EvalContext<cplx>& f, cplx UL, cplx LR,
+                   const std::atomic<bool>* cancel,
+                   const std::function<void(const ZeroList&)>& progress)
+{
+    // The mesh only needs to separate zeros and poles further apart than a
+    // small fraction of a pixel. The polishing step takes them from there
+    // to full precision.
+    constexpr double MESH_PRECISION = 1e-5;
+    const double meshPrecision      = MESH_PRECISION * std::abs(LR - UL);
+
+    if (IsDeepZoom(UL, LR))
+    {
+        auto toDouble = [](const std::vector<std::pair<cplx32, int>>& P) {
+            ZeroList points;
+            for (auto& p : P)
+                points.emplace_back(ToDouble(p.first), p.second);
+            return points;
+        };
+        zf::options<cplx32> opts;
+        opts.cancel         = cancel;
+        opts.mesh_precision = meshPrecision;
+        if (progress)
+            opts.progress = [&](auto& P) { progress(toDouble(P)); };
+        // Without a derivative in this precision, zf polishes the results
+        // by Muller's method.
+        auto g = [&f](cplx32 z) { return f.EvalPrecise(z); };
+        return toDouble(
+            zf::solve<cplx32>(cplx32(UL), cplx32(LR), 1e-32, g, opts));
+    }
+
+    // The initial mesh is evaluated in one batch, split between threads as
+    // in Grid::MapGrid, though it is smaller than most grids.
+    constexpr size_t MIN_POINTS_PER_THREAD = 256;
+    zf::options<cplx> opts;
+    opts.batch_f = [&f](const cplx* in, cplx* out, size_t n) {
+        const size_t threadCount =
+            std::min<size_t>(std::thread::hardware_concurrency(),
+                             n / MIN_POINTS_PER_THREAD);
+        if (threadCount <= 1) return f.EvalBatch(in, out, n);
+        std::vector<std::thread> threads;
+        const size_t chunk = (n + threadCount - 1) / threadCount;
+        for (size_t first = 0; first < n; first += chunk)
+        {
+            size_t count = std::min(chunk, n - first);
+            threads.emplace_back(
+                [in, out, first, count](EvalContext<cplx> context) {
+                    context.EvalBatch(in + first, out + first, count);
+                },
+                f);
+        }
+        for (auto& th : threads)
+            th.join();
+    };
+    opts.cancel         = cancel;
+    opts.progress       = progress;
+    opts.mesh_precision = meshPrecision;
+    opts.df             = [&f](cplx z) {
+        Dual<cplx> w = f.EvalDerivative(z);
+        return std::make_pair(w.val, w.d);
+    };
+    return zf::solve<cplx>(
+        UL, LR, 1e-16, [&f](cplx z) { return f(z); }, opts);
+}
+} // namespace
+
+OutputPlane::~OutputPlane()
+{
+    if (zeroSearch) *zeroSearch = true;
+    if (link)
+    {
+        std::lock_guard<std::mutex> guard(link->lock);
+        link->plane = nullptr;
+    }
+}
+
 void OutputPlane::CalcZerosAndPoles()
 {
+    if (zeroSearch) *zeroSearch = true;
+    zeroSearch = nullptr;
     if (!in->showZeros) return;
-    //atomic_bool_setter busy(calculating_zeros);
-    zerosAndPoles.clear();
-    in->mouseOnZero = nullptr;
+    if (!link)
+    {
+        link        = std::make_shared<PlaneLink>();
+        link->plane = this;
+    }
+
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    zeroSearch  = cancel;
+    // The search works on its own context, with the current variable
+    // values. Quadrants need full precision.
+    EvalContext<cplx> context = f.CreateContext();
+    context.SetTolerance(0);
+    const unsigned long long program = context.GetProgram().GetId();
+    cplx UL = cplx(in->axes.realMin, in->axes.imagMax);
+    cplx LR = cplx(in->axes.realMax, in->axes.imagMin);
+
+    std::thread([link = link, cancel, context, program, UL, LR]() mutable {
+        // Results go to the UI thread, where they're dropped if a newer
+        // search has started by the time they arrive.
+        auto post = [&](std::function<void(OutputPlane*)> show) {
+            std::lock_guard<std::mutex> guard(link->lock);
+            OutputPlane* plane = link->plane;
+            if (!plane || *cancel) return;
+            plane->CallAfter([plane, cancel, show]() {
+                if (plane->zeroSearch == cancel) show(plane);
+            });
+        };
+        auto show = [&](const ZeroList& points) {
+            post([points, program](OutputPlane* plane) {
+                plane->ShowZerosAndPoles(points, program);
+            });
+        };
+        // Solver does not handle branch points at the moment. TODO: Fix that.
+        try
+        {
+            ZeroList points =
+                SolveZerosAndPoles(context, UL, LR, cancel.get(), show);
+            post([points, program](OutputPlane* plane) {
+                plane->ShowZerosAndPoles(points, program);
+                plane->zeroSearch = nullptr;
+            });
+        }
+        catch (zf::cancelled&)
+        {
+        }
+        catch (...)
+        {
+            post([](OutputPlane* plane) { plane->ZeroSearchFailed(); });
+        }
+    }).detach();
+}
+
+void OutputPlane::CalcZerosAndPolesNow()
+{
+    if (zeroSearch) *zeroSearch = true;
+    zeroSearch = nullptr;
+    if (!in->showZeros) return;
+
+    EvalContext<cplx> context = f.CreateContext();
+    context.SetTolerance(0);
     cplx UL = cplx(in->axes.realMin, in->axes.imagMax);
     cplx LR = cplx(in->axes.realMax, in->axes.imagMin);
-    // Solver does not handle branch points at the moment. TODO: Fix that.
     try
     {
-        auto points = zf::solve<cplx>(UL, LR, 1e-16, f);
-        for (auto& P : points)
+        ShowZerosAndPoles(
+            SolveZerosAndPoles(context, UL, LR, nullptr, nullptr),
+            context.GetProgram().GetId());
+    }
+    catch (...)
+    {
+        ZeroSearchFailed();
+    }
+}
+
+void OutputPlane::TrackZerosAndPoles()
+{
+    if (zeroSearch || !in->showZeros) return;
+
+    EvalContext<cplx> context = f.CreateContext();
+    context.SetTolerance(0);
+    const unsigned long long program = context.GetProgram().GetId();
+    cplx UL = cplx(in->axes.realMin, in->axes.imagMax);
+    cplx LR = cplx(in->axes.realMax, in->axes.imagMin);
+    // Newton's method in double can't resolve deep zooms, so those always
+    // get a full search.
+    if (program == zeroProgram && !IsDeepZoom(UL, LR))
+    {
+        ZeroList points = zeroList;
+        try
+        {
+            if (zf::track<cplx>(
+                    UL, LR, [&context](cplx z) { return context(z); },
+                    [&context](cplx z) {
+                        Dual<cplx> w = context.EvalDerivative(z);
+                        return std::make_pair(w.val, w.d);
+                    },
+                    points))
+            {
+                ShowZerosAndPoles(points, program);
+                return;
+            }
+        }
+        catch (...)
         {
-            std::string name;
-            if (P.second > 0)
-                name = "Zero, order " + std::to_string(P.second);
-            else if (P.second < 0)
-                name = "Pole, order " + std::to_string(P.second);
-            else
-                name = "Point";
-            zerosAndPoles.push_back(std::make_unique<ContourPoint>(P.first,
-                wxColor(0,0,0), name, P.second));
+            // The full search reports it, if it fails too.
         }
-        if (!in->animating) in->Refresh();
     }
-    catch (...)
+    CalcZerosAndPoles();
+}
+
+void OutputPlane::ShowZerosAndPoles(
+    const std::vector<std::pair<cplx, int>>& points, unsigned long long program)
+{
+    zeroList    = points;
+    zeroProgram = program;
+    zerosAndPoles.clear();
+    in->mouseOnZero = nullptr;
+    for (auto& P : points)
     {
-        wxRichToolTip errormsg(wxT("Zero Finder aborted"),
-            "Zero Finder exceeded memory limit. Try looking at a smaller region.");
-        in->showZeros = false;
-        toolbar->ToggleTool(ID_Show_Zeros, false);
-        errormsg.ShowFor(statBar);
+        std::string name;
+        if (P.second > 0)
+            name = "Zero, order " + std::to_string(P.second);
+        else if (P.second < 0)
+            name = "Pole, order " + std::to_string(P.second);
+        else
+            name = "Point";
+        zerosAndPoles.push_back(std::make_unique<ContourPoint>(P.first,
+            wxColor(0,0,0), name, P.second));
     }
+    if (!in->animating) in->Refresh();
+}
+
+void OutputPlane::ZeroSearchFailed()
+{
+    wxRichToolTip errormsg(wxT("Zero Finder aborted"),
+        "Zero Finder exceeded memory limit. Try looking at a smaller region.");
+    zeroSearch    = nullptr;
+    in->showZeros = false;
+    toolbar->ToggleTool(ID_Show_Zeros, false);
+    errormsg.ShowFor(statBar);
 }
 
 bool OutputPlane::DrawFrame(wxBitmap& image, double t)
@@ -286,6 +502,7 @@ bool OutputPlane::DrawFrame(wxBitmap& image, double t)
         for (auto& A : in->animations)
             A->FrameAt(t * 1000);
 
+    UpdateTolerance();
     tGrid.MapGrid(in->grid, f);
 
     auto& inputContours = in->contours;
@@ -317,3 +534,11 @@ bool OutputPlane::DrawFrame(wxBitmap& image, double t)
 }
 
 int OutputPlane::GetRes() { return tGrid.res; }
+
+void OutputPlane::UpdateTolerance()
+{
+    double pixel = std::min(ScreenXToLength(1), ScreenYToLength(1));
+    f.SetTolerance(std::isfinite(pixel) ? pixel / 4 : 0,
+                   ComplexInterval(cplx(axes.realMin, axes.imagMin),
+                                   cplx(axes.realMax, axes.imagMax)));
+}
@@ -6,8 +6,10 @@
 #include "ToolPanel.h"
 #include "ContourPoint.h"
 
+#include <atomic>
 #include <complex>
-//#include <atomic>
+#include <memory>
+#include <mutex>
 #include <wx/spinctrl.h>
 
 #include <boost/archive/text_iarchive.hpp>
@@ -36,6 +38,7 @@ public:
     OutputPlane() {}
     OutputPlane(wxWindow* parent, InputPlane* In,
                 const std::string& name = "Output");
+    ~OutputPlane();
 
     void OnMouseLeftUp(wxMouseEvent& mouse);
     //void OnMouseRightUp(wxMouseEvent& mouse);
@@ -53,8 +56,11 @@ public:
     void Zoom(wxPoint mousePos, int zoomSteps);
 
     void EnterFunction(std::string s);
-    void CopyFunction(ParsedFunc<cplx> g);
-    auto GetFunc() { return f; }
+    void CopyFunction(const ParsedFunc<cplx>& g);
+    const ParsedFunc<cplx>& GetFunc() const { return f; }
+    // Compiles f to native code in the background, for long-running work
+    // like exports. Editing f goes back to the interpreter.
+    void UseNativeFunction();
 
     void MarkAllForRedraw();
     void SetFuncInput(wxTextCtrl* fIn) { funcInput = fIn; }
@@ -62,7 +68,17 @@ public:
     void RefreshFuncText() { funcInput->SetValue(f.GetInputText()); }
     void SetVarPanel(VariableEditPanel* var) { varPanel = var; }
 
+    // Searches for the zeros and poles of f in the input plane's viewport
+    // on a background thread, replacing any search still running. The
+    // results of each refinement are shown as they arrive.
     void CalcZerosAndPoles();
+    // Same, but waits for the final results, e.g. for exporting frames.
+    void CalcZerosAndPolesNow();
+    // Follows the zeros and poles from their last positions, for when f or
+    // the viewport has changed a little, e.g. between animation frames.
+    // Starts a new search if any may have appeared or gone. Does nothing
+    // while a search is running, since its results are the better start.
+    void TrackZerosAndPoles();
 
     // t = -1 means don't use the parameter.
     bool DrawFrame(wxBitmap& image, double t = -1);
@@ -72,7 +88,6 @@ public:
 
     ParsedFunc<cplx> f;
 
-    //std::atomic_bool calculating_zeros;
 private:
     Parser<cplx> parser;
     TransformedGrid tGrid;
@@ -83,6 +98,31 @@ private:
 
     std::vector<std::unique_ptr<ContourPoint>> zerosAndPoles;
 
+    // Background searches reach the plane through this, and stop posting
+    // results once the plane is destroyed.
+    struct PlaneLink
+    {
+        std::mutex lock;
+        OutputPlane* plane = nullptr;
+    };
+    std::shared_ptr<PlaneLink> link;
+    // Cancels the current search, and is reset once it finishes. Results
+    // from any other search are dropped.
+    std::shared_ptr<std::atomic<bool>> zeroSearch;
+    // The last results shown, and the id of the program they're for, as the
+    // starting point for TrackZerosAndPoles().
+    std::vector<std::pair<cplx, int>> zeroList;
+    unsigned long long zeroProgram = 0;
+
+    void ShowZerosAndPoles(const std::vector<std::pair<cplx, int>>& points,
+                           unsigned long long program);
+    void ZeroSearchFailed();
+
+    // Mapped points only need to be accurate to a fraction of a pixel, and f
+    // switches to higher precision when double can't manage that, as when
+    // zoomed far in. Call before mapping.
+    void UpdateTolerance();
+
     template <class Archive>
     void serialize(Archive& ar, const unsigned int version)
     {
@@ -93,12 +133,3 @@ private:
     }
     wxDECLARE_EVENT_TABLE();
 };
-
-//class atomic_bool_setter
-//{
-//public:
-//    atomic_bool_setter(std::atomic_bool& a) : b(a) { b.store(true); }
-//    ~atomic_bool_setter() { b.store(false); }
-//private:
-//    std::atomic_bool& b;
-//};
\ No newline at end of file
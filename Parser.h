@@ -1,10 +1,19 @@
 #pragma once
+#include "Program.h"
+#include "SpecialFunctions.h"
+#include "SubtreeCache.h"
 #include "Token.h"
 #include "zeta.h"
 
+#include <atomic>
+#include <cctype>
 #include <cmath>
+#include <cstdlib>
+#include <list>
 #include <map>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/archive/text_iarchive.hpp>
@@ -24,8 +33,9 @@ typedef std::complex<double> cplx;
 
 struct cmp_length_then_alpha;
 
-// Parser<T> outputs a ParsedFunc object, essentially a self-evaluating stack
-// of operations/functions and arguments of type T. Tokens objects can be
+// Parser<T> outputs a ParsedFunc object, essentially a stack of
+// operations/functions and arguments of type T, compiled into a Program<T>
+// for evaluation. Tokens objects can be
 // defined and added to the parser separately, provided they inherit from
 // Symbol<T>. Any type with typical overloads of the basic operations and
 // functions (e.g. taking the usual number of args, returning T) should
@@ -38,24 +48,36 @@ template <typename T> class Parser
     friend class boost::serialization::access;
 
 public:
-    Parser();
+    typedef std::map<std::string, std::unique_ptr<const Symbol<T>>,
+                     cmp_length_then_alpha>
+        SymbolTable;
+
+    Parser() = default;
+    // Tokens recognized here are only known to this parser, and take
+    // precedence over built-ins with the same name.
     void RecognizeToken(Symbol<T>* sym)
     {
-        tokenLibrary[sym->GetToken()] = std::unique_ptr<Symbol<T>>(sym);
+        tokenLibrary[sym->GetToken()] = std::unique_ptr<const Symbol<T>>(sym);
     }
+    // op should only be given for functions the Program<T> interpreter
+    // implements itself; anything else is called through f.
     template <typename... Args>
     void RecognizeFunc(const std::function<T(Args...)>& f,
-                       const std::string& name)
+                       const std::string& name, OpCode op = OpCode::call)
     {
-        RecognizeToken(new SymbolFunc<T, Args...>(f, name));
+        RecognizeToken(new SymbolFunc<T, Args...>(f, name, op));
     }
-    void constexpr Initialize();
     ParsedFunc<T> Parse(std::string str);
 
+    // Operators, constants and standard functions. Built once, on first use,
+    // and shared by every Parser<T>; parsing only reads from it.
+    static const SymbolTable& Builtins();
+
 private:
+    static void Initialize(SymbolTable& table);
+
     ParsedFunc<T> f;
-    std::map<std::string, std::unique_ptr<Symbol<T>>, cmp_length_then_alpha>
-        tokenLibrary;
+    SymbolTable tokenLibrary;
 
     // Save/Load via Boost.Serialization
     template <class Archive>
@@ -78,8 +100,12 @@ private:
 
 // Contains the result of Parser<T> parsing a string. SetVariable(name, T)
 // sets the numerical value of a named parameter, and eval() calculates the
-// result of the expression. Tokens can be added and removed manually with
-// PushToken(Symbol<T>*) and PopToken(), if necessary.
+// result of the expression. The symbol stack is compiled into a Program<T>
+// when parsing finishes, and that program is what actually runs. Tokens can
+// be added and removed manually with PushToken(Symbol<T>*) and PopToken(), if
+// necessary; the program is then recompiled on the next evaluation. The
+// compiled program is immutable and shared between copies; CreateContext()
+// gives independent evaluation state for use on other threads.
 
 template <typename T> class ParsedFunc
 {
@@ -97,10 +123,17 @@ public:
         symbolStack = std::move(in.symbolStack);
         tokens      = std::move(in.tokens);
         inputText   = std::move(in.inputText);
+        program     = std::move(in.program);
+        native      = std::move(in.native);
+        tolerance   = in.tolerance;
+        viewport    = in.viewport;
+        single      = in.single;
+        compiled    = in.compiled;
         for (auto sym : symbolStack)
         {
             sym->SetParent(this);
         }
+        if (compiled) BindVariables();
         return *this;
     }
     ParsedFunc& operator=(const ParsedFunc& in) noexcept
@@ -129,23 +162,103 @@ public:
             }
         }
         inputText = in.inputText;
+        program   = in.program;
+        native    = in.native;
+        tolerance = in.tolerance;
+        viewport  = in.viewport;
+        single    = in.single;
+        compiled  = in.compiled;
+        if (compiled) BindVariables();
         return *this;
     }
-    T eval()
-    {
-        itr = symbolStack.end() - 1;
-        return (*itr)->eval().GetVal();
-    };
+    T eval();
 
-    void SetIV(std::string token) { IV_token = token; }
+    void SetIV(std::string token)
+    {
+        IV_token = token;
+        if (compiled) context.SetIV(IV_token);
+    }
     std::string GetIV() const { return IV_token; }
     void SetVariable(const std::string& name, const T& val);
+    // For setting the same variable repeatedly, e.g. every animation frame,
+    // without looking it up by name. A handle stays current until the
+    // function is recompiled.
+    VarHandle GetVarHandle(const std::string& name)
+    {
+        if (!compiled) Compile();
+        return program->GetVarHandle(name);
+    }
+    bool IsCurrent(VarHandle h) const
+    {
+        return compiled && h.program == program->GetId();
+    }
+    void SetVariable(VarHandle h, const T& val)
+    {
+        if (IsCurrent(h) && h.IsValid()) varSymbols[h.index]->SetVal(val);
+    }
+
+    // Compiles the symbol stack. Throws std::invalid_argument if it does not
+    // form a valid expression.
+    void Compile();
+    const Program<T>& GetProgram()
+    {
+        if (!compiled) Compile();
+        return *program;
+    }
+
+    // Returns a context sharing this function's compiled program, with the
+    // current variable values and independent variable. Each thread
+    // evaluating the function in parallel should use its own context.
+    EvalContext<T> CreateContext();
+
+    // Natively compiled version of the program, used once it is ready. See
+    // NativeCompiler.h. Dropped whenever the function is recompiled.
+    void SetNativeKernel(std::shared_ptr<const NativeKernel> kernel)
+    {
+        native = std::move(kernel);
+        context.SetNativeKernel(native);
+    }
 
-    typename std::vector<Symbol<T>*>::iterator itr;
+    // Absolute error allowed in EvalBatch() for values in or near view, so
+    // it knows when double isn't enough. See EvalContext<T>::SetTolerance().
+    void SetTolerance(double tol,
+                      const ComplexInterval& view = ComplexInterval::Entire())
+    {
+        tolerance = tol;
+        viewport  = view;
+        context.SetTolerance(tol, view);
+    }
+    // Opts in to single precision within the tolerance. See
+    // EvalContext<T>::SetSinglePrecision().
+    void SetSinglePrecision(bool allow)
+    {
+        single = allow;
+        context.SetSinglePrecision(allow);
+    }
 
-    auto GetMinItr() { return symbolStack.begin(); }
     T operator()(T val);
-    void PushToken(Symbol<T>* token)
+    // f(val) and its derivative in one evaluation. See Dual.h.
+    Dual<T> EvalDerivative(T val);
+    // f(val) in one of the higher precision types in Multiprecision.h, e.g.
+    // for finding zeros in a deep zoom.
+    template <typename U> U EvalPrecise(const U& val)
+    {
+        LoadVariables();
+        return context.EvalPrecise(val);
+    }
+
+    // Evaluates the function at n values of the independent variable. out
+    // may be the same array as in. Much faster than calling operator() in a
+    // loop for std::complex<double>; see Program<T>::RunBatch.
+    void EvalBatch(const T* in, T* out, size_t n);
+    // Same, with the real and imaginary parts in separate arrays.
+    void EvalBatch(const double* inRe, const double* inIm, double* outRe,
+                   double* outIm, size_t n);
+    // Same as EvalBatch(in, out, n), but keeps the values of subexpressions
+    // not depending on any parameter in cache, for when the same points are
+    // evaluated again with different parameters. See SubtreeCache.h.
+    void EvalBatch(const T* in, T* out, size_t n, SubtreeCache<T>& cache);
+    void PushToken(const Symbol<T>* token)
     {
         Symbol<T>* S;
         if (tokens.find(token->GetToken()) == tokens.end())
@@ -157,8 +270,13 @@ public:
         else
             S = tokens[token->GetToken()].get();
         symbolStack.push_back(S);
+        compiled = false;
+    }
+    void PopToken()
+    {
+        symbolStack.pop_back();
+        compiled = false;
     }
-    void PopToken() { symbolStack.pop_back(); }
     std::string str() { return inputText; }
     void ReplaceVariable(std::string varOld, std::string var);
     auto GetVars();
@@ -180,6 +298,20 @@ private:
     std::string inputText = "";
     std::string IV_token  = "z";
 
+    // Compiled form of symbolStack, shared with copies of this function and
+    // any contexts handed out. varSymbols holds the symbol whose value feeds
+    // each program variable, in the order of GetVarNames().
+    void BindVariables();
+    void LoadVariables();
+    std::shared_ptr<const Program<T>> program;
+    std::shared_ptr<const NativeKernel> native;
+    EvalContext<T> context;
+    std::vector<Symbol<T>*> varSymbols;
+    double tolerance         = 0;
+    ComplexInterval viewport = ComplexInterval::Entire();
+    bool single              = false;
+    bool compiled            = false;
+
     template <class Archive>
     void save(Archive& ar, const unsigned int version) const
     {
@@ -207,156 +339,277 @@ private:
     }
 };
 
-template <typename T> inline Parser<T>::Parser() { Initialize(); }
-
-template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
+// Recently parsed functions, keyed by their text with insignificant white
+// space removed. Parser<T>::Parse looks here first, so entering a function
+// again, undo/redo and reloading a scene reuse the compiled program instead
+// of parsing again. Entries are never modified; Find() hands out copies,
+// which share the entry's program. Safe to use from several threads.
+template <typename T> class ParseCache
 {
-    f.symbolStack.clear();
-    std::vector<Symbol<T>*> opStack;
-    f.inputText = input;
+public:
+    static ParseCache& Get()
+    {
+        static ParseCache cache;
+        return cache;
+    }
 
-    auto PushOp = [&](Symbol<T>* token) {
-        token->SetParent(&f);
-        opStack.push_back(token);
-    };
+    // Copies the function cached under key into f and returns true, or
+    // returns false if there isn't one.
+    bool Find(const std::string& key, ParsedFunc<T>& f);
+    void Insert(const std::string& key, const ParsedFunc<T>& f);
 
-    auto replaceAll = [](std::string& s, const std::string& toReplace,
-                         const std::string& replaceWith) {
-        std::size_t pos = 0;
-        while (pos != std::string::npos)
-        {
-            pos = s.find(toReplace, pos);
-            if (pos != std::string::npos)
-            {
-                s.replace(pos, toReplace.length(), replaceWith);
-                pos += replaceWith.length();
-            }
-        }
-        return s;
-    };
+    // Least recently used entries are dropped beyond this many.
+    void SetCapacity(size_t n);
+    void Clear();
+    size_t GetHits() const { return hits; }
+    size_t GetMisses() const { return misses; }
+
+    // Removes white space, except between two words or numbers: "z + 1" and
+    // "z+1" are the same expression, but "2 a" and "2a" are not.
+    static std::string Normalize(const std::string& text);
 
-    // Add white space between tokenLibrary for easier stringstream processing
-    size_t pos            = 0;
-    std::string inputCopy = input;
-    while (pos != std::string::npos)
+    static constexpr size_t DEFAULT_CAPACITY = 128;
+
+private:
+    typedef std::list<std::pair<std::string, ParsedFunc<T>>> EntryList;
+    EntryList entries; // Most recently used first.
+    std::unordered_map<std::string, typename EntryList::iterator> index;
+    size_t capacity = DEFAULT_CAPACITY;
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::mutex lock;
+};
+
+template <typename T>
+inline bool ParseCache<T>::Find(const std::string& key, ParsedFunc<T>& f)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = index.find(key);
+    if (found == index.end())
     {
-        pos = inputCopy.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJ"
-                                          "KLMNOPQRSTUVWXYZ01234567890_. ",
-                                          pos);
-        if (pos != std::string::npos)
-        {
-            std::string y(1, input[pos]);
-            input.replace(pos, 1, " " + y + " ");
-            inputCopy.replace(pos, 1, "   ");
-        }
+        misses++;
+        return false;
     }
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    f = found->second->second;
+    return true;
+}
 
-    std::string s;
-    std::stringstream strPre(input);
+template <typename T>
+inline void ParseCache<T>::Insert(const std::string& key,
+                                  const ParsedFunc<T>& f)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = index.find(key);
+    if (found != index.end()) entries.erase(found->second);
+    entries.emplace_front(key, f);
+    index[key] = entries.begin();
+    while (entries.size() > capacity)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
 
-    std::vector<std::string> tokenVec;
+template <typename T> inline void ParseCache<T>::SetCapacity(size_t n)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = n;
+    while (entries.size() > capacity)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
 
-    // Convert string to vector of tokenLibrary.
-    // Easier to manage special exceptions this way.
+template <typename T> inline void ParseCache<T>::Clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    index.clear();
+    hits   = 0;
+    misses = 0;
+}
 
-    while (strPre >> s)
+template <typename T>
+inline std::string ParseCache<T>::Normalize(const std::string& text)
+{
+    auto isWordChar = [](char c) {
+        return isalnum((unsigned char)c) || c == '_' || c == '.';
+    };
+    std::string key;
+    key.reserve(text.size());
+    bool space = false;
+    for (char c : text)
     {
-        T t;
-        std::string name;
-        std::stringstream ss(s);
-        // If first char is a number, read in the whole number.
-        // If anything remains, It is an unrecognized token,
-        // so call it a variable and set it to zero.
-        if (isdigit(s[0]) || s[0] == '.')
+        if (isspace((unsigned char)c))
         {
-            ss >> t;
-            // Add "\\" to name to prevent issues tokenizing in the future
-            // if the parser is reused without clearing mapped tokenLibrary.
-            s = "\\" + s;
-            if (tokenLibrary.find(s) == tokenLibrary.end())
-                tokenLibrary[s] = std::make_unique<SymbolNum<T>>(t);
-            tokenVec.push_back(s);
-            if (ss >> s)
-            {
-                if (tokenLibrary.find(s) == tokenLibrary.end())
-                {
-                    tokenLibrary[s] = std::make_unique<SymbolVar<T>>(s, 0);
-                    tokenVec.push_back(s);
-                }
-                else
-                    tokenVec.push_back(s);
-            }
+            space = true;
+            continue;
         }
-        else if (tokenLibrary.find(s) == tokenLibrary.end())
+        if (space && !key.empty() && isWordChar(key.back()) && isWordChar(c))
+            key += ' ';
+        key += c;
+        space = false;
+    }
+    return key;
+}
+
+template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
+{
+    // Functions using this parser's own symbols aren't shared.
+    const bool cacheable = tokenLibrary.empty();
+    std::string key;
+    if (cacheable)
+    {
+        key = ParseCache<T>::Normalize(input);
+        if (ParseCache<T>::Get().Find(key, f))
         {
-            tokenLibrary[s] = std::make_unique<SymbolVar<T>>(s);
-            tokenVec.push_back(s);
+            f.inputText = input;
+            return f;
         }
-        else
-            tokenVec.push_back(s);
     }
 
-    for (size_t i = 0; i < tokenVec.size(); i++)
-    {
-        // Special rule: '-' (sub) should be read as '~' (neg) if subraction
-        // wouldn't work, i.e. if the left token is dyadic or doesn't exist.
-        if (tokenVec[i] == "-")
+    f.symbolStack.clear();
+    f.tokens.clear();
+    std::vector<const Symbol<T>*> opStack;
+    f.inputText = input;
+
+    auto PushOp = [&](const Symbol<T>* token) { opStack.push_back(token); };
+
+    const SymbolTable& builtins = Builtins();
+    auto libraryToken = [&](const std::string& name) -> const Symbol<T>* {
+        auto found = tokenLibrary.find(name);
+        if (found != tokenLibrary.end()) return found->second.get();
+        auto builtin = builtins.find(name);
+        return builtin == builtins.end() ? nullptr : builtin->second.get();
+    };
+    const Symbol<T>* subToken    = libraryToken("-");
+    const Symbol<T>* negToken    = libraryToken("~");
+    const Symbol<T>* mulToken    = libraryToken("*");
+    const Symbol<T>* lparenToken = libraryToken("(");
+    const Symbol<T>* commaToken  = libraryToken(",");
+
+    // Number literals and unrecognized names belong to this parse only, so
+    // the token library stays the same size however many strings are
+    // parsed. f keeps its own copies of whatever it uses.
+    std::vector<std::unique_ptr<Symbol<T>>> parseLocal;
+    std::map<std::string, const Symbol<T>*> newVars;
+
+    // Unrecognized names become variables, initialized to 1, or to 0 when
+    // they directly follow a number, e.g. the x in 2x.
+    auto lookup = [&](const std::string& name,
+                      bool afterNumber) -> const Symbol<T>* {
+        if (const Symbol<T>* sym = libraryToken(name)) return sym;
+        auto found = newVars.find(name);
+        if (found != newVars.end()) return found->second;
+        if (afterNumber)
+            parseLocal.push_back(std::make_unique<SymbolVar<T>>(name, 0));
+        else
+            parseLocal.push_back(std::make_unique<SymbolVar<T>>(name));
+        return newVars[name] = parseLocal.back().get();
+    };
+
+    // tokenVec is the lexed input, with implied multiplication filled in.
+    // isLiteral marks number literals, which imply multiplication with any
+    // adjacent number, constant or variable.
+    std::vector<const Symbol<T>*> tokenVec;
+    std::vector<bool> isLiteral;
+    auto emit = [&](const Symbol<T>* sym, bool literal) {
+        if (!tokenVec.empty())
         {
-            if (i > 0)
-            {
-                if (tokenLibrary[tokenVec[i - 1]]->GetPrecedence() == -1 ||
-                    tokenLibrary[tokenVec[i - 1]]->IsDyad())
-                { tokenVec[i] = "~"; }
-            }
-            else if (i == 0)
+            int prevPrec = tokenVec.back()->GetPrecedence();
+            int prec     = sym->GetPrecedence();
+            // Implied multiplication between numbers and constants or
+            // variables, e.g. 3i, 2pi, and between parens and other parens
+            // or numbers. Commas have the same precedence as parens, but
+            // only separate.
+            const bool lparen = prec == sym_lparen && sym != commaToken;
+            if ((isLiteral.back() && prec == sym_num) ||
+                (prevPrec == sym_num && literal) ||
+                (lparen && (prevPrec == sym_num || prevPrec == sym_rparen)) ||
+                (prevPrec == sym_rparen && (prec == sym_num || lparen)))
             {
-                tokenVec[i] = "~";
+                tokenVec.push_back(mulToken);
+                isLiteral.push_back(false);
             }
         }
+        // Special rule: '-' (sub) should be read as '~' (neg) if subraction
+        // wouldn't work, i.e. if the left token is dyadic or doesn't exist.
+        if (sym == subToken &&
+            (tokenVec.empty() || tokenVec.back()->GetPrecedence() == -1 ||
+             tokenVec.back()->IsDyad()))
+            sym = negToken;
+        tokenVec.push_back(sym);
+        isLiteral.push_back(literal);
+    };
 
-        int currentTokenPrec = tokenLibrary[tokenVec[i]]->GetPrecedence();
+    auto isWordChar = [](char c) {
+        return isalnum((unsigned char)c) || c == '_' || c == '.';
+    };
+    auto isDigit = [](char c) { return isdigit((unsigned char)c) != 0; };
 
-        // Special rule: implied multiplication between constants / variables
-        // and numbers, e.g. 3i, 2PI.
-        if (currentTokenPrec == sym_num)
+    // Words are runs of letters, digits, '_' and '.'; any other character
+    // is a token by itself.
+    const size_t len = input.size();
+    for (size_t pos = 0; pos < len;)
+    {
+        const char c = input[pos];
+        if (isspace((unsigned char)c))
         {
-            int inserted = 0;
-            if (i > 0)
-            {
-                if (tokenVec[i - 1][0] == '\\')
-                {
-                    tokenVec.insert(tokenVec.begin() + i, "*");
-                    inserted++;
-                }
-            }
-            if (i < tokenVec.size() - 1)
-            {
-                if (tokenVec[i + 1][0] == '\\')
-                { tokenVec.insert(tokenVec.begin() + i + 1 + inserted, "*"); }
-            }
+            pos++;
+            continue;
+        }
+        if (!isWordChar(c))
+        {
+            emit(lookup(std::string(1, c), false), false);
+            pos++;
+            continue;
         }
 
-        // Implied multiplication between parens, other parens, and numbers.
-        else if (currentTokenPrec == sym_lparen && i > 0)
+        size_t end = pos;
+        while (end < len && isWordChar(input[end]))
+            end++;
+
+        // A word starting with a number is the number, then possibly a name.
+        if (isDigit(c) || c == '.')
         {
-            Symbol<T>* prev = tokenLibrary[tokenVec[i - 1]].get();
-            if (prev->GetPrecedence() == sym_num ||
-                prev->GetPrecedence() == sym_rparen)
+            size_t numEnd = pos;
+            while (numEnd < end && isDigit(input[numEnd]))
+                numEnd++;
+            if (numEnd < end && input[numEnd] == '.')
             {
-                tokenVec.insert(tokenVec.begin() + i, "*");
-                i++;
+                numEnd++;
+                while (numEnd < end && isDigit(input[numEnd]))
+                    numEnd++;
             }
-        }
-        else if (currentTokenPrec == sym_rparen && i < tokenVec.size() - 1)
-        {
-            Symbol<T>* next = tokenLibrary[tokenVec[i + 1]].get();
-            if (next->GetPrecedence() == sym_num ||
-                next->GetPrecedence() == sym_lparen)
+            bool hasDigits = numEnd > pos + (c == '.' ? 1 : 0);
+            if (hasDigits && numEnd + 1 < end &&
+                (input[numEnd] == 'e' || input[numEnd] == 'E') &&
+                isDigit(input[numEnd + 1]))
             {
-                tokenVec.insert(tokenVec.begin() + i + 1, "*");
-                i++;
+                numEnd += 2;
+                while (numEnd < end && isDigit(input[numEnd]))
+                    numEnd++;
             }
+
+            // Something like "." alone isn't a number. It reads as zero, and
+            // the rest of the word is ignored.
+            double value = 0;
+            if (hasDigits)
+                value = std::strtod(input.substr(pos, numEnd - pos).c_str(),
+                                    nullptr);
+            else
+                numEnd = end;
+            parseLocal.push_back(std::make_unique<SymbolNum<T>>(T(value)));
+            emit(parseLocal.back().get(), true);
+            if (numEnd < end)
+                emit(lookup(input.substr(numEnd, end - numEnd), true), false);
         }
+        else
+            emit(lookup(input.substr(pos, end - pos), false), false);
+        pos = end;
     }
 
     // Check for errors
@@ -364,29 +617,15 @@ template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
     {
         if (tokenVec.empty())
             throw std::invalid_argument("Error: Empy expression.");
-        if (tokenLibrary[tokenVec[0]]->IsDyad() ||
-            tokenLibrary[tokenVec.back()]->IsDyad())
+        if (tokenVec[0]->IsDyad() || tokenVec.back()->IsDyad())
         {
             throw std::invalid_argument(
                 "Error: Expression begins or ends with dyad.");
         }
-        if (tokenVec.size() > 1)
+        for (size_t i = 1; i < tokenVec.size(); i++)
         {
-            for (auto it = tokenVec.begin() + 1; it != tokenVec.end() - 1; it++)
-            {
-                if ((*it)[0] == '\\')
-                {
-                    if (tokenLibrary[*it]->IsDyad())
-                    {
-                        if (tokenLibrary[*(it - 1)]->IsDyad() ||
-                            tokenLibrary[*(it + 1)]->IsDyad())
-                        {
-                            throw std::invalid_argument(
-                                "Error: Two adjacent dyads.");
-                        }
-                    }
-                }
-            }
+            if (tokenVec[i - 1]->IsDyad() && tokenVec[i]->IsDyad())
+                throw std::invalid_argument("Error: Two adjacent dyads.");
         }
     }
     catch (std::invalid_argument& msg)
@@ -395,21 +634,29 @@ template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
         throw msg;
     }
 
-    for (auto s : tokenVec)
+    for (auto op : tokenVec)
     {
-        std::stringstream s1(s);
-        std::string op;
-        s1 >> op;
+        // A comma finishes the function argument before it, which goes to
+        // the output queue, up to the function's left paren.
+        if (op == commaToken)
+        {
+            while (!opStack.empty() &&
+                   opStack.back()->GetPrecedence() != sym_lparen)
+            {
+                f.PushToken(opStack.back());
+                opStack.pop_back();
+            }
+            continue;
+        }
 
         // Lower precedence means earlier in the order of operations
-        int tokPrec = tokenLibrary[op]->GetPrecedence();
+        int tokPrec = op->GetPrecedence();
 
         // First op always goes to the op stack. Left paren is given lowest
         // precedence, so it is always added.
         if (opStack.empty() || tokPrec < opStack.back()->GetPrecedence() ||
-            (!tokenLibrary[op]->IsLeftAssoc() &&
-             tokPrec == opStack.back()->GetPrecedence()))
-            PushOp(tokenLibrary[op].get());
+            (!op->IsLeftAssoc() && tokPrec == opStack.back()->GetPrecedence()))
+            PushOp(op);
         else if (tokPrec >= opStack.back()->GetPrecedence())
         {
             // Right paren means, assuming it matches with a left, everything on
@@ -433,7 +680,7 @@ template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
                     }
                     catch (std::invalid_argument& msg)
                     {
-                        PushOp(tokenLibrary["("].get());
+                        PushOp(lparenToken);
                         std::cout << msg.what();
                     }
                 }
@@ -451,7 +698,7 @@ template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
                     f.PushToken(opStack.back());
                     opStack.pop_back();
                 }
-                PushOp(tokenLibrary[op].get());
+                PushOp(op);
             }
         }
     }
@@ -462,6 +709,8 @@ template <typename T> ParsedFunc<T> Parser<T>::Parse(std::string input)
         if (f.symbolStack.back()->GetPrecedence() == sym_lparen) f.PopToken();
         opStack.pop_back();
     }
+    f.Compile();
+    if (cacheable) ParseCache<T>::Get().Insert(key, f);
     return f;
 }
 
@@ -482,10 +731,82 @@ inline void ParsedFunc<T>::SetVariable(const std::string& name, const T& val)
     if (tokens.find(name) != tokens.end()) tokens[name]->SetVal(val);
 }
 
+template <typename T> inline void ParsedFunc<T>::Compile()
+{
+    program  = std::make_shared<const Program<T>>(
+        ProgramBuilder<T>(symbolStack).Build());
+    native.reset();
+    compiled = true;
+    BindVariables();
+}
+
+template <typename T> inline void ParsedFunc<T>::BindVariables()
+{
+    context = EvalContext<T>(program, IV_token);
+    context.SetNativeKernel(native);
+    context.SetTolerance(tolerance, viewport);
+    context.SetSinglePrecision(single);
+    varSymbols.clear();
+    for (auto& name : program->GetVarNames())
+    {
+        varSymbols.push_back(GetVar(name));
+    }
+}
+
+template <typename T> inline void ParsedFunc<T>::LoadVariables()
+{
+    if (!compiled) Compile();
+    for (size_t i = 0; i < varSymbols.size(); i++)
+    {
+        context.SetVariableAt(i, varSymbols[i]->GetVal());
+    }
+}
+
+template <typename T> inline EvalContext<T> ParsedFunc<T>::CreateContext()
+{
+    LoadVariables();
+    return context;
+}
+
+template <typename T> inline T ParsedFunc<T>::eval()
+{
+    LoadVariables();
+    return context.eval();
+}
+
 template <typename T> inline T ParsedFunc<T>::operator()(T val)
 {
-    SetVariable(IV_token, val);
-    return eval();
+    LoadVariables();
+    return context(val);
+}
+
+template <typename T> inline Dual<T> ParsedFunc<T>::EvalDerivative(T val)
+{
+    LoadVariables();
+    return context.EvalDerivative(val);
+}
+
+template <typename T>
+inline void ParsedFunc<T>::EvalBatch(const T* in, T* out, size_t n)
+{
+    LoadVariables();
+    context.EvalBatch(in, out, n);
+}
+
+template <typename T>
+inline void ParsedFunc<T>::EvalBatch(const double* inRe, const double* inIm,
+                                     double* outRe, double* outIm, size_t n)
+{
+    LoadVariables();
+    context.EvalBatch(inRe, inIm, outRe, outIm, n);
+}
+
+template <typename T>
+inline void ParsedFunc<T>::EvalBatch(const T* in, T* out, size_t n,
+                                     SubtreeCache<T>& cache)
+{
+    LoadVariables();
+    cache.EvalBatch(context, in, out, n);
 }
 
 template <typename T>
@@ -500,6 +821,7 @@ inline void ParsedFunc<T>::ReplaceVariable(std::string varOld,
         {
             if (sym->GetToken() == varOld) { sym = tokens[varOld]; }
         }
+        compiled = false;
     }
 }
 
@@ -508,6 +830,9 @@ template <typename T> inline auto ParsedFunc<T>::GetVars()
     std::vector<Symbol<T>*> vars;
     for (auto& tok : tokens)
     {
+        // Names only used as the index of a sum or product aren't variables
+        // of the function.
+        if (compiled && program->GetVarSlot(tok.first) < 0) continue;
         if (tok.second != nullptr && tok.second->IsVar())
             vars.push_back(tok.second.get());
     }
@@ -545,8 +870,27 @@ struct is_complex<typename T, std::void_t<decltype(std::imag(T{ 0, 1 })) >>
     static constexpr bool value{true};
 };
 
-template <typename T> inline constexpr void Parser<T>::Initialize()
+template <typename T>
+inline const typename Parser<T>::SymbolTable& Parser<T>::Builtins()
+{
+    static const SymbolTable table = [] {
+        SymbolTable t;
+        Initialize(t);
+        return t;
+    }();
+    return table;
+}
+
+template <typename T> inline void Parser<T>::Initialize(SymbolTable& table)
 {
+    auto RecognizeToken = [&](const Symbol<T>* sym) {
+        table[sym->GetToken()] = std::unique_ptr<const Symbol<T>>(sym);
+    };
+    auto RecognizeFunc = [&](const std::function<T(T)>& f,
+                             const std::string& name, OpCode op) {
+        RecognizeToken(new SymbolFunc<T, T>(f, name, op));
+    };
+
     RecognizeToken(new SymbolAdd<T>);
     RecognizeToken(new SymbolSub<T>);
     RecognizeToken(new SymbolMul<T>);
@@ -570,40 +914,73 @@ template <typename T> inline constexpr void Parser<T>::Initialize()
 
     typedef std::function<T(T)> fn;
 
-    RecognizeFunc((fn)[](T z) { return exp(z); }, "exp");
-    RecognizeFunc((fn)[](T z) { return log(z); }, "log");
-    RecognizeFunc((fn)[](T z) { return sqrt(z); }, "sqrt");
-    RecognizeFunc((fn)[](T z) { return sin(z); }, "sin");
-    RecognizeFunc((fn)[](T z) { return cos(z); }, "cos");
-    RecognizeFunc((fn)[](T z) { return tan(z); }, "tan");
-    RecognizeFunc((fn)[](T z) { return sinh(z); }, "sinh");
-    RecognizeFunc((fn)[](T z) { return cosh(z); }, "cosh");
-    RecognizeFunc((fn)[](T z) { return tanh(z); }, "tanh");
-    RecognizeFunc((fn)[](T z) { return asin(z); }, "asin");
-    RecognizeFunc((fn)[](T z) { return acos(z); }, "acos");
-    RecognizeFunc((fn)[](T z) { return atan(z); }, "atan");
-    RecognizeFunc((fn)[](T z) { return asinh(z); }, "asinh");
-    RecognizeFunc((fn)[](T z) { return acosh(z); }, "acosh");
-    RecognizeFunc((fn)[](T z) { return atanh(z); }, "atanh");
+    RecognizeFunc((fn)[](T z) { return exp(z); }, "exp", OpCode::exp);
+    RecognizeFunc((fn)[](T z) { return log(z); }, "log", OpCode::log);
+    RecognizeFunc((fn)[](T z) { return sqrt(z); }, "sqrt", OpCode::sqrt);
+    RecognizeFunc((fn)[](T z) { return sin(z); }, "sin", OpCode::sin);
+    RecognizeFunc((fn)[](T z) { return cos(z); }, "cos", OpCode::cos);
+    RecognizeFunc((fn)[](T z) { return tan(z); }, "tan", OpCode::tan);
+    RecognizeFunc((fn)[](T z) { return sinh(z); }, "sinh", OpCode::sinh);
+    RecognizeFunc((fn)[](T z) { return cosh(z); }, "cosh", OpCode::cosh);
+    RecognizeFunc((fn)[](T z) { return tanh(z); }, "tanh", OpCode::tanh);
+    RecognizeFunc((fn)[](T z) { return asin(z); }, "asin", OpCode::asin);
+    RecognizeFunc((fn)[](T z) { return acos(z); }, "acos", OpCode::acos);
+    RecognizeFunc((fn)[](T z) { return atan(z); }, "atan", OpCode::atan);
+    RecognizeFunc((fn)[](T z) { return asinh(z); }, "asinh", OpCode::asinh);
+    RecognizeFunc((fn)[](T z) { return acosh(z); }, "acosh", OpCode::acosh);
+    RecognizeFunc((fn)[](T z) { return atanh(z); }, "atanh", OpCode::atanh);
 
     // Derived functions for convenience
 
-    RecognizeFunc((fn)[](T z) { return  1.0 / cos(z); }, "sec");
-    RecognizeFunc((fn)[](T z) { return  1.0 / sin(z); }, "csc");
-    RecognizeFunc((fn)[](T z) { return  cos(z) / sin(z); }, "cot");
-    RecognizeFunc((fn)[](T z) { return  1.0 / cosh(z); }, "sech");
-    RecognizeFunc((fn)[](T z) { return  1.0 / sinh(z); }, "csch");
-    RecognizeFunc((fn)[](T z) { return  cosh(z) / sinh(z); }, "coth");
-    RecognizeFunc((fn)[](T z) { return  acos(1.0 / z); }, "asec");
-    RecognizeFunc((fn)[](T z) { return  asin(1.0 / z); }, "acsc");
-    RecognizeFunc((fn)[](T z) { return  atan(1.0 / z); }, "acot");
-    RecognizeFunc((fn)[](T z) { return  acosh(1.0 / z); }, "asech");
-    RecognizeFunc((fn)[](T z) { return  asinh(1.0 / z); }, "acsch");
-    RecognizeFunc((fn)[](T z) { return  atanh(1.0 / z); }, "acoth");
+    RecognizeFunc((fn)[](T z) { return 1.0 / cos(z); }, "sec", OpCode::sec);
+    RecognizeFunc((fn)[](T z) { return 1.0 / sin(z); }, "csc", OpCode::csc);
+    RecognizeFunc((fn)[](T z) { return cos(z) / sin(z); }, "cot", OpCode::cot);
+    RecognizeFunc((fn)[](T z) { return 1.0 / cosh(z); }, "sech", OpCode::sech);
+    RecognizeFunc((fn)[](T z) { return 1.0 / sinh(z); }, "csch", OpCode::csch);
+    RecognizeFunc((fn)[](T z) { return cosh(z) / sinh(z); }, "coth",
+                  OpCode::coth);
+    RecognizeFunc((fn)[](T z) { return acos(1.0 / z); }, "asec", OpCode::asec);
+    RecognizeFunc((fn)[](T z) { return asin(1.0 / z); }, "acsc", OpCode::acsc);
+    RecognizeFunc((fn)[](T z) { return atan(1.0 / z); }, "acot", OpCode::acot);
+    RecognizeFunc((fn)[](T z) { return acosh(1.0 / z); }, "asech",
+                  OpCode::asech);
+    RecognizeFunc((fn)[](T z) { return asinh(1.0 / z); }, "acsch",
+                  OpCode::acsch);
+    RecognizeFunc((fn)[](T z) { return atanh(1.0 / z); }, "acoth",
+                  OpCode::acoth);
 
     // Special functions
 
-    // Zeta implementation isn't very good. Diverges when too far away from
-    // the real line. Around the critical strip, that's about += 50i;
-    RecognizeFunc((std::function<T(T)>)[](T z) { return zeta(z); }, "zeta");
+    // Accurate at any height; see zeta.h.
+    RecognizeFunc((std::function<T(T)>)[](T z) { return zeta(z); }, "zeta",
+                  OpCode::zeta);
+
+    // Accuracy targets and methods are in SpecialFunctions.h.
+    RecognizeFunc((fn)[](T z) { return Gamma(z); }, "gamma", OpCode::gamma);
+    RecognizeFunc((fn)[](T z) { return LogGamma(z); }, "loggamma",
+                  OpCode::loggamma);
+    RecognizeFunc((fn)[](T z) { return Digamma(z); }, "digamma",
+                  OpCode::digamma);
+    RecognizeFunc((fn)[](T z) { return Erf(z); }, "erf", OpCode::erf);
+    RecognizeFunc((fn)[](T z) { return Erfc(z); }, "erfc", OpCode::erfc);
+    RecognizeFunc((fn)[](T m) { return EllipticK(m); }, "ellipk",
+                  OpCode::ellipk);
+    RecognizeFunc((fn)[](T m) { return EllipticE(m); }, "ellipe",
+                  OpCode::ellipe);
+
+    // besselj(n, z), besseli(n, z) and polylog(s, z)
+    typedef std::function<T(T, T)> fn2;
+    RecognizeToken(new SymbolFunc<T, T, T>(
+        (fn2)[](T n, T z) { return BesselJ(n, z); }, "besselj",
+        OpCode::besselj));
+    RecognizeToken(new SymbolFunc<T, T, T>(
+        (fn2)[](T n, T z) { return BesselI(n, z); }, "besseli",
+        OpCode::besseli));
+    RecognizeToken(new SymbolFunc<T, T, T>(
+        (fn2)[](T s, T z) { return Polylog(s, z); }, "polylog",
+        OpCode::polylog));
+
+    // Series and products, e.g. sum(k, 1, 50, z^k / k)
+    RecognizeToken(new SymbolLoop<T>("sum", OpCode::sum));
+    RecognizeToken(new SymbolLoop<T>("prod", OpCode::prod));
 }
\ No newline at end of file
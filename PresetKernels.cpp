@@ -0,0 +1,322 @@
+#include "PresetKernels.h"
+#include "VectorMath.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// Parameters must be in the first MAX_SLOTS registers, which is room for
+// the constants and variables any of the presets has.
+constexpr size_t MAX_SLOTS = 4;
+// Points are copied into blocks of this many to be worked on in split form.
+constexpr size_t BLOCK = 64;
+
+constexpr size_t SlotCombinations(size_t params)
+{
+    return params == 0 ? 1 : MAX_SLOTS * SlotCombinations(params - 1);
+}
+
+// u + iv = (a + ib) / (c + id), by the same arithmetic as the batch
+// interpreter's division.
+inline void Divide(double a, double b, double c, double d, double& u,
+                   double& v)
+{
+    const bool wide = std::abs(c) >= std::abs(d);
+    const double s  = wide ? c : d;
+    const double t  = wide ? d : c;
+    const double q  = t / s;
+    const double r  = s + t * q;
+    const double x  = wide ? a : b;
+    const double y  = wide ? b : a;
+    u               = (x + y * q) / r;
+    const double w  = (y - x * q) / r;
+    v               = wide ? w : -w;
+}
+
+// The presets. Each evaluates its function at n points, given as x + iy,
+// with the parameters p in the order they appear in the program built from
+// EXAMPLE.
+
+struct Square
+{
+    static constexpr const char* EXAMPLE = "z^2";
+    static constexpr size_t PARAMS       = 0;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx*)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            u[k] = x[k] * x[k] - y[k] * y[k];
+            v[k] = x[k] * y[k] + y[k] * x[k];
+        }
+    }
+};
+
+// p0 / z
+struct Reciprocal
+{
+    static constexpr const char* EXAMPLE = "1/z";
+    static constexpr size_t PARAMS       = 1;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx* p)
+    {
+        for (size_t k = 0; k < n; k++)
+            Divide(p[0].real(), p[0].imag(), x[k], y[k], u[k], v[k]);
+    }
+};
+
+// Functions VectorMath has.
+template <VectorMath::Unary VectorMath::*F> struct Elementary
+{
+    static constexpr size_t PARAMS = 0;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx*)
+    {
+        (VectorMath::Get().*F)(x, y, u, v, n);
+    }
+};
+struct Exp : Elementary<&VectorMath::exp>
+{
+    static constexpr const char* EXAMPLE = "exp(z)";
+};
+struct Sin : Elementary<&VectorMath::sin>
+{
+    static constexpr const char* EXAMPLE = "sin(z)";
+};
+struct Cos : Elementary<&VectorMath::cos>
+{
+    static constexpr const char* EXAMPLE = "cos(z)";
+};
+
+// (z - p1) / (z + p0), as the builder does z + a first.
+struct Mobius
+{
+    static constexpr const char* EXAMPLE = "(z-a)/(z+a)";
+    static constexpr size_t PARAMS       = 2;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx* p)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            Divide(x[k] - p[1].real(), y[k] - p[1].imag(), x[k] + p[0].real(),
+                   y[k] + p[0].imag(), u[k], v[k]);
+        }
+    }
+};
+
+// z + p0 / z
+struct Joukowski
+{
+    static constexpr const char* EXAMPLE = "z+1/z";
+    static constexpr size_t PARAMS       = 1;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx* p)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            double r, i;
+            Divide(p[0].real(), p[0].imag(), x[k], y[k], r, i);
+            u[k] = x[k] + r;
+            v[k] = y[k] + i;
+        }
+    }
+};
+
+// z^2 + p0
+struct Quadratic
+{
+    static constexpr const char* EXAMPLE = "z^2+c";
+    static constexpr size_t PARAMS       = 1;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx* p)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            u[k] = (x[k] * x[k] - y[k] * y[k]) + p[0].real();
+            v[k] = (x[k] * y[k] + y[k] * x[k]) + p[0].imag();
+        }
+    }
+};
+
+// p1 / (z - p0)
+struct SimplePole
+{
+    static constexpr const char* EXAMPLE = "1/(z-a)";
+    static constexpr size_t PARAMS       = 2;
+    static void Eval(const double* x, const double* y, double* u, double* v,
+                     size_t n, const cplx* p)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            Divide(p[1].real(), p[1].imag(), x[k] - p[0].real(),
+                   y[k] - p[0].imag(), u[k], v[k]);
+        }
+    }
+};
+
+// The kernel for Preset with its parameters in registers Slots.
+template <typename Preset, size_t... Slots>
+void PresetKernel(const double* leaves, const double* inRe, const double* inIm,
+                  size_t inStride, double* outRe, double* outIm,
+                  size_t outStride, size_t n)
+{
+    const cplx p[] = {cplx(leaves[2 * Slots], leaves[2 * Slots + 1])...,
+                      cplx()};
+    double x[BLOCK], y[BLOCK], u[BLOCK], v[BLOCK];
+    for (size_t first = 0; first < n; first += BLOCK)
+    {
+        const size_t count = std::min(BLOCK, n - first);
+        for (size_t k = 0; k < count; k++)
+        {
+            x[k] = inRe[(first + k) * inStride];
+            y[k] = inIm[(first + k) * inStride];
+        }
+        Preset::Eval(x, y, u, v, count, p);
+        for (size_t k = 0; k < count; k++)
+        {
+            outRe[(first + k) * outStride] = u[k];
+            outIm[(first + k) * outStride] = v[k];
+        }
+    }
+}
+
+// Kernel number Index, whose J-th parameter is in register
+// (Index / MAX_SLOTS^J) % MAX_SLOTS.
+template <typename Preset, size_t Index, size_t... J>
+NativeKernelFn KernelAt(std::index_sequence<J...>)
+{
+    return &PresetKernel<Preset,
+                         Index / SlotCombinations(J) % MAX_SLOTS...>;
+}
+
+template <typename Preset, size_t... Index>
+std::vector<NativeKernelFn> KernelTable(std::index_sequence<Index...>)
+{
+    return {KernelAt<Preset, Index>(
+        std::make_index_sequence<Preset::PARAMS>())...};
+}
+
+struct Entry
+{
+    size_t params;
+    std::vector<NativeKernelFn> kernels; // Indexed as in KernelAt()
+};
+
+// A description of P's instructions in which the independent variable is z,
+// every other leaf is p, and t<i> is the result of instruction i. The
+// operands of + and * are put in a fixed order, which doesn't change the
+// result. The registers of the p's, in order, go in slots. Empty if P does
+// more than apply built-in operations.
+std::string Shape(const Program<cplx>& P, int ivSlot,
+                  std::vector<unsigned int>& slots)
+{
+    const auto& code = P.GetCode();
+    const unsigned int leafCount =
+        (unsigned int)(P.GetConstants().size() + P.GetVarNames().size());
+    if (code.empty() || ivSlot < 0) return "";
+
+    std::vector<std::string> values(P.GetRegisterCount());
+    for (unsigned int r = 0; r < leafCount; r++)
+        values[r] = (int)r == ivSlot ? "z" : "p";
+    // z, then results, then parameters.
+    auto rank = [](const std::string& s) {
+        return s[0] == 'z' ? 0 : s[0] == 't' ? 1 : 2;
+    };
+
+    std::string shape;
+    slots.clear();
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        Instruction I = code[i];
+        if (IsLoopOp(I.op) || I.op == OpCode::call) return "";
+        const bool binary = IsBinaryOp(I.op);
+        if (binary && (I.op == OpCode::add || I.op == OpCode::mul) &&
+            std::make_tuple(rank(values[I.b]), values[I.b]) <
+                std::make_tuple(rank(values[I.a]), values[I.a]))
+            std::swap(I.a, I.b);
+
+        shape += std::to_string((int)I.op) + " " + values[I.a];
+        if (values[I.a] == "p") slots.push_back(I.a);
+        if (binary)
+        {
+            shape += " " + values[I.b];
+            if (values[I.b] == "p") slots.push_back(I.b);
+        }
+        shape += ";";
+        values[I.dst] = "t" + std::to_string(i);
+    }
+    if (values[P.GetResultRegister()] != "t" + std::to_string(code.size() - 1))
+        return "";
+    return shape;
+}
+
+template <typename Preset>
+void AddPreset(std::map<std::string, Entry>& gallery, Parser<cplx>& parser)
+{
+    ParsedFunc<cplx> f     = parser.Parse(Preset::EXAMPLE);
+    const Program<cplx>& P = f.GetProgram();
+    std::vector<unsigned int> slots;
+    Entry& entry  = gallery[Shape(P, P.GetVarSlot(f.GetIV()), slots)];
+    entry.params  = Preset::PARAMS;
+    entry.kernels = KernelTable<Preset>(
+        std::make_index_sequence<SlotCombinations(Preset::PARAMS)>());
+}
+
+// The presets by shape, worked out from their examples so that they always
+// agree with what ProgramBuilder makes.
+const std::map<std::string, Entry>& Gallery()
+{
+    static const std::map<std::string, Entry> gallery = [] {
+        std::map<std::string, Entry> g;
+        Parser<cplx> parser;
+        AddPreset<Square>(g, parser);
+        AddPreset<Reciprocal>(g, parser);
+        AddPreset<Exp>(g, parser);
+        AddPreset<Sin>(g, parser);
+        AddPreset<Cos>(g, parser);
+        AddPreset<Mobius>(g, parser);
+        AddPreset<Joukowski>(g, parser);
+        AddPreset<Quadratic>(g, parser);
+        AddPreset<SimplePole>(g, parser);
+        return g;
+    }();
+    return gallery;
+}
+} // namespace
+
+std::shared_ptr<const NativeKernel> FindPresetKernel(const Program<cplx>& P,
+                                                     int ivSlot)
+{
+    std::vector<unsigned int> slots;
+    const std::string shape = Shape(P, ivSlot, slots);
+    auto found              = Gallery().find(shape);
+    if (shape.empty() || found == Gallery().end()) return nullptr;
+
+    const Entry& entry = found->second;
+    if (slots.size() != entry.params) return nullptr;
+    size_t index = 0;
+    for (size_t j = slots.size(); j-- > 0;)
+    {
+        if (slots[j] >= MAX_SLOTS) return nullptr;
+        index = index * MAX_SLOTS + slots[j];
+    }
+
+    auto kernel    = std::make_shared<NativeKernel>();
+    kernel->ivSlot = ivSlot;
+    kernel->fn.store(entry.kernels[index], std::memory_order_release);
+    return kernel;
+}
+
+bool UsePresetKernel(ParsedFunc<cplx>& f)
+{
+    const Program<cplx>& P = f.GetProgram();
+    auto kernel = FindPresetKernel(P, P.GetVarSlot(f.GetIV()));
+    if (!kernel) return false;
+    f.SetNativeKernel(std::move(kernel));
+    return true;
+}
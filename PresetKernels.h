@@ -0,0 +1,27 @@
+#pragma once
+#include <memory>
+
+#include "NativeKernel.h"
+#include "Parser.h"
+
+typedef std::complex<double> cplx;
+
+// Hand-written kernels for the functions most sessions use: z^2, 1/z,
+// exp(z), sin(z), cos(z), (z-a)/(z+a), z+1/z, z^2+c and 1/(z-a). A program
+// matches a preset when its instructions have the same shape, which ignores
+// the names and values of its constants and variables: every leaf operand
+// is a parameter, read from the registers on each call, so 1/(z-1),
+// 1/(z-a) and 2/(z+i) all share one kernel. Each kernel is a template
+// instantiated for the registers its parameters are in.
+//
+// A preset is an ordinary NativeKernel that is ready immediately, so
+// EvalContext uses it exactly as it would a compiled one.
+
+// Returns a kernel for P, taking its input in register ivSlot, or nullptr if
+// P isn't one of the presets.
+std::shared_ptr<const NativeKernel> FindPresetKernel(const Program<cplx>& P,
+                                                     int ivSlot);
+
+// Attaches the preset kernel for f, if there is one. Returns whether there
+// was. Like a compiled kernel, it is dropped if f is recompiled.
+bool UsePresetKernel(ParsedFunc<cplx>& f);
@@ -0,0 +1,2107 @@
+#pragma once
+#include "Dual.h"
+#include "Interval.h"
+#include "Multiprecision.h"
+#include "NativeKernel.h"
+#include "SpecialFunctions.h"
+#include "Token.h"
+#include "VectorMath.h"
+#include "zeta.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// A Program<T> is the compiled form of a ParsedFunc: a flat list of
+// register-based instructions plus a constant pool. Registers are laid out
+// as [constants | variables | temporaries], so the caller only has to fill in
+// the variable slots before calling Run(). Sums and products are loops,
+// whose bodies are kept apart from the main code. The interpreter loop does
+// no virtual dispatch, throws nothing and allocates nothing; all validation
+// happens once, in ProgramBuilder<T>.
+//
+// A built Program<T> is never modified, so it is shared through
+// std::shared_ptr<const Program<T>>. Everything that changes between calls
+// (parameter values, the independent variable, scratch space) lives in an
+// EvalContext<T>, one per thread or caller.
+
+// value = true if T looks like std::complex, i.e. has real() and imag().
+template <class, class = void> struct is_complex_type
+{
+    static constexpr bool value{false};
+};
+template <class T>
+struct is_complex_type<
+    T, std::void_t<decltype(std::declval<T>().real() + std::declval<T>().imag())>>
+{
+    static constexpr bool value{true};
+};
+
+// One step of a Program. dst, a and b are register indices, except for
+// OpCode::call, where a is an offset into the argument list and b is the
+// index of the callable, and OpCode::sum and prod, where a is the index of
+// the loop.
+struct Instruction
+{
+    OpCode op;
+    unsigned int dst;
+    unsigned int a;
+    unsigned int b;
+};
+
+// Per-point register values for the general Program<T>::RunBatch: the real
+// and imaginary parts of register reg at each point, stride doubles apart.
+struct BatchInput
+{
+    unsigned int reg;
+    const double* re;
+    const double* im;
+    size_t stride;
+};
+struct BatchOutput
+{
+    unsigned int reg;
+    double* re;
+    double* im;
+    size_t stride;
+};
+
+template <typename T> class ProgramBuilder;
+
+// Refers to a variable of one particular Program<T> by its position, so it
+// can be set without looking up its name. index is -1 if the variable isn't
+// used. See ParsedFunc<T>::GetVarHandle().
+struct VarHandle
+{
+    int index                  = -1;
+    unsigned long long program = 0; // Program<T>::GetId()
+
+    bool IsValid() const { return index >= 0; }
+};
+
+// True for operations reading both a and b.
+inline bool IsBinaryOp(OpCode op)
+{
+    return (op >= OpCode::add && op <= OpCode::powr) ||
+           (op >= OpCode::besselj && op <= OpCode::polylog);
+}
+
+inline bool IsLoopOp(OpCode op)
+{
+    return op == OpCode::sum || op == OpCode::prod;
+}
+
+template <typename T> class Program
+{
+    friend class ProgramBuilder<T>;
+
+public:
+    // Functions with more arguments than this are rejected by the builder,
+    // so the interpreter can gather arguments on the stack.
+    static constexpr unsigned int MAX_CALL_ARITY = 8;
+
+    struct Callable
+    {
+        std::function<T(const T*)> f;
+        unsigned int arity;
+    };
+
+    // A sum or product, which runs code[begin, end) of the loop code once
+    // for each value of its index register, then adds or multiplies in the
+    // value left in register term. The index counts up in steps of 1 from
+    // the real part of register from while it is no more than that of
+    // register to, so it takes at most MAX_LOOP_ITERATIONS values. Loops of
+    // more than EXACT_LOOP_TERMS terms, such as series to infinity, stop
+    // early once CONVERGED_TERMS terms in a row have made no difference.
+    // Terms only count towards that once the total has left its starting
+    // value, so leading zero terms don't end a sum.
+    struct Loop
+    {
+        unsigned int index;
+        unsigned int from;
+        unsigned int to;
+        unsigned int term;
+        unsigned int begin;
+        unsigned int end;
+    };
+    static constexpr size_t MAX_LOOP_ITERATIONS = 1000000;
+    static constexpr unsigned int CONVERGED_TERMS = 4;
+    static constexpr double EXACT_LOOP_TERMS = 10000;
+
+    // Sizes regs and fills in the constant pool. Variable slots are left
+    // alone, except that new ones are zeroed.
+    void InitRegisters(std::vector<T>& regs) const
+    {
+        regs.resize(registerCount);
+        std::copy(constants.begin(), constants.end(), regs.begin());
+    }
+
+    // Register holding the named variable, or -1 if it is not used.
+    int GetVarSlot(const std::string& name) const
+    {
+        for (size_t i = 0; i < varNames.size(); i++)
+        {
+            if (varNames[i] == name) return (int)(constants.size() + i);
+        }
+        return -1;
+    }
+
+    // Variables occupy consecutive registers, in the order of GetVarNames().
+    unsigned int GetFirstVarSlot() const
+    {
+        return (unsigned int)constants.size();
+    }
+    const std::vector<std::string>& GetVarNames() const { return varNames; }
+    VarHandle GetVarHandle(const std::string& name) const
+    {
+        int slot = GetVarSlot(name);
+        return {slot < 0 ? -1 : slot - (int)GetFirstVarSlot(), id};
+    }
+    // Distinguishes built programs, so handles from an older program can be
+    // recognized.
+    unsigned long long GetId() const { return id; }
+    unsigned int GetRegisterCount() const { return registerCount; }
+    size_t GetInstructionCount() const { return code.size(); }
+    const std::vector<Instruction>& GetCode() const { return code; }
+    const std::vector<Loop>& GetLoops() const { return loops; }
+    // Bodies of the loops, which aren't part of GetCode().
+    const std::vector<Instruction>& GetLoopCode() const { return loopCode; }
+    const std::vector<T>& GetConstants() const { return constants; }
+    unsigned int GetResultRegister() const { return result; }
+
+    // regs must have been prepared with InitRegisters(). U is normally T,
+    // but can be any type constructible from T with the same operations,
+    // e.g. Dual<T> to get derivatives.
+    template <typename U> U Run(U* regs) const;
+
+    // Evaluates the program at n points, writing the value of each in[k] to
+    // the variable slot ivSlot (ignored if negative). regs supplies the
+    // constants and other variables. out may alias in. For
+    // std::complex<double>, points are processed BATCH_SIZE at a time with
+    // every operation applied to the whole block, in structure-of-arrays
+    // form, so the arithmetic compiles to vector loops. scratch is reused
+    // between calls to avoid allocating. Its element type R sets the
+    // precision of the arithmetic: double, or float for twice as many points
+    // per vector where that is accurate enough. Functions other than + - * /
+    // are always evaluated in double. If bound isn't null, bound[k] is set
+    // to an estimate of the rounding error of out[k]; see ScaleBatch().
+    template <typename R>
+    void RunBatch(T* regs, int ivSlot, const T* in, T* out, size_t n,
+                  std::vector<R>& scratch, R* bound = nullptr) const;
+
+    // Same, for separate real and imaginary arrays. Strides are counted in
+    // doubles. Only available for std::complex<double>.
+    template <typename R>
+    void RunBatch(const T* regs, int ivSlot, const double* inRe,
+                  const double* inIm, size_t inStride, double* outRe,
+                  double* outIm, size_t outStride, size_t n,
+                  std::vector<R>& scratch, R* bound = nullptr) const;
+
+    // General form of the above: every point loads each of the inputs and
+    // stores each of the outputs. Inputs may be leaf registers, i.e.
+    // constants and variables, and outputs any register. bound is for the
+    // first output.
+    template <typename R>
+    void RunBatch(const T* regs, const BatchInput* in, size_t inCount,
+                  const BatchOutput* out, size_t outCount, size_t n,
+                  std::vector<R>& scratch, R* bound = nullptr) const;
+
+    // Splits the program for evaluating at the same points again and again
+    // with different parameters, i.e. variables other than the one in
+    // register ivSlot. ivPart runs the instructions that don't depend on any
+    // parameter, and leaves each of their values used elsewhere in a
+    // register of its own, starting at GetRegisterCount(). paramPart runs the
+    // rest, reading those values from extra variables, appended after this
+    // program's. Both keep this program's constants and variables in the
+    // same registers. Returns false, leaving both alone, if nothing would be
+    // left for ivPart, or if the program has loops.
+    bool SplitByParameters(int ivSlot, Program& ivPart,
+                           Program& paramPart) const;
+
+    static constexpr size_t BATCH_SIZE = 64;
+
+private:
+    template <typename U>
+    void Exec(U* r, const Instruction* first, const Instruction* last) const;
+    template <typename U> void RunLoop(U* r, const Instruction& I) const;
+    // Batch versions of the above, on BATCH_SIZE points laid out as in
+    // RunBatch(), of which the first count are in use. If scale isn't null,
+    // ScaleBatch() follows every instruction.
+    template <typename R>
+    void ExecBatch(R* data, size_t count, const Instruction* first,
+                   const Instruction* last, R* scale = nullptr,
+                   R* rel = nullptr) const;
+    template <typename R>
+    void RunLoopBatch(R* data, size_t count, const Instruction& I) const;
+    // Running error estimate for ExecBatch(), called after each instruction
+    // I. Every register's value in data differs from the exact one, due to
+    // rounding the arithmetic and the inputs to R, by at most rel[reg] times
+    // scale at that point, a bound on the magnitudes of the terms making it
+    // up, as |re| + |im|. rel is the same at every point. Operations other
+    // than + - * / and negation give an infinite scale.
+    template <typename R>
+    void ScaleBatch(const R* data, R* scale, R* rel,
+                    const Instruction& I) const;
+
+    std::vector<Instruction> code;
+    std::vector<Loop> loops;
+    std::vector<Instruction> loopCode;
+    std::vector<T> constants;
+    std::vector<std::string> varNames;
+    std::vector<unsigned int> callArgs;
+    std::vector<Callable> calls;
+    unsigned int registerCount = 0;
+    unsigned int result        = 0;
+    unsigned long long id      = NextId();
+
+    static unsigned long long NextId()
+    {
+        static std::atomic<unsigned long long> next{1};
+        return next++;
+    }
+};
+
+// Applies a one-argument operation. Shared by the scalar and batch
+// interpreters so both compute exactly the same thing.
+template <typename T> inline T EvalUnary(OpCode op, const T& a)
+{
+    using std::acos;
+    using std::acosh;
+    using std::asin;
+    using std::asinh;
+    using std::atan;
+    using std::atanh;
+    using std::cos;
+    using std::cosh;
+    using std::exp;
+    using std::log;
+    using std::sin;
+    using std::sinh;
+    using std::sqrt;
+    using std::tan;
+    using std::tanh;
+
+    switch (op)
+    {
+    case OpCode::neg: return -a;
+    case OpCode::exp: return exp(a);
+    case OpCode::log: return log(a);
+    case OpCode::sqrt: return sqrt(a);
+    case OpCode::sin: return sin(a);
+    case OpCode::cos: return cos(a);
+    case OpCode::tan: return tan(a);
+    case OpCode::sinh: return sinh(a);
+    case OpCode::cosh: return cosh(a);
+    case OpCode::tanh: return tanh(a);
+    case OpCode::asin: return asin(a);
+    case OpCode::acos: return acos(a);
+    case OpCode::atan: return atan(a);
+    case OpCode::asinh: return asinh(a);
+    case OpCode::acosh: return acosh(a);
+    case OpCode::atanh: return atanh(a);
+    case OpCode::sec: return 1.0 / cos(a);
+    case OpCode::csc: return 1.0 / sin(a);
+    case OpCode::cot: return cos(a) / sin(a);
+    case OpCode::sech: return 1.0 / cosh(a);
+    case OpCode::csch: return 1.0 / sinh(a);
+    case OpCode::coth: return cosh(a) / sinh(a);
+    case OpCode::asec: return acos(1.0 / a);
+    case OpCode::acsc: return asin(1.0 / a);
+    case OpCode::acot: return atan(1.0 / a);
+    case OpCode::asech: return acosh(1.0 / a);
+    case OpCode::acsch: return asinh(1.0 / a);
+    case OpCode::acoth: return atanh(1.0 / a);
+    case OpCode::zeta: return zeta(a);
+    case OpCode::gamma: return Gamma(a);
+    case OpCode::loggamma: return LogGamma(a);
+    case OpCode::digamma: return Digamma(a);
+    case OpCode::erf: return Erf(a);
+    case OpCode::erfc: return Erfc(a);
+    case OpCode::ellipk: return EllipticK(a);
+    case OpCode::ellipe: return EllipticE(a);
+    default: return a;
+    }
+}
+
+// pow for an exponent known to be real. For complex a this avoids taking the
+// complex log and exp of the exponent.
+template <typename T> inline T PowReal(const T& a, const T& b)
+{
+    using std::pow;
+    if constexpr (is_complex_type<T>::value)
+        return pow(a, b.real());
+    else
+        return pow(a, b);
+}
+
+// Applies a two-argument operation.
+template <typename T> inline T EvalBinary(OpCode op, const T& a, const T& b)
+{
+    using std::pow;
+
+    switch (op)
+    {
+    case OpCode::add: return a + b;
+    case OpCode::sub: return a - b;
+    case OpCode::mul: return a * b;
+    case OpCode::div: return a / b;
+    case OpCode::pow: return pow(a, b);
+    case OpCode::powr: return PowReal(a, b);
+    case OpCode::besselj: return BesselJ(a, b);
+    case OpCode::besseli: return BesselI(a, b);
+    case OpCode::polylog: return Polylog(a, b);
+    default: return a;
+    }
+}
+
+// Applies op to n <= B points with the SIMD kernels of VectorMath.h. As for
+// every function but + - * /, single precision batches are evaluated in
+// double.
+template <size_t B, typename R>
+inline void VectorBatch(OpCode op, const R* ar, const R* ai, const R* br,
+                        const R* bi, R* dr, R* di, size_t n)
+{
+    const VectorMath& M = VectorMath::Get();
+    const double *xr, *xi, *yr, *yi;
+    double* ur;
+    double* ui;
+    double buffer[6][B];
+    if constexpr (std::is_same_v<R, double>)
+    {
+        xr = ar, xi = ai, yr = br, yi = bi, ur = dr, ui = di;
+    }
+    else
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            buffer[0][k] = ar[k];
+            buffer[1][k] = ai[k];
+        }
+        if (op == OpCode::pow || op == OpCode::powr)
+        {
+            for (size_t k = 0; k < n; k++)
+            {
+                buffer[2][k] = br[k];
+                buffer[3][k] = bi[k];
+            }
+        }
+        xr = buffer[0], xi = buffer[1], yr = buffer[2], yi = buffer[3];
+        ur = buffer[4], ui = buffer[5];
+    }
+
+    switch (op)
+    {
+    case OpCode::exp: M.exp(xr, xi, ur, ui, n); break;
+    case OpCode::log: M.log(xr, xi, ur, ui, n); break;
+    case OpCode::sqrt: M.sqrt(xr, xi, ur, ui, n); break;
+    case OpCode::sin: M.sin(xr, xi, ur, ui, n); break;
+    case OpCode::cos: M.cos(xr, xi, ur, ui, n); break;
+    case OpCode::tan: M.tan(xr, xi, ur, ui, n); break;
+    case OpCode::sinh: M.sinh(xr, xi, ur, ui, n); break;
+    case OpCode::cosh: M.cosh(xr, xi, ur, ui, n); break;
+    case OpCode::tanh: M.tanh(xr, xi, ur, ui, n); break;
+    case OpCode::pow: M.pow(xr, xi, yr, yi, ur, ui, n); break;
+    case OpCode::powr: M.powr(xr, xi, yr, yi, ur, ui, n); break;
+    default: break;
+    }
+
+    if constexpr (!std::is_same_v<R, double>)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            dr[k] = (R)ur[k];
+            di[k] = (R)ui[k];
+        }
+    }
+}
+
+// Calls a function that is not built in. Other evaluation types overload
+// this, e.g. Dual<T>.
+template <typename T>
+inline T ApplyCallable(const std::function<T(const T*)>& f, const T* args,
+                       unsigned int arity)
+{
+    return f(args);
+}
+
+// Whether adding change to a sum of size scale makes no difference at the
+// precision of T. Used to stop loops that have converged; other evaluation
+// types overload this.
+template <typename T> inline bool Negligible(const T& change, const T& scale)
+{
+    using std::abs;
+    if constexpr (is_complex_type<T>::value)
+    {
+        using Real     = std::decay_t<decltype(abs(change.real()))>;
+        const Real eps = std::numeric_limits<Real>::epsilon();
+        return std::max(abs(change.real()), abs(change.imag())) <=
+               eps * std::max(abs(scale.real()), abs(scale.imag()));
+    }
+    else
+        return abs(change) <= std::numeric_limits<T>::epsilon() * abs(scale);
+}
+
+// The bound of a loop given by x, which is read as a real number. Returns
+// false if x isn't a single number, as for intervals.
+template <typename T> inline bool LoopBound(const T& x, double& bound)
+{
+    if constexpr (is_complex_type<T>::value)
+        bound = (double)x.real();
+    else
+        bound = (double)x;
+    return true;
+}
+
+template <typename T>
+template <typename U>
+inline U Program<T>::Run(U* r) const
+{
+    Exec(r, code.data(), code.data() + code.size());
+    return r[result];
+}
+
+template <typename T>
+template <typename U>
+inline void Program<T>::Exec(U* r, const Instruction* first,
+                             const Instruction* last) const
+{
+    using std::pow;
+
+    for (const Instruction* it = first; it != last; ++it)
+    {
+        const Instruction& I = *it;
+        const U& a           = r[I.a];
+        switch (I.op)
+        {
+        case OpCode::add: r[I.dst] = a + r[I.b]; break;
+        case OpCode::sub: r[I.dst] = a - r[I.b]; break;
+        case OpCode::mul: r[I.dst] = a * r[I.b]; break;
+        case OpCode::div: r[I.dst] = a / r[I.b]; break;
+        case OpCode::pow: r[I.dst] = pow(a, r[I.b]); break;
+        case OpCode::powr: r[I.dst] = PowReal(a, r[I.b]); break;
+        case OpCode::besselj:
+        case OpCode::besseli:
+        case OpCode::polylog: r[I.dst] = EvalBinary(I.op, a, r[I.b]); break;
+        case OpCode::call:
+        {
+            const Callable& C = calls[I.b];
+            U args[MAX_CALL_ARITY];
+            for (unsigned int k = 0; k < C.arity; k++)
+                args[k] = r[callArgs[I.a + k]];
+            r[I.dst] = ApplyCallable(C.f, args, C.arity);
+            break;
+        }
+        case OpCode::sum:
+        case OpCode::prod: RunLoop(r, I); break;
+        default: r[I.dst] = EvalUnary(I.op, a);
+        }
+    }
+}
+
+template <typename T>
+template <typename U>
+inline void Program<T>::RunLoop(U* r, const Instruction& I) const
+{
+    const Loop& L       = loops[I.a];
+    const bool product  = I.op == OpCode::prod;
+    const U one         = U(T(1));
+    U total             = product ? one : U(T(0));
+    double from, to;
+    if (!LoopBound(r[L.from], from) || !LoopBound(r[L.to], to))
+    {
+        // Only intervals have uncertain bounds.
+        if constexpr (std::is_same_v<U, ComplexInterval>)
+            total = ComplexInterval::Entire();
+        r[I.dst] = total;
+        return;
+    }
+
+    const U zero       = U(T(0));
+    const bool canStop = to - from >= EXACT_LOOP_TERMS;
+    unsigned int quiet = 0;
+    for (size_t j = 0; j < MAX_LOOP_ITERATIONS && from + j <= to; j++)
+    {
+        r[L.index] = U(T(from + j));
+        Exec(r, loopCode.data() + L.begin, loopCode.data() + L.end);
+        const U& term = r[L.term];
+        bool negligible;
+        // Negligible(x, zero) only holds for exactly zero x.
+        if (product)
+        {
+            total      = total * term;
+            negligible = Negligible(term - one, one) &&
+                         !Negligible(total - one, zero);
+        }
+        else
+        {
+            total      = total + term;
+            negligible = Negligible(term, total) && !Negligible(total, zero);
+        }
+        quiet = negligible ? quiet + 1 : 0;
+        if (canStop && quiet == CONVERGED_TERMS) break;
+    }
+    r[I.dst] = total;
+}
+
+template <typename T>
+template <typename R>
+inline void Program<T>::RunBatch(T* regs, int ivSlot, const T* in, T* out,
+                                 size_t n, std::vector<R>& scratch,
+                                 R* bound) const
+{
+    if constexpr (std::is_same_v<T, std::complex<double>>)
+    {
+        // std::complex<double> is layout-compatible with double[2].
+        auto inData  = reinterpret_cast<const double*>(in);
+        auto outData = reinterpret_cast<double*>(out);
+        RunBatch(regs, ivSlot, inData, inData + 1, 2, outData, outData + 1, 2,
+                 n, scratch, bound);
+    }
+    else
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            if (ivSlot >= 0) regs[ivSlot] = in[k];
+            out[k] = Run(regs);
+        }
+        if (bound) std::fill(bound, bound + n, R(0));
+    }
+}
+
+template <typename T>
+template <typename R>
+inline void Program<T>::RunBatch(const T* regs, int ivSlot, const double* inRe,
+                                 const double* inIm, size_t inStride,
+                                 double* outRe, double* outIm,
+                                 size_t outStride, size_t n,
+                                 std::vector<R>& scratch, R* bound) const
+{
+    BatchInput input{(unsigned int)ivSlot, inRe, inIm, inStride};
+    BatchOutput output{result, outRe, outIm, outStride};
+    RunBatch(regs, &input, ivSlot >= 0 ? 1 : 0, &output, 1, n, scratch,
+             bound);
+}
+
+template <typename T>
+template <typename R>
+inline void Program<T>::RunBatch(const T* regs, const BatchInput* in,
+                                 size_t inCount, const BatchOutput* out,
+                                 size_t outCount, size_t n,
+                                 std::vector<R>& scratch, R* bound) const
+{
+    constexpr size_t B = BATCH_SIZE;
+    constexpr R u      = std::numeric_limits<R>::epsilon() / 2;
+    // Scales, if bounding, follow all the values, then the factors rel.
+    scratch.resize((bound ? 3 * B + 1 : 2 * B) * registerCount);
+    R* data  = scratch.data();
+    R* scale = bound ? data + 2 * B * registerCount : nullptr;
+    R* rel   = bound ? scale + B * registerCount : nullptr;
+    auto re  = [data](unsigned int reg) { return data + 2 * B * reg; };
+    auto im  = [data](unsigned int reg) { return data + 2 * B * reg + B; };
+
+    // Constants and parameters are the same for every point, and no
+    // instruction writes to them, so they only need broadcasting once.
+    const unsigned int leafCount = (unsigned int)(constants.size() +
+                                                  varNames.size());
+    for (unsigned int reg = 0; reg < leafCount; reg++)
+    {
+        std::fill(re(reg), re(reg) + B, (R)regs[reg].real());
+        std::fill(im(reg), im(reg) + B, (R)regs[reg].imag());
+        if (scale)
+        {
+            std::fill(scale + B * reg, scale + B * (reg + 1),
+                      std::abs(re(reg)[0]) + std::abs(im(reg)[0]));
+            rel[reg] = u;
+        }
+    }
+
+    for (size_t first = 0; first < n; first += B)
+    {
+        const size_t count = std::min(B, n - first);
+        for (size_t j = 0; j < inCount; j++)
+        {
+            const BatchInput& I = in[j];
+            R* zr               = re(I.reg);
+            R* zi               = im(I.reg);
+            for (size_t k = 0; k < count; k++)
+            {
+                zr[k] = (R)I.re[(first + k) * I.stride];
+                zi[k] = (R)I.im[(first + k) * I.stride];
+            }
+            if (scale)
+            {
+                for (size_t k = 0; k < count; k++)
+                    scale[B * I.reg + k] = std::abs(zr[k]) + std::abs(zi[k]);
+                rel[I.reg] = u;
+            }
+        }
+
+        ExecBatch(data, count, code.data(), code.data() + code.size(), scale,
+                  rel);
+        if (scale)
+        {
+            const R* s = scale + B * out[0].reg;
+            for (size_t k = 0; k < count; k++)
+                bound[first + k] = rel[out[0].reg] * s[k];
+        }
+
+        for (size_t j = 0; j < outCount; j++)
+        {
+            const BatchOutput& O = out[j];
+            const R* rr          = re(O.reg);
+            const R* ri          = im(O.reg);
+            for (size_t k = 0; k < count; k++)
+            {
+                O.re[(first + k) * O.stride] = rr[k];
+                O.im[(first + k) * O.stride] = ri[k];
+            }
+        }
+    }
+}
+
+template <typename T>
+template <typename R>
+inline void Program<T>::ExecBatch(R* data, size_t count,
+                                  const Instruction* first,
+                                  const Instruction* last, R* scale,
+                                  R* rel) const
+{
+    constexpr size_t B = BATCH_SIZE;
+    auto re = [data](unsigned int reg) { return data + 2 * B * reg; };
+    auto im = [data](unsigned int reg) { return data + 2 * B * reg + B; };
+
+    for (const Instruction* it = first; it != last; ++it)
+    {
+        const Instruction& I   = *it;
+        const R* __restrict ar = re(I.a);
+        const R* __restrict ai = im(I.a);
+        const R* __restrict br = re(I.b);
+        const R* __restrict bi = im(I.b);
+        R* __restrict dr       = re(I.dst);
+        R* __restrict di       = im(I.dst);
+
+        switch (I.op)
+        {
+        case OpCode::add:
+            for (size_t k = 0; k < B; k++)
+            {
+                dr[k] = ar[k] + br[k];
+                di[k] = ai[k] + bi[k];
+            }
+            break;
+        case OpCode::sub:
+            for (size_t k = 0; k < B; k++)
+            {
+                dr[k] = ar[k] - br[k];
+                di[k] = ai[k] - bi[k];
+            }
+            break;
+        case OpCode::mul:
+            for (size_t k = 0; k < B; k++)
+            {
+                dr[k] = ar[k] * br[k] - ai[k] * bi[k];
+                di[k] = ar[k] * bi[k] + ai[k] * br[k];
+            }
+            break;
+        case OpCode::div:
+            // Smith's algorithm, written with selects instead of
+            // branches so it vectorizes. Division by zero gives NaN,
+            // which callers already check for.
+            for (size_t k = 0; k < B; k++)
+            {
+                const bool wide = std::abs(br[k]) >= std::abs(bi[k]);
+                const R c       = wide ? br[k] : bi[k];
+                const R d       = wide ? bi[k] : br[k];
+                const R q       = d / c;
+                const R s       = c + d * q;
+                const R x       = wide ? ar[k] : ai[k];
+                const R y       = wide ? ai[k] : ar[k];
+                const R u       = (x + y * q) / s;
+                const R v       = (y - x * q) / s;
+                dr[k]           = u;
+                di[k]           = wide ? v : -v;
+            }
+            break;
+        case OpCode::neg:
+            for (size_t k = 0; k < B; k++)
+            {
+                dr[k] = -ar[k];
+                di[k] = -ai[k];
+            }
+            break;
+        case OpCode::exp:
+        case OpCode::log:
+        case OpCode::sqrt:
+        case OpCode::sin:
+        case OpCode::cos:
+        case OpCode::tan:
+        case OpCode::sinh:
+        case OpCode::cosh:
+        case OpCode::tanh:
+        case OpCode::pow:
+        case OpCode::powr:
+            VectorBatch<B>(I.op, ar, ai, br, bi, dr, di, count);
+            break;
+        case OpCode::besselj:
+        case OpCode::besseli:
+        case OpCode::polylog:
+            for (size_t k = 0; k < count; k++)
+            {
+                T z   = EvalBinary(I.op, T(ar[k], ai[k]), T(br[k], bi[k]));
+                dr[k] = (R)z.real();
+                di[k] = (R)z.imag();
+            }
+            break;
+        case OpCode::call:
+        {
+            const Callable& C = calls[I.b];
+            T args[MAX_CALL_ARITY];
+            for (size_t k = 0; k < count; k++)
+            {
+                for (unsigned int j = 0; j < C.arity; j++)
+                {
+                    unsigned int reg = callArgs[I.a + j];
+                    args[j]          = T(re(reg)[k], im(reg)[k]);
+                }
+                T z   = C.f(args);
+                dr[k] = (R)z.real();
+                di[k] = (R)z.imag();
+            }
+            break;
+        }
+        case OpCode::sum:
+        case OpCode::prod: RunLoopBatch(data, count, I); break;
+        case OpCode::gamma: GammaBatch(ar, ai, dr, di, count); break;
+        case OpCode::loggamma: LogGammaBatch(ar, ai, dr, di, count); break;
+        case OpCode::digamma: DigammaBatch(ar, ai, dr, di, count); break;
+        case OpCode::zeta:
+            if constexpr (std::is_same_v<T, std::complex<double>>)
+            {
+                // zeta_batch() shares the work between the points.
+                T s[B], z[B];
+                for (size_t k = 0; k < count; k++)
+                    s[k] = T(ar[k], ai[k]);
+                zeta_batch(s, z, count);
+                for (size_t k = 0; k < count; k++)
+                {
+                    dr[k] = (R)z[k].real();
+                    di[k] = (R)z[k].imag();
+                }
+                break;
+            }
+            [[fallthrough]];
+        default:
+            for (size_t k = 0; k < count; k++)
+            {
+                T z   = EvalUnary(I.op, T(ar[k], ai[k]));
+                dr[k] = (R)z.real();
+                di[k] = (R)z.imag();
+            }
+        }
+        if (scale) ScaleBatch(data, scale, rel, I);
+    }
+}
+
+// To first order. A product's relative errors add, a sum's are the larger
+// of its terms', and each operation adds its own rounding: complex
+// multiplication is taken to lose 3 units in the last place and Smith's
+// division 8. A quotient's scale grows with its divisor's uncertainty,
+// which must stay under a quarter of the divisor.
+template <typename T>
+template <typename R>
+inline void Program<T>::ScaleBatch(const R* data, R* scale, R* rel,
+                                   const Instruction& I) const
+{
+    constexpr size_t B = BATCH_SIZE;
+    constexpr R u      = std::numeric_limits<R>::epsilon() / 2;
+    const R* __restrict sa = scale + B * I.a;
+    const R* __restrict sb = scale + B * I.b;
+    R* __restrict sd       = scale + B * I.dst;
+    const R ra             = rel[I.a];
+    const R rb             = rel[I.b];
+
+    switch (I.op)
+    {
+    case OpCode::add:
+    case OpCode::sub:
+        for (size_t k = 0; k < B; k++)
+            sd[k] = sa[k] + sb[k];
+        rel[I.dst] = std::max(ra, rb) + u;
+        break;
+    case OpCode::mul:
+        for (size_t k = 0; k < B; k++)
+            sd[k] = sa[k] * sb[k];
+        rel[I.dst] = ra + rb + ra * rb + 3 * u;
+        break;
+    case OpCode::div:
+    {
+        const R* br = data + 2 * B * I.b;
+        const R* bi = br + B;
+        const R* dr = data + 2 * B * I.dst;
+        const R* di = dr + B;
+        for (size_t k = 0; k < B; k++)
+        {
+            const R mb = std::abs(br[k]) + std::abs(bi[k]);
+            const R md = std::abs(dr[k]) + std::abs(di[k]);
+            sd[k]      = 4 * rb * sb[k] <= mb
+                             ? 4 * (sa[k] + md * sb[k]) / mb + md
+                             : std::numeric_limits<R>::infinity();
+        }
+        rel[I.dst] = std::max({ra, rb, 8 * u});
+        break;
+    }
+    case OpCode::neg:
+        std::copy(sa, sa + B, sd);
+        rel[I.dst] = ra;
+        break;
+    default:
+        std::fill(sd, sd + B, std::numeric_limits<R>::infinity());
+        rel[I.dst] = u;
+    }
+}
+
+// Every point runs the body together, so it stays vectorized, until the
+// last one has finished its terms. The same test as RunLoop() decides when
+// each point stops.
+template <typename T>
+template <typename R>
+inline void Program<T>::RunLoopBatch(R* data, size_t count,
+                                     const Instruction& I) const
+{
+    constexpr size_t B = BATCH_SIZE;
+    auto re = [data](unsigned int reg) { return data + 2 * B * reg; };
+    auto im = [data](unsigned int reg) { return data + 2 * B * reg + B; };
+
+    const Loop& L      = loops[I.a];
+    const bool product = I.op == OpCode::prod;
+    const R eps        = std::numeric_limits<R>::epsilon();
+    R* kr              = re(L.index);
+    R* ki              = im(L.index);
+    R* sr              = re(I.dst);
+    R* si              = im(I.dst);
+    const R* tr        = re(L.term);
+    const R* ti        = im(L.term);
+
+    double from[B], to[B];
+    unsigned int quiet[B];
+    bool active[B], canStop[B];
+    for (size_t k = 0; k < B; k++)
+    {
+        from[k]    = re(L.from)[k];
+        to[k]      = re(L.to)[k];
+        sr[k]      = product ? 1 : 0;
+        si[k]      = 0;
+        ki[k]      = 0;
+        quiet[k]   = 0;
+        canStop[k] = to[k] - from[k] >= EXACT_LOOP_TERMS;
+    }
+
+    for (size_t j = 0; j < MAX_LOOP_ITERATIONS; j++)
+    {
+        bool any = false;
+        for (size_t k = 0; k < count; k++)
+        {
+            active[k] = (!canStop[k] || quiet[k] < CONVERGED_TERMS) &&
+                        from[k] + j <= to[k];
+            kr[k]     = (R)(from[k] + j);
+            any       = any || active[k];
+        }
+        if (!any) break;
+
+        ExecBatch(data, count, loopCode.data() + L.begin,
+                  loopCode.data() + L.end);
+        for (size_t k = 0; k < count; k++)
+        {
+            if (!active[k]) continue;
+            bool negligible;
+            if (product)
+            {
+                const R x  = sr[k] * tr[k] - si[k] * ti[k];
+                si[k]      = sr[k] * ti[k] + si[k] * tr[k];
+                sr[k]      = x;
+                negligible = std::max(std::abs(tr[k] - 1), std::abs(ti[k])) <=
+                                 eps &&
+                             !(sr[k] == 1 && si[k] == 0);
+            }
+            else
+            {
+                sr[k] += tr[k];
+                si[k] += ti[k];
+                negligible = std::max(std::abs(tr[k]), std::abs(ti[k])) <=
+                                 eps * std::max(std::abs(sr[k]),
+                                                std::abs(si[k])) &&
+                             !(sr[k] == 0 && si[k] == 0);
+            }
+            quiet[k] = negligible ? quiet[k] + 1 : 0;
+        }
+    }
+}
+
+template <typename T>
+inline bool Program<T>::SplitByParameters(int ivSlot, Program<T>& ivPart,
+                                          Program<T>& paramPart) const
+{
+    if (!loops.empty()) return false;
+    constexpr unsigned int NONE  = ~0u;
+    const unsigned int firstVar  = GetFirstVarSlot();
+    const unsigned int leafCount = firstVar + (unsigned int)varNames.size();
+
+    // Registers are reused, so follow which instruction's value each one
+    // holds. src gives, for every register read, the instruction which
+    // wrote it, or NONE for constants and variables.
+    std::vector<unsigned int> writer(registerCount, NONE);
+    std::vector<unsigned int> srcA(code.size(), NONE), srcB(code.size(), NONE);
+    std::vector<unsigned int> argSrc(callArgs.size(), NONE);
+    std::vector<bool> param(code.size(), false);
+    auto readParam = [&](unsigned int reg, unsigned int& src) {
+        if (reg < leafCount) return reg >= firstVar && (int)reg != ivSlot;
+        src = writer[reg];
+        return (bool)param[src];
+    };
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        const Instruction& I = code[i];
+        if (I.op == OpCode::call)
+        {
+            for (unsigned int k = 0; k < calls[I.b].arity; k++)
+            {
+                if (readParam(callArgs[I.a + k], argSrc[I.a + k]))
+                    param[i] = true;
+            }
+        }
+        else
+        {
+            param[i] = readParam(I.a, srcA[i]);
+            if (IsBinaryOp(I.op) && readParam(I.b, srcB[i])) param[i] = true;
+        }
+        writer[I.dst] = (unsigned int)i;
+    }
+    const unsigned int resultSrc = result < leafCount ? NONE : writer[result];
+
+    // Parameter-free values read by the parameter part, or the result, are
+    // passed from one part to the other.
+    std::vector<unsigned int> passed(code.size(), NONE);
+    unsigned int passedCount = 0;
+    auto pass                = [&](unsigned int src) {
+        if (src != NONE && !param[src] && passed[src] == NONE)
+            passed[src] = passedCount++;
+    };
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (!param[i]) continue;
+        const Instruction& I = code[i];
+        if (I.op == OpCode::call)
+        {
+            for (unsigned int k = 0; k < calls[I.b].arity; k++)
+                pass(argSrc[I.a + k]);
+        }
+        else
+        {
+            pass(srcA[i]);
+            pass(srcB[i]);
+        }
+    }
+    pass(resultSrc);
+    if (passedCount == 0) return false;
+
+    // Rewrites the registers an instruction reads and writes, given where
+    // passed values and everything else go in the new program.
+    auto rewrite = [&](Program<T>& P, size_t i, auto passedReg, auto reg) {
+        Instruction I = code[i];
+        auto operand  = [&](unsigned int r, unsigned int src) {
+            return src != NONE && passed[src] != NONE ? passedReg(passed[src])
+                                                      : reg(r);
+        };
+        if (I.op == OpCode::call)
+        {
+            for (unsigned int k = 0; k < calls[I.b].arity; k++)
+                P.callArgs[I.a + k] =
+                    operand(callArgs[I.a + k], argSrc[I.a + k]);
+        }
+        else
+        {
+            I.a = operand(I.a, srcA[i]);
+            if (IsBinaryOp(I.op)) I.b = operand(I.b, srcB[i]);
+        }
+        return I;
+    };
+
+    // The parameter-free part keeps every register where it was, but gives
+    // each passed value a register of its own so nothing overwrites it.
+    ivPart               = Program<T>();
+    ivPart.constants     = constants;
+    ivPart.varNames      = varNames;
+    ivPart.calls         = calls;
+    ivPart.callArgs      = callArgs;
+    ivPart.registerCount = registerCount + passedCount;
+    ivPart.result        = registerCount;
+    auto ivPassed = [&](unsigned int k) { return registerCount + k; };
+    auto same     = [](unsigned int r) { return r; };
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (param[i]) continue;
+        Instruction I = rewrite(ivPart, i, ivPassed, same);
+        if (passed[i] != NONE) I.dst = ivPassed(passed[i]);
+        ivPart.code.push_back(I);
+    }
+
+    // The parameter part reads passed values as extra variables, which
+    // moves every temporary register up.
+    paramPart           = Program<T>();
+    paramPart.constants = constants;
+    paramPart.varNames  = varNames;
+    for (unsigned int k = 0; k < passedCount; k++)
+        paramPart.varNames.push_back("#" + std::to_string(k));
+    paramPart.calls         = calls;
+    paramPart.callArgs      = callArgs;
+    paramPart.registerCount = registerCount + passedCount;
+    auto paramPassed = [&](unsigned int k) { return leafCount + k; };
+    auto shifted     = [&](unsigned int r) {
+        return r < leafCount ? r : r + passedCount;
+    };
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (!param[i]) continue;
+        Instruction I = rewrite(paramPart, i, paramPassed, shifted);
+        I.dst         = shifted(I.dst);
+        paramPart.code.push_back(I);
+    }
+    paramPart.result = resultSrc != NONE && passed[resultSrc] != NONE
+                           ? paramPassed(passed[resultSrc])
+                           : shifted(result);
+    return true;
+}
+
+// Arithmetic for EvalContext<T>::EvalBatch(), from fastest to most precise.
+enum class Precision
+{
+    normal,   // double, or float where that is close enough.
+    extended, // cplx32, see Multiprecision.h.
+    high,     // cplx64.
+};
+
+// The mutable half of an evaluation: a register file for one shared
+// Program<T>, holding the current parameter values, plus batch scratch
+// space. Contexts are cheap to create and copy. Different threads can run
+// the same program at once as long as each has its own context.
+template <typename T> class EvalContext
+{
+public:
+    EvalContext() {}
+    EvalContext(std::shared_ptr<const Program<T>> prog,
+                const std::string& IV = "z")
+        : program(std::move(prog))
+    {
+        program->InitRegisters(registers);
+        SetIV(IV);
+    }
+
+    void SetIV(const std::string& name) { ivSlot = program->GetVarSlot(name); }
+    int GetIVSlot() const { return ivSlot; }
+
+    // Variables the program doesn't use are ignored.
+    void SetVariable(const std::string& name, const T& val)
+    {
+        int slot = program->GetVarSlot(name);
+        if (slot >= 0) registers[slot] = val;
+    }
+    // Sets the i-th variable, in the order of Program<T>::GetVarNames().
+    void SetVariableAt(size_t i, const T& val)
+    {
+        registers[program->GetFirstVarSlot() + i] = val;
+    }
+    // h must come from this context's program.
+    void SetVariable(VarHandle h, const T& val)
+    {
+        if (h.IsValid()) SetVariableAt(h.index, val);
+    }
+
+    // Once the kernel's fn is set, cplx evaluations call it instead of the
+    // interpreter. It must have been compiled from the same program.
+    void SetNativeKernel(std::shared_ptr<const NativeKernel> kernel)
+    {
+        native = std::move(kernel);
+    }
+
+    T eval() { return program->Run(registers.data()); }
+
+    // Returns f(z) in val and f'(z), with respect to the independent
+    // variable, in d.
+    Dual<T> EvalDerivative(const T& z)
+    {
+        dualRegisters.assign(registers.begin(), registers.end());
+        if (ivSlot >= 0) dualRegisters[ivSlot] = Dual<T>(z, T(1));
+        return program->Run(dualRegisters.data());
+    }
+    // f(z) in one of the higher precision types in Multiprecision.h.
+    template <typename U> U EvalPrecise(const U& z) const
+    {
+        std::vector<U> regs(registers.begin(), registers.end());
+        if (ivSlot >= 0) regs[ivSlot] = z;
+        return program->Run(regs.data());
+    }
+    T operator()(const T& val)
+    {
+        if (ivSlot >= 0) registers[ivSlot] = val;
+        if (auto fn = GetNativeFn())
+        {
+            T result;
+            auto v = reinterpret_cast<const double*>(&val);
+            auto r = reinterpret_cast<double*>(&result);
+            fn(reinterpret_cast<const double*>(registers.data()), v, v + 1, 2,
+               r, r + 1, 2, 1);
+            return result;
+        }
+        return program->Run(registers.data());
+    }
+    void EvalBatch(const T* in, T* out, size_t n)
+    {
+        EvalBatch(in, out, n, ChoosePrecision(in, n));
+    }
+    // Same, in precision p. Points mapped in parts, e.g. on several threads,
+    // should share the precision ChoosePrecision() gives for all of them.
+    void EvalBatch(const T* in, T* out, size_t n, Precision p)
+    {
+        if constexpr (std::is_same_v<T, std::complex<double>>)
+        {
+            if (p == Precision::extended)
+                return EvalBatchPrecise<cplx32>(in, out, n);
+            if (p == Precision::high)
+                return EvalBatchPrecise<cplx64>(in, out, n);
+        }
+        if (auto fn = GetNativeFn())
+        {
+            auto i = reinterpret_cast<const double*>(in);
+            auto o = reinterpret_cast<double*>(out);
+            fn(reinterpret_cast<const double*>(registers.data()), i, i + 1, 2,
+               o, o + 1, 2, n);
+            return;
+        }
+        if (single && tolerance > 0 && EvalBatchSingle(in, out, n)) return;
+        program->RunBatch(registers.data(), ivSlot, in, out, n, scratch);
+    }
+    void EvalBatch(const double* inRe, const double* inIm, double* outRe,
+                   double* outIm, size_t n)
+    {
+        if (auto fn = GetNativeFn())
+        {
+            fn(reinterpret_cast<const double*>(registers.data()), inRe, inIm,
+               1, outRe, outIm, 1, n);
+            return;
+        }
+        program->RunBatch(registers.data(), ivSlot, inRe, inIm, 1, outRe,
+                          outIm, 1, n, scratch);
+    }
+
+    // Absolute error EvalBatch(in, out, n) may make, e.g. a fraction of a
+    // pixel when drawing. Above zero, it works in more than double precision
+    // when needed, and in single precision whenever that is close enough if
+    // SetSinglePrecision() allows; 0, the default, means always double.
+    // Only values in or near view,
+    // e.g. the output plane's viewport, need to be that accurate; those far
+    // off screen can't be seen to be wrong.
+    void SetTolerance(double tol,
+                      const ComplexInterval& view = ComplexInterval::Entire())
+    {
+        tolerance = tol;
+        viewport  = view;
+    }
+    double GetTolerance() const { return tolerance; }
+
+    // Lets EvalBatch() use single precision within the tolerance. Off by
+    // default: bounding the error costs about as much as float saves, so
+    // it is no faster than double for short programs, and slower for
+    // high powers, whose bounds are often too loose to use.
+    void SetSinglePrecision(bool allow) { single = allow; }
+
+    // Precision needed to evaluate at the n points in to within tolerance.
+    // At a sample of the points, interval arithmetic bounds the rounding
+    // error of double; only where that could exceed the tolerance near the
+    // view, as in a deep zoom or after cancellation, are the values compared
+    // with higher precision ones. Meant to be called once for all the points
+    // of a mapping, which are then evaluated with that precision.
+    Precision ChoosePrecision(const T* in, size_t n) const
+    {
+        if constexpr (std::is_same_v<T, std::complex<double>>)
+        {
+            constexpr size_t SAMPLES = 16;
+            if (n == 0 || !(tolerance > 0)) return Precision::normal;
+
+            std::vector<T> regs = registers;
+            std::vector<ComplexInterval> bounds(regs.begin(), regs.end());
+            // The samples whose error could show.
+            std::vector<T> pts, values;
+            for (size_t j = 0; j < SAMPLES; j++)
+            {
+                const T z = in[j * (n - 1) / (SAMPLES - 1)];
+                if (ivSlot >= 0)
+                {
+                    regs[ivSlot]   = z;
+                    bounds[ivSlot] = z;
+                }
+                const ComplexInterval b = program->Run(bounds.data());
+                if ((b.re.hi - b.re.lo <= tolerance &&
+                     b.im.hi - b.im.lo <= tolerance) ||
+                    !NearView(b))
+                    continue;
+                pts.push_back(z);
+                values.push_back(program->Run(regs.data()));
+            }
+            if (pts.empty()) return Precision::normal;
+            if (SamplesAgree<cplx32>(pts, values)) return Precision::normal;
+            if (SamplesAgree<cplx64>(pts, values)) return Precision::extended;
+            return Precision::high;
+        }
+        return Precision::normal;
+    }
+
+    const Program<T>& GetProgram() const { return *program; }
+    // Constants, then variables, as laid out by the program.
+    const std::vector<T>& GetRegisters() const { return registers; }
+    bool UsesNativeKernel() const { return GetNativeFn() != nullptr; }
+    const std::shared_ptr<const Program<T>>& GetSharedProgram() const
+    {
+        return program;
+    }
+
+private:
+    // Kernels only exist for std::complex<double>, and are compiled for a
+    // particular independent variable.
+    NativeKernelFn GetNativeFn() const
+    {
+        if constexpr (std::is_same_v<T, std::complex<double>>)
+        {
+            if (native && native->ivSlot == ivSlot && ivSlot >= 0)
+                return native->fn.load(std::memory_order_acquire);
+        }
+        return nullptr;
+    }
+
+    // Whether a value in b could be on screen, or near enough to it that
+    // the lines to it are. The view is widened by its size on every side.
+    bool NearView(const ComplexInterval& b) const
+    {
+        const double w = viewport.re.hi - viewport.re.lo;
+        const double h = viewport.im.hi - viewport.im.lo;
+        return b.Intersects(
+            ComplexInterval(Interval(viewport.re.lo - w, viewport.re.hi + w),
+                            Interval(viewport.im.lo - h, viewport.im.hi + h)));
+    }
+
+    // Whether f, evaluated at pts in precision U, is within tolerance of
+    // values. values is replaced by the new ones.
+    template <typename U>
+    bool SamplesAgree(const std::vector<T>& pts, std::vector<T>& values) const
+    {
+        bool agree = true;
+        for (size_t j = 0; j < pts.size(); j++)
+        {
+            const T w = ToDouble(EvalPrecise(U(pts[j])));
+            if (std::isfinite(std::abs(w)) &&
+                !(std::abs(w - values[j]) <= tolerance))
+                agree = false;
+            values[j] = w;
+        }
+        return agree;
+    }
+
+    template <typename U> void EvalBatchPrecise(const T* in, T* out, size_t n)
+    {
+        std::vector<U> regs(registers.begin(), registers.end());
+        for (size_t k = 0; k < n; k++)
+        {
+            if (ivSlot >= 0) regs[ivSlot] = U(in[k]);
+            out[k] = ToDouble(program->Run(regs.data()));
+        }
+    }
+
+    // Runs EvalBatch in single precision, for std::complex<double>, along
+    // with a bound on each point's rounding error. Points whose bound
+    // exceeds the tolerance, which catches both badly conditioned
+    // expressions and values too large for float to resolve, are redone
+    // together in double. Single precision is skipped for programs with
+    // anything but + - * /, which gain little and can't be bounded, when
+    // values in view are too large, as when zoomed far in, or when too many
+    // points turn out to need redoing. Otherwise returns false, and out must
+    // be recalculated.
+    bool EvalBatchSingle(const T* in, T* out, size_t n)
+    {
+        if constexpr (std::is_same_v<T, std::complex<double>>)
+        {
+            const std::vector<Instruction>& code = program->GetCode();
+            if (!std::all_of(code.begin(), code.end(), [](Instruction I) {
+                    return I.op == OpCode::add || I.op == OpCode::sub ||
+                           I.op == OpCode::mul || I.op == OpCode::div ||
+                           I.op == OpCode::neg;
+                }))
+                return false;
+            const double reach =
+                std::max({std::abs(viewport.re.lo), std::abs(viewport.re.hi),
+                          std::abs(viewport.im.lo), std::abs(viewport.im.hi)});
+            if (viewport.IsBounded() &&
+                !(reach < tolerance / (64 * FLT_EPSILON)))
+                return false;
+
+            // in is needed again below, so if out is the same array the
+            // results go elsewhere first.
+            T* result = out;
+            if (out == in)
+            {
+                approx.resize(n);
+                result = approx.data();
+            }
+            bounds.resize(n);
+            program->RunBatch(registers.data(), ivSlot, in, result, n,
+                              singleScratch, bounds.data());
+            redo.clear();
+            for (size_t k = 0; k < n; k++)
+                if (!(bounds[k] <= tolerance)) redo.push_back(in[k]);
+            if (8 * redo.size() > n) return false;
+            program->RunBatch(registers.data(), ivSlot, redo.data(),
+                              redo.data(), redo.size(), scratch);
+            for (size_t k = 0, j = 0; k < n; k++)
+                if (!(bounds[k] <= tolerance)) result[k] = redo[j++];
+            if (result != out) std::copy(result, result + n, out);
+            return true;
+        }
+        return false;
+    }
+
+    std::shared_ptr<const Program<T>> program;
+    std::shared_ptr<const NativeKernel> native;
+    std::vector<T> registers;
+    std::vector<Dual<T>> dualRegisters;
+    std::vector<double> scratch;
+    std::vector<float> singleScratch;
+    std::vector<float> bounds;
+    std::vector<T> approx;
+    std::vector<T> redo;
+    double tolerance = 0;
+    ComplexInterval viewport = ComplexInterval::Entire();
+    bool single              = false;
+    int ivSlot               = -1;
+};
+
+// Compiles a postfix symbol stack, as produced by Parser<T>, into a
+// Program<T>. Symbols are consumed from the back of the stack, in the same
+// order the old recursive evaluator used, so the meaning of every expression
+// is unchanged. Anything that could not be evaluated throws
+// std::invalid_argument here rather than at evaluation time.
+//
+// While building, operations whose operands are all constants are evaluated
+// on the spot (e.g. 2*pi*i, exp(1/2)), and identical operations on identical
+// operands share one value (e.g. both sin(z) in sin(z)^2 + sin(z)). Only
+// built-in operations are folded; user functions are called at run time,
+// though still only once per distinct argument list. Nothing is reordered,
+// so folded results are rounded exactly as they would be at run time.
+//
+// Some operations are also rewritten into cheaper ones: constant integer
+// powers become multiplication chains, z^0.5 becomes sqrt(z), other real
+// powers skip the complex log of the exponent, and reciprocal trig functions
+// become one call and a division. Sums of constant multiples of powers of
+// the same value are recognized as polynomials and emitted in Horner form.
+// These change rounding slightly, but not by more than pow() itself would.
+//
+// sum and prod compile to a loop whose body is only the part of the term
+// depending on the index; everything else is evaluated once, before it.
+template <typename T> class ProgramBuilder
+{
+public:
+    ProgramBuilder(const std::vector<Symbol<T>*>& postfix) : stack(postfix) {}
+
+    Program<T> Build();
+
+private:
+    enum class Kind
+    {
+        constant,
+        variable,
+        index, // Of a loop, whose number is in a.
+        operation
+    };
+
+    // SSA value. Leaves index into constants/varNames, operations refer to
+    // other values by index. Loops have their bounds in a and b, and their
+    // term and index in args.
+    struct Value
+    {
+        Kind kind;
+        OpCode op;
+        unsigned int a;
+        unsigned int b;
+        std::vector<unsigned int> args; // Only for OpCode::call and loops
+    };
+
+    // Calls f with each value V reads.
+    template <typename F> void ForEachOperand(const Value& V, F f) const
+    {
+        if (V.op == OpCode::call)
+        {
+            for (auto arg : V.args)
+                f(arg);
+            return;
+        }
+        f(V.a);
+        if (IsBinaryOp(V.op) || IsLoopOp(V.op)) f(V.b);
+        if (IsLoopOp(V.op)) f(V.args[0]);
+    }
+
+    unsigned int Visit();
+    unsigned int VisitLoop(OpCode op);
+    size_t SubtreeStart(size_t end) const;
+    unsigned int AddConstant(const T& val);
+    unsigned int AddVariable(const std::string& name);
+    unsigned int AddOperation(OpCode op, unsigned int a, unsigned int b = 0);
+    unsigned int AddCall(Symbol<T>* sym, std::vector<unsigned int>&& args);
+    bool IsConstant(unsigned int v) const
+    {
+        return values[v].kind == Kind::constant;
+    }
+    bool GetRealConstant(unsigned int v, double& x) const;
+    unsigned int One() { return AddConstant(T(1)); }
+
+    // Adds exactly the given operation, folding it if it is constant and
+    // reusing an identical one if it exists.
+    unsigned int Emit(OpCode op, unsigned int a, unsigned int b = 0);
+    unsigned int EmitPow(unsigned int a, unsigned int b);
+    unsigned int EmitPowInt(unsigned int a, unsigned int k);
+
+    // Integer powers and polynomial degrees up to this are expanded.
+    static constexpr int MAX_INTEGER_POWER = 64;
+    static constexpr unsigned int NO_BASE = ~0u;
+
+    // Polynomial in the value x with constant coefficients, by degree.
+    // Constants have x == NO_BASE.
+    struct Polynomial
+    {
+        unsigned int x;
+        std::map<int, T> terms;
+    };
+    Polynomial GetPolynomial(unsigned int v) const;
+    bool MakePolynomial(OpCode op, unsigned int a, unsigned int b,
+                        Polynomial& P) const;
+    unsigned int EmitHorner(const Polynomial& P);
+    std::map<unsigned int, Polynomial> polynomials;
+
+    const std::vector<Symbol<T>*>& stack;
+    size_t pos = 0;
+
+    std::vector<Value> values;
+    std::vector<T> constants;
+    std::vector<unsigned int> constantValues; // Value index of each constant
+    std::vector<std::string> varNames;
+    std::vector<typename Program<T>::Callable> calls;
+    std::map<std::string, unsigned int> variableIndex;
+    std::map<std::tuple<OpCode, unsigned int, unsigned int>, unsigned int>
+        operationIndex;
+    std::map<std::pair<Symbol<T>*, std::vector<unsigned int>>, unsigned int>
+        callIndex;
+
+    // Loops in the order they are visited. depth is the number of loops
+    // whose body this one is written in.
+    struct LoopInfo
+    {
+        unsigned int depth;
+        unsigned int value;
+    };
+    std::vector<LoopInfo> loops;
+    // Index names in scope while visiting a term, innermost last.
+    std::vector<std::pair<std::string, unsigned int>> indexScope;
+};
+
+template <typename T> inline unsigned int ProgramBuilder<T>::Visit()
+{
+    if (pos == 0) throw std::invalid_argument("Error: Mismatched operations.");
+    Symbol<T>* sym = stack[--pos];
+
+    if (sym->GetPrecedence() == sym_num)
+    {
+        if (sym->IsVar())
+        {
+            for (auto it = indexScope.rbegin(); it != indexScope.rend(); ++it)
+            {
+                if (it->first == sym->GetToken()) return it->second;
+            }
+            return AddVariable(sym->GetToken());
+        }
+        return AddConstant(sym->GetVal());
+    }
+
+    OpCode op = sym->GetOpCode();
+    int arity = sym->GetArity();
+    if (op == OpCode::none)
+        throw std::invalid_argument("Error: Mismatched operations.");
+    if (IsLoopOp(op)) return VisitLoop(op);
+
+    if (op == OpCode::call)
+    {
+        if (arity > (int)Program<T>::MAX_CALL_ARITY)
+            throw std::invalid_argument("Error: Too many function arguments.");
+        std::vector<unsigned int> args;
+        for (int k = 0; k < arity; k++)
+            args.push_back(Visit());
+        return AddCall(sym, std::move(args));
+    }
+
+    // The first operand popped is the right-hand side of a dyad.
+    if (arity == 2)
+    {
+        unsigned int rhs = Visit();
+        unsigned int lhs = Visit();
+        return AddOperation(op, lhs, rhs);
+    }
+    if (arity == 1) return AddOperation(op, Visit());
+    throw std::invalid_argument("Error: Mismatched operations.");
+}
+
+// The arguments of a loop are popped term first, but the index name comes
+// first, so it is found by skipping over the other arguments.
+template <typename T>
+inline unsigned int ProgramBuilder<T>::VisitLoop(OpCode op)
+{
+    size_t start = pos;
+    for (int k = 0; k < 3; k++)
+        start = SubtreeStart(start);
+    if (start == 0)
+        throw std::invalid_argument("Error: Mismatched operations.");
+    const Symbol<T>* name = stack[start - 1];
+    if (!name->IsVar())
+    {
+        throw std::invalid_argument(
+            "Error: The index of a sum or product must be a variable name.");
+    }
+
+    const unsigned int loop = (unsigned int)loops.size();
+    loops.push_back({(unsigned int)indexScope.size(), 0});
+    values.push_back({Kind::index, OpCode::none, loop, 0, {}});
+    const unsigned int index = (unsigned int)values.size() - 1;
+
+    indexScope.emplace_back(name->GetToken(), index);
+    const unsigned int term = Visit();
+    indexScope.pop_back();
+    const unsigned int to   = Visit();
+    const unsigned int from = Visit();
+    pos--; // The index name
+
+    values.push_back({Kind::operation, op, from, to, {term, index}});
+    loops[loop].value = (unsigned int)values.size() - 1;
+    return loops[loop].value;
+}
+
+// Position in the stack of the first symbol of the subexpression ending just
+// before end.
+template <typename T>
+inline size_t ProgramBuilder<T>::SubtreeStart(size_t end) const
+{
+    for (int needed = 1; needed > 0;)
+    {
+        if (end == 0)
+            throw std::invalid_argument("Error: Mismatched operations.");
+        const Symbol<T>* sym = stack[--end];
+        if (sym->GetPrecedence() != sym_num) needed += sym->GetArity();
+        needed--;
+    }
+    return end;
+}
+
+template <typename T>
+inline unsigned int ProgramBuilder<T>::AddConstant(const T& val)
+{
+    // Constants are only shared when identical: == would merge +0 and -0,
+    // which are on different sides of a branch cut, e.g. in log(-1 - 0i).
+    // Every NaN is the same constant.
+    auto same = [](double x, double y) {
+        return x == y ? std::signbit(x) == std::signbit(y)
+                      : std::isnan(x) && std::isnan(y);
+    };
+    for (size_t c = 0; c < constants.size(); c++)
+    {
+        bool identical;
+        if constexpr (is_complex_type<T>::value)
+            identical = same(constants[c].real(), val.real()) &&
+                        same(constants[c].imag(), val.imag());
+        else
+            identical = same(constants[c], val);
+        if (identical) return constantValues[c];
+    }
+    values.push_back(
+        {Kind::constant, OpCode::none, (unsigned int)constants.size(), 0, {}});
+    constants.push_back(val);
+    constantValues.push_back((unsigned int)values.size() - 1);
+    return constantValues.back();
+}
+
+template <typename T>
+inline unsigned int ProgramBuilder<T>::AddVariable(const std::string& name)
+{
+    auto found = variableIndex.find(name);
+    if (found != variableIndex.end()) return found->second;
+    values.push_back(
+        {Kind::variable, OpCode::none, (unsigned int)varNames.size(), 0, {}});
+    varNames.push_back(name);
+    variableIndex[name] = (unsigned int)values.size() - 1;
+    return variableIndex[name];
+}
+
+template <typename T>
+inline unsigned int ProgramBuilder<T>::AddOperation(OpCode op, unsigned int a,
+                                                    unsigned int b)
+{
+    if (!IsBinaryOp(op)) b = 0;
+    if (IsConstant(a) && (!IsBinaryOp(op) || IsConstant(b)))
+        return Emit(op, a, b);
+
+    switch (op)
+    {
+    case OpCode::sec: return Emit(OpCode::div, One(), Emit(OpCode::cos, a));
+    case OpCode::csc: return Emit(OpCode::div, One(), Emit(OpCode::sin, a));
+    case OpCode::cot: return Emit(OpCode::div, One(), Emit(OpCode::tan, a));
+    case OpCode::sech: return Emit(OpCode::div, One(), Emit(OpCode::cosh, a));
+    case OpCode::csch: return Emit(OpCode::div, One(), Emit(OpCode::sinh, a));
+    case OpCode::coth: return Emit(OpCode::div, One(), Emit(OpCode::tanh, a));
+    case OpCode::asec: return Emit(OpCode::acos, Emit(OpCode::div, One(), a));
+    case OpCode::acsc: return Emit(OpCode::asin, Emit(OpCode::div, One(), a));
+    case OpCode::acot: return Emit(OpCode::atan, Emit(OpCode::div, One(), a));
+    case OpCode::asech:
+        return Emit(OpCode::acosh, Emit(OpCode::div, One(), a));
+    case OpCode::acsch:
+        return Emit(OpCode::asinh, Emit(OpCode::div, One(), a));
+    case OpCode::acoth:
+        return Emit(OpCode::atanh, Emit(OpCode::div, One(), a));
+    default: break;
+    }
+
+    Polynomial P;
+    if (MakePolynomial(op, a, b, P))
+    {
+        unsigned int v;
+        if ((op == OpCode::add || op == OpCode::sub) && P.terms.size() > 1 &&
+            P.terms.rbegin()->first > 1)
+            v = EmitHorner(P);
+        else if (op == OpCode::pow)
+            v = EmitPow(a, b);
+        else
+            v = Emit(op, a, b);
+        polynomials[v] = std::move(P);
+        return v;
+    }
+    if (op == OpCode::pow) return EmitPow(a, b);
+    return Emit(op, a, b);
+}
+
+template <typename T>
+inline unsigned int ProgramBuilder<T>::Emit(OpCode op, unsigned int a,
+                                            unsigned int b)
+{
+    const bool binary = IsBinaryOp(op);
+    if (!binary) b = 0;
+
+    if (IsConstant(a) && (!binary || IsConstant(b)))
+    {
+        const T& x = constants[values[a].a];
+        return AddConstant(binary ? EvalBinary(op, x, constants[values[b].a])
+                                  : EvalUnary(op, x));
+    }
+
+    // add and mul commute exactly, so either operand order finds the same
+    // value.
+    auto key = std::make_tuple(op, a, b);
+    if ((op == OpCode::add || op == OpCode::mul) && b < a)
+        key = std::make_tuple(op, b, a);
+    auto found = operationIndex.find(key);
+    if (found != operationIndex.end()) return found->second;
+
+    values.push_back({Kind::operation, op, a, b, {}});
+    operationIndex[key] = (unsigned int)values.size() - 1;
+    return operationIndex[key];
+}
+
+template <typename T>
+inline bool ProgramBuilder<T>::GetRealConstant(unsigned int v, double& x) const
+{
+    if (!IsConstant(v)) return false;
+    const T& c = constants[values[v].a];
+    if constexpr (is_complex_type<T>::value)
+    {
+        if (c.imag() != 0) return false;
+        x = c.real();
+    }
+    else
+        x = c;
+    return true;
+}
+
+template <typename T>
+inline unsigned int ProgramBuilder<T>::EmitPow(unsigned int a, unsigned int b)
+{
+    double x;
+    if (!GetRealConstant(b, x)) return Emit(OpCode::pow, a, b);
+
+    if (x == std::trunc(x) && std::abs(x) <= MAX_INTEGER_POWER)
+    {
+        if (x == 0) return One();
+        unsigned int p = EmitPowInt(a, (unsigned int)std::abs(x));
+        return x > 0 ? p : Emit(OpCode::div, One(), p);
+    }
+    if (x == 0.5) return Emit(OpCode::sqrt, a);
+    if (x == -0.5) return Emit(OpCode::div, One(), Emit(OpCode::sqrt, a));
+    return Emit(OpCode::powr, a, b);
+}
+
+// a^k for k > 0 by repeated squaring. Intermediate powers are shared with
+// any other power of a.
+template <typename T>
+inline unsigned int ProgramBuilder<T>::EmitPowInt(unsigned int a,
+                                                  unsigned int k)
+{
+    unsigned int result = NO_BASE;
+    for (unsigned int base = a; k; k >>= 1)
+    {
+        if (k & 1)
+            result = result == NO_BASE ? base : Emit(OpCode::mul, result, base);
+        if (k > 1) base = Emit(OpCode::mul, base, base);
+    }
+    return result;
+}
+
+template <typename T>
+inline typename ProgramBuilder<T>::Polynomial
+ProgramBuilder<T>::GetPolynomial(unsigned int v) const
+{
+    if (IsConstant(v)) return {NO_BASE, {{0, constants[values[v].a]}}};
+    auto found = polynomials.find(v);
+    if (found != polynomials.end()) return found->second;
+    return {v, {{1, T(1)}}};
+}
+
+// Describes the result of op as a polynomial, if it is one. Products of two
+// polynomials are only accepted when both are single terms, since expanding
+// something like (z-1)*(z+1) would lose accuracy near its roots.
+template <typename T>
+inline bool ProgramBuilder<T>::MakePolynomial(OpCode op, unsigned int a,
+                                              unsigned int b,
+                                              Polynomial& P) const
+{
+    Polynomial A = GetPolynomial(a);
+    Polynomial B;
+    if (IsBinaryOp(op))
+    {
+        B = GetPolynomial(b);
+        if (A.x != B.x && A.x != NO_BASE && B.x != NO_BASE) return false;
+    }
+    P.x = A.x != NO_BASE ? A.x : B.x;
+
+    switch (op)
+    {
+    case OpCode::neg:
+        for (auto& [d, c] : A.terms)
+            P.terms[d] = -c;
+        break;
+    case OpCode::add:
+    case OpCode::sub:
+        P.terms = A.terms;
+        for (auto& [d, c] : B.terms)
+        {
+            auto found = P.terms.find(d);
+            if (found == P.terms.end())
+                P.terms[d] = op == OpCode::add ? c : -c;
+            else if (op == OpCode::add)
+                found->second += c;
+            else
+                found->second -= c;
+        }
+        for (auto it = P.terms.begin(); it != P.terms.end();)
+            it = it->second == T(0) ? P.terms.erase(it) : std::next(it);
+        break;
+    case OpCode::mul:
+        if (A.terms.size() == 1 && B.terms.size() == 1)
+        {
+            auto [dA, cA] = *A.terms.begin();
+            auto [dB, cB] = *B.terms.begin();
+            P.terms[dA + dB] = cA * cB;
+        }
+        else if (A.x == NO_BASE || B.x == NO_BASE)
+        {
+            const Polynomial& C = A.x == NO_BASE ? A : B;
+            const Polynomial& Q = A.x == NO_BASE ? B : A;
+            for (auto& [d, c] : Q.terms)
+                P.terms[d] = C.terms.begin()->second * c;
+        }
+        else
+            return false;
+        break;
+    case OpCode::pow:
+    {
+        double x;
+        if (!GetRealConstant(b, x) || x != std::trunc(x) || x < 1 ||
+            x > MAX_INTEGER_POWER || A.terms.size() != 1 ||
+            A.terms.begin()->second != T(1))
+            return false;
+        P.x = A.x;
+        P.terms[A.terms.begin()->first * (int)x] = T(1);
+        break;
+    }
+    default: return false;
+    }
+
+    return !P.terms.empty() && P.x != NO_BASE &&
+           P.terms.rbegin()->first <= MAX_INTEGER_POWER;
+}
+
+// Evaluates the terms from the highest degree down, multiplying by the power
+// of x that separates each term from the next.
+template <typename T>
+inline unsigned int ProgramBuilder<T>::EmitHorner(const Polynomial& P)
+{
+    auto mulPow = [&](unsigned int acc, int k) {
+        if (k == 0) return acc;
+        unsigned int p = EmitPowInt(P.x, k);
+        return acc == One() ? p : Emit(OpCode::mul, acc, p);
+    };
+
+    auto it          = P.terms.rbegin();
+    unsigned int acc = AddConstant(it->second);
+    int degree       = it->first;
+    for (++it; it != P.terms.rend(); ++it)
+    {
+        acc    = mulPow(acc, degree - it->first);
+        acc    = Emit(OpCode::add, acc, AddConstant(it->second));
+        degree = it->first;
+    }
+    return mulPow(acc, degree);
+}
+
+// Calls are identified by the symbol they came from, which the owning
+// ParsedFunc shares between every use of the same function name.
+template <typename T>
+inline unsigned int ProgramBuilder<T>::AddCall(Symbol<T>* sym,
+                                               std::vector<unsigned int>&& args)
+{
+    auto key   = std::make_pair(sym, args);
+    auto found = callIndex.find(key);
+    if (found != callIndex.end()) return found->second;
+
+    values.push_back({Kind::operation, OpCode::call, 0,
+                      (unsigned int)calls.size(), std::move(args)});
+    calls.push_back({sym->GetCallable(), (unsigned int)sym->GetArity()});
+    callIndex[key] = (unsigned int)values.size() - 1;
+    return callIndex[key];
+}
+
+template <typename T> inline Program<T> ProgramBuilder<T>::Build()
+{
+    pos = stack.size();
+    if (stack.empty()) throw std::invalid_argument("Error: Empty expression.");
+    // Anything left below the root is ignored, as it always has been.
+    unsigned int root = Visit();
+
+    // Values are created after their operands, so their order is already a
+    // valid evaluation order. Folding leaves some values unused; mark the
+    // ones the result depends on.
+    std::vector<bool> live(values.size(), false);
+    live[root] = true;
+    for (unsigned int v = (unsigned int)values.size(); v-- > 0;)
+    {
+        const Value& V = values[v];
+        if (!live[v] || V.kind != Kind::operation) continue;
+        ForEachOperand(V, [&](unsigned int w) { live[w] = true; });
+    }
+
+    // Each value is evaluated in the body of the innermost loop whose index
+    // it depends on, or once, outside every loop, if there isn't one. deps
+    // lists the loops a value depends on.
+    const unsigned int NONE = ~0u;
+    std::vector<unsigned int> block(values.size(), NONE);
+    std::vector<std::vector<unsigned int>> deps(values.size());
+    for (unsigned int v = 0; v < values.size(); v++)
+    {
+        const Value& V = values[v];
+        if (V.kind == Kind::index) deps[v].push_back(V.a);
+        if (!live[v] || V.kind != Kind::operation || loops.empty()) continue;
+        ForEachOperand(V, [&](unsigned int w) {
+            deps[v].insert(deps[v].end(), deps[w].begin(), deps[w].end());
+        });
+        std::sort(deps[v].begin(), deps[v].end());
+        deps[v].erase(std::unique(deps[v].begin(), deps[v].end()),
+                      deps[v].end());
+        if (IsLoopOp(V.op))
+        {
+            deps[v].erase(std::remove(deps[v].begin(), deps[v].end(),
+                                      values[V.args[1]].a),
+                          deps[v].end());
+        }
+        for (unsigned int L : deps[v])
+        {
+            if (block[v] == NONE || loops[L].depth > loops[block[v]].depth)
+                block[v] = L;
+        }
+    }
+    auto loopOf = [&](unsigned int v) { return values[values[v].args[1]].a; };
+
+    // Evaluation order: the values of each block in the order they were
+    // created, with a loop's body just before the loop. Entries marked true
+    // are where a loop starts.
+    std::vector<std::vector<unsigned int>> members(loops.size() + 1);
+    for (unsigned int v = 0; v < values.size(); v++)
+    {
+        if (live[v] && values[v].kind == Kind::operation)
+            members[block[v] == NONE ? 0 : block[v] + 1].push_back(v);
+    }
+    std::vector<std::pair<unsigned int, bool>> order;
+    std::function<void(unsigned int)> schedule = [&](unsigned int b) {
+        for (unsigned int v : members[b])
+        {
+            if (IsLoopOp(values[v].op))
+            {
+                order.emplace_back(v, true);
+                schedule(loopOf(v) + 1);
+            }
+            order.emplace_back(v, false);
+        }
+    };
+    schedule(0);
+
+    // Find the last use of each value so registers of temporaries can be
+    // recycled. A value used in the body of a loop it isn't part of is
+    // needed until the loop finishes, so that counts as a use by the loop.
+    auto user = [&](unsigned int u, unsigned int w) {
+        if (IsLoopOp(values[u].op) && block[w] == loopOf(u)) return u;
+        while (block[u] != block[w] && block[u] != NONE)
+            u = loops[block[u]].value;
+        return u;
+    };
+    std::vector<unsigned int> lastUse(values.size(), NONE);
+    for (const auto& entry : order)
+    {
+        const unsigned int u = entry.first;
+        if (!entry.second)
+            ForEachOperand(values[u],
+                           [&](unsigned int w) { lastUse[w] = user(u, w); });
+    }
+    lastUse[root] = (unsigned int)values.size();
+    std::vector<std::vector<unsigned int>> releases(values.size());
+    for (const auto& entry : order)
+    {
+        const unsigned int u = entry.first;
+        if (entry.second) continue;
+        ForEachOperand(values[u], [&](unsigned int w) {
+            const unsigned int e = user(u, w);
+            if (values[w].kind == Kind::operation && lastUse[w] == e &&
+                std::find(releases[e].begin(), releases[e].end(), w) ==
+                    releases[e].end())
+                releases[e].push_back(w);
+        });
+    }
+
+    Program<T> P;
+    P.varNames = varNames;
+    P.calls    = calls;
+
+    // Only constants still in use go in the pool.
+    std::vector<unsigned int> constantSlot(constants.size(), NONE);
+    for (unsigned int v = 0; v < values.size(); v++)
+    {
+        const Value& V = values[v];
+        if (live[v] && V.kind == Kind::constant && constantSlot[V.a] == NONE)
+        {
+            constantSlot[V.a] = (unsigned int)P.constants.size();
+            P.constants.push_back(constants[V.a]);
+        }
+    }
+
+    const unsigned int leafCount =
+        (unsigned int)(P.constants.size() + varNames.size());
+    std::vector<unsigned int> reg(values.size(), NONE);
+    std::vector<unsigned int> freeRegs;
+    unsigned int nextReg = leafCount;
+    auto allocate        = [&]() {
+        if (freeRegs.empty()) return nextReg++;
+        unsigned int r = freeRegs.back();
+        freeRegs.pop_back();
+        return r;
+    };
+
+    for (unsigned int v = 0; v < values.size(); v++)
+    {
+        const Value& V = values[v];
+        if (V.kind == Kind::constant)
+            reg[v] = constantSlot[V.a];
+        else if (V.kind == Kind::variable)
+            reg[v] = (unsigned int)P.constants.size() + V.a;
+    }
+
+    // Loop bodies are collected separately, by their number in P.loops.
+    std::vector<unsigned int> loopSlot(loops.size(), NONE);
+    std::vector<std::vector<Instruction>> bodies;
+    for (auto [v, start] : order)
+    {
+        const Value& V = values[v];
+        if (start)
+        {
+            // The index and the running total are written while the body
+            // runs, so they need registers of their own until it finishes.
+            loopSlot[loopOf(v)] = (unsigned int)P.loops.size();
+            P.loops.emplace_back();
+            bodies.emplace_back();
+            reg[V.args[1]] = allocate();
+            reg[v]         = allocate();
+            continue;
+        }
+
+        // The destination is allocated before the operands are released, so
+        // an instruction never writes to a register it is still reading.
+        Instruction I{V.op, reg[v], 0, 0};
+        if (V.op == OpCode::call)
+        {
+            I.dst = reg[v] = allocate();
+            I.a            = (unsigned int)P.callArgs.size();
+            I.b            = V.b;
+            for (auto arg : V.args)
+                P.callArgs.push_back(reg[arg]);
+        }
+        else if (IsLoopOp(V.op))
+        {
+            typename Program<T>::Loop& L = P.loops[loopSlot[loopOf(v)]];
+            L.index = reg[V.args[1]];
+            L.from  = reg[V.a];
+            L.to    = reg[V.b];
+            L.term  = reg[V.args[0]];
+            I.a     = loopSlot[loopOf(v)];
+            freeRegs.push_back(L.index);
+        }
+        else
+        {
+            I.dst = reg[v] = allocate();
+            I.a            = reg[V.a];
+            I.b            = IsBinaryOp(V.op) ? reg[V.b] : I.a;
+        }
+        for (auto w : releases[v])
+            freeRegs.push_back(reg[w]);
+        if (block[v] == NONE)
+            P.code.push_back(I);
+        else
+            bodies[loopSlot[block[v]]].push_back(I);
+    }
+    for (size_t k = 0; k < bodies.size(); k++)
+    {
+        P.loops[k].begin = (unsigned int)P.loopCode.size();
+        P.loopCode.insert(P.loopCode.end(), bodies[k].begin(),
+                          bodies[k].end());
+        P.loops[k].end = (unsigned int)P.loopCode.size();
+    }
+
+    P.registerCount = nextReg;
+    P.result        = reg[root];
+    return P;
+}
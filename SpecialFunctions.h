@@ -0,0 +1,658 @@
+#pragma once
+#include "zeta.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <type_traits>
+
+// Special functions of a complex variable, built in to the parser:
+//
+//   Gamma(z), LogGamma(z), Digamma(z)  1e-14 relative for |z| < 10; for
+//                                      Gamma the error then grows like
+//                                      |z| log |z|, the size of the phase.
+//                                      LogGamma is the principal branch,
+//                                      continuous from above on the
+//                                      negative real axis, and is accurate
+//                                      to 1e-15 absolute near its zeros.
+//   Erf(z), Erfc(z)                    1e-14 relative, wherever the result
+//                                      fits in a double.
+//   BesselJ(n, z), BesselI(n, z)       Integer order n, which is rounded;
+//                                      1e-14 relative to the function's
+//                                      size nearby, for |z| up to 1000.
+//   Polylog(s, z)                      Li_s(z), 1e-13 relative for integer
+//                                      s or |z| < 25. Further out other s
+//                                      lose about a digit for every half
+//                                      unit of Re s above 3.
+//   EllipticK(m), EllipticE(m)         Complete elliptic integrals with
+//                                      parameter m = k^2, 1e-15 relative.
+//
+// Each works on std::complex<double>. Like zeta(), real T is evaluated as
+// complex and the real part returned.
+//
+// Gamma, LogGamma and Digamma are written in real arithmetic without
+// branches, so GammaBatch() and the others vectorize; the batch
+// interpreter calls them directly on its arrays. Both give exactly the same
+// values.
+
+// Lanczos approximation with g = 7 and 9 terms.
+constexpr double LANCZOS_G      = 7;
+constexpr double LANCZOS_COEF[] = {
+    0.99999999999980993,  676.5203681218851,     -1259.1392167224028,
+    771.32342877765313,   -176.61502916214059,   12.507343278686905,
+    -0.13857109526572012, 9.9843695780195716e-6, 1.5056327351493116e-7,
+};
+
+// log Gamma(x + iy) for x >= 1/2.
+inline void LanczosLogGamma(double x, double y, double& lr, double& li)
+{
+    // Gamma(w + 1) = sqrt(2 pi) t^(w + 1/2) e^-t A(w), t = w + g + 1/2,
+    // where A(w) is a sum of partial fractions and w = z - 1.
+    const double wr = x - 1;
+    double ar = LANCZOS_COEF[0], ai = 0;
+    for (int k = 1; k < 9; k++)
+    {
+        const double dr = wr + k;
+        const double d  = LANCZOS_COEF[k] / (dr * dr + y * y);
+        ar += d * dr;
+        ai -= d * y;
+    }
+    const double tr  = wr + LANCZOS_G + 0.5;
+    const double ltr = 0.5 * std::log(tr * tr + y * y);
+    const double lti = std::atan2(y, tr);
+    const double pr  = wr + 0.5;
+    lr = pr * ltr - y * lti - tr + 0.5 * std::log(ar * ar + ai * ai) +
+         0.5 * std::log(2 * M_PI);
+    li = pr * lti + y * ltr - y + std::atan2(ai, ar);
+}
+
+// Principal log Gamma(x + iy). Re z < 1/2 is reflected:
+// log Gamma(z) = log pi - log sin(pi z) - log Gamma(1 - z), with the log of
+// the sine continued through the upper half plane, where it is
+// -i pi z + log(i/2) + log(1 - e^(2 pi i z)). The lower half plane is the
+// conjugate.
+inline void LogGammaKernel(double x, double y, double& outRe, double& outIm)
+{
+    const bool lower   = y < 0;
+    const double ay    = std::abs(y);
+    const bool reflect = x < 0.5;
+    double lr, li;
+    LanczosLogGamma(reflect ? 1 - x : x, reflect ? -ay : ay, lr, li);
+
+    // |1 - q e^(2 pi i xf)|^2 with q = e^(-2 pi y), written without
+    // cancellation near the poles.
+    const double xf = x - std::floor(x + 0.5);
+    const double q  = std::exp(-2 * M_PI * ay);
+    const double om = -std::expm1(-2 * M_PI * ay);
+    const double s  = std::sin(M_PI * xf);
+    const double re = om + 2 * q * s * s;
+    const double im = -q * std::sin(2 * M_PI * xf);
+    const double logSinRe =
+        M_PI * ay - M_LN2 + 0.5 * std::log(re * re + im * im);
+    const double logSinIm = M_PI / 2 - M_PI * x + std::atan2(im, re);
+
+    double r = reflect ? std::log(M_PI) - logSinRe - lr : lr;
+    double i = reflect ? -logSinIm - li : li;
+    outRe    = r;
+    outIm    = lower ? -i : i;
+}
+
+inline void GammaKernel(double x, double y, double& outRe, double& outIm)
+{
+    double lr, li;
+    LogGammaKernel(x, y, lr, li);
+    const double m = std::exp(lr);
+    outRe          = m * std::cos(li);
+    outIm          = y == 0 && x > 0 ? 0 : m * std::sin(li);
+}
+
+// Gamma'(z) / Gamma(z), from the asymptotic series at z + 10, and
+// reflected by psi(z) = psi(1 - z) - pi cot(pi z) for Re z < 1/2.
+inline void DigammaKernel(double x, double y, double& outRe, double& outIm)
+{
+    const bool reflect = x < 0.5;
+    double wr          = reflect ? 1 - x : x;
+    double wi          = reflect ? -y : y;
+
+    // psi(w) = psi(w + 10) - sum 1 / (w + k)
+    double sr = 0, si = 0;
+    for (int k = 0; k < 10; k++)
+    {
+        const double d = 1 / ((wr + k) * (wr + k) + wi * wi);
+        sr += (wr + k) * d;
+        si -= wi * d;
+    }
+    wr += 10;
+    const double d  = 1 / (wr * wr + wi * wi);
+    const double rr = wr * d, ri = -wi * d; // 1 / v
+    const double qr = rr * rr - ri * ri, qi = 2 * rr * ri; // 1 / v^2
+    // log v - 1/2v - sum B(2k) / (2k v^2k), by Horner's rule in 1 / v^2.
+    double hr = 0, hi = 0;
+    for (int k = 8; k >= 1; k--)
+    {
+        const double c  = ZETA_BERNOULLI[k - 1] / (2.0 * k);
+        const double tr = hr * qr - hi * qi + c;
+        hi              = hr * qi + hi * qr;
+        hr              = tr;
+    }
+    double pr = 0.5 * std::log(wr * wr + wi * wi) - 0.5 * rr -
+                (hr * qr - hi * qi) - sr;
+    double pi = std::atan2(wi, wr) - 0.5 * ri - (hr * qi + hi * qr) - si;
+
+    // cot(pi z) = (sin 2 pi x - i sinh 2 pi y) / 2(sinh^2 pi y + sin^2 pi x),
+    // which is -i sign(y) to double precision far from the real axis.
+    const double xf = x - std::floor(x + 0.5);
+    const double sx = std::sin(M_PI * xf), sy = std::sinh(M_PI * y);
+    const double den = 2 * (sy * sy + sx * sx);
+    const bool far   = std::abs(y) > 20;
+    const double cr  = far ? 0 : std::sin(2 * M_PI * xf) / den;
+    const double ci = far ? (y > 0 ? -1 : 1) : -std::sinh(2 * M_PI * y) / den;
+    outRe           = reflect ? pr - M_PI * cr : pr;
+    outIm           = reflect ? pi - M_PI * ci : pi;
+}
+
+template <typename R>
+inline void GammaBatch(const R* re, const R* im, R* outRe, R* outIm, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        double r, i;
+        GammaKernel(re[k], im[k], r, i);
+        outRe[k] = (R)r;
+        outIm[k] = (R)i;
+    }
+}
+
+template <typename R>
+inline void LogGammaBatch(const R* re, const R* im, R* outRe, R* outIm,
+                          size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        double r, i;
+        LogGammaKernel(re[k], im[k], r, i);
+        outRe[k] = (R)r;
+        outIm[k] = (R)i;
+    }
+}
+
+template <typename R>
+inline void DigammaBatch(const R* re, const R* im, R* outRe, R* outIm,
+                         size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        double r, i;
+        DigammaKernel(re[k], im[k], r, i);
+        outRe[k] = (R)r;
+        outIm[k] = (R)i;
+    }
+}
+
+// psi'(z), by the same method as DigammaKernel().
+inline std::complex<double> TrigammaEval(std::complex<double> z)
+{
+    typedef std::complex<double> C;
+    if (z.real() < 0.5)
+    {
+        const C s = std::sin(M_PI * z);
+        return M_PI * M_PI / (s * s) - TrigammaEval(1.0 - z);
+    }
+    C shift = 0;
+    for (int k = 0; k < 10; k++)
+        shift += 1.0 / ((z + (double)k) * (z + (double)k));
+    const C v = z + 10.0, r = 1.0 / v, q = r * r;
+    C h = 0;
+    for (int k = 8; k >= 1; k--)
+        h = h * q + ZETA_BERNOULLI[k - 1];
+    return shift + r + 0.5 * q + h * q * r;
+}
+
+// erf by whichever converges without cancellation: the Maclaurin series
+// near the imaginary axis, the series for e^(z^2) erf(z) near the real
+// axis, and the continued fraction for erfc further right. erfc is
+// returned instead when asked for and the continued fraction is used, so
+// it keeps its precision where it's tiny.
+inline std::complex<double> ErfEval(std::complex<double> z, bool complement)
+{
+    typedef std::complex<double> C;
+    const double x = z.real(), y = std::abs(z.imag());
+    if (x < 0)
+    {
+        const C e = ErfEval(-z, false);
+        return complement ? 1.0 + e : -e;
+    }
+    const double TWO_OVER_SQRT_PI = 1.1283791670955126;
+    const double size             = std::abs(z);
+
+    if (x >= 1.5 && (y >= 1.5 || size >= 6 || complement))
+    {
+        // erfc(z) = e^(-z^2) / sqrt(pi) / (z + 1/2 / (z + 1 / (z + ...)))
+        // by the modified Lentz method.
+        const double tiny = 1e-300;
+        C f = z, c = z, d = 0;
+        for (int k = 1; k < 5000; k++)
+        {
+            const double a = 0.5 * k;
+            d              = z + a * d;
+            c              = z + a / c;
+            if (d == 0.0) d = tiny;
+            if (c == 0.0) c = tiny;
+            d         = 1.0 / d;
+            const C t = c * d;
+            f *= t;
+            if (std::abs(t - 1.0) < 1e-16) break;
+        }
+        const C erfc = std::exp(-z * z) / (std::sqrt(M_PI) * f);
+        return complement ? erfc : 1.0 - erfc;
+    }
+
+    C sum = 0, term;
+    if (y >= x)
+    {
+        // 2/sqrt(pi) sum (-1)^n z^(2n+1) / (n! (2n+1))
+        const C z2 = z * z;
+        term       = z;
+        for (int n = 0; n < 10000; n++)
+        {
+            const C add = term / (2.0 * n + 1);
+            sum += add;
+            if (std::abs(add) <= 1e-17 * std::abs(sum)) break;
+            term *= -z2 / (n + 1.0);
+        }
+        sum *= TWO_OVER_SQRT_PI;
+    }
+    else
+    {
+        // 2/sqrt(pi) e^(-z^2) sum (2 z^2)^n z / (1 3 5 ... (2n+1))
+        const C z2 = 2.0 * z * z;
+        term       = z;
+        for (int n = 0; n < 10000; n++)
+        {
+            sum += term;
+            if (std::abs(term) <= 1e-17 * std::abs(sum)) break;
+            term *= z2 / (2.0 * n + 3);
+        }
+        sum *= TWO_OVER_SQRT_PI * std::exp(-z * z);
+    }
+    return complement ? 1.0 - sum : sum;
+}
+
+// J_n(z) for integer n. Beyond the point where the Hankel asymptotic
+// expansion is accurate, it's used directly; nearer zero, Miller's backward
+// recurrence, normalised by e^(-iz) = J_0 + 2 sum (-i)^k J_k, which for
+// Im z >= 0 has no cancellation.
+inline std::complex<double> BesselJEval(int n, std::complex<double> z)
+{
+    typedef std::complex<double> C;
+    if (n < 0) return (n % 2 ? -1.0 : 1.0) * BesselJEval(-n, z);
+    if (z == 0.0) return n == 0 ? 1.0 : 0.0;
+    if (z.real() < 0) return (n % 2 ? -1.0 : 1.0) * BesselJEval(n, -z);
+    if (z.imag() < 0) return std::conj(BesselJEval(n, std::conj(z)));
+
+    const double size = std::abs(z);
+    const double nu2  = 4.0 * n * n;
+    if (size > 25 + 0.5 * n * n)
+    {
+        // sqrt(2 / pi z) (P cos chi - Q sin chi), chi = z - (n/2 + 1/4) pi
+        C P = 0, Q = 0, term = 1;
+        double last = INFINITY;
+        for (int k = 0; k < 200; k++)
+        {
+            if (std::abs(term) > last) break;
+            last = std::abs(term);
+            if (k % 2 == 0)
+                P += (k % 4 ? -1.0 : 1.0) * term;
+            else
+                Q += (k % 4 == 3 ? -1.0 : 1.0) * term;
+            if (last < 1e-17) break;
+            const double odd = 2.0 * k + 1;
+            term *= (nu2 - odd * odd) / (8.0 * (k + 1)) / z;
+        }
+        const C chi = z - (0.5 * n + 0.25) * M_PI;
+        return std::sqrt(2.0 / (M_PI * z)) *
+               (P * std::cos(chi) - Q * std::sin(chi));
+    }
+
+    // Start well above both n and |z|, where J_k falls off quickly.
+    const int top = 2 * ((std::max(n, (int)size) + 20 +
+                          (int)(12 * std::cbrt(std::max((double)n, size)))) /
+                         2);
+    const C twoOverZ = 2.0 / z;
+    C next = 0, cur = 1e-30, result = 0, norm = 0;
+    C phase = std::pow(C(0, -1), top); // (-i)^k
+    for (int k = top; k >= 0; k--)
+    {
+        if (k == n) result = cur;
+        norm += (k == 0 ? 1.0 : 2.0) * phase * cur;
+        const C prev = twoOverZ * (double)k * cur - next;
+        next         = cur;
+        cur          = prev;
+        phase *= C(0, 1);
+        if (std::abs(cur) > 1e250)
+        {
+            next *= 1e-250;
+            cur *= 1e-250;
+            result *= 1e-250;
+            norm *= 1e-250;
+        }
+    }
+    return result / norm * std::exp(C(0, -1) * z);
+}
+
+// I_n(z) = i^-n J_n(iz).
+inline std::complex<double> BesselIEval(int n, std::complex<double> z)
+{
+    typedef std::complex<double> C;
+    const C j = BesselJEval(n, C(-z.imag(), z.real()));
+    switch (((n % 4) + 4) % 4)
+    {
+    case 0: return j;
+    case 1: return C(j.imag(), -j.real());
+    case 2: return -j;
+    default: return C(-j.imag(), j.real());
+    }
+}
+
+inline bool IsPositiveInteger(std::complex<double> s)
+{
+    return s.imag() == 0 && s.real() >= 1 && s.real() == std::floor(s.real());
+}
+
+// Hurwitz zeta(s, a) for Re a > 0, by Euler-Maclaurin summation as in
+// zeta.h.
+inline std::complex<double> HurwitzZeta(std::complex<double> s,
+                                        std::complex<double> a)
+{
+    typedef std::complex<double> C;
+    const int N = (int)std::ceil(0.55 * std::abs(s)) + 10;
+    C sum       = 0;
+    for (int k = 0; k < N; k++)
+        sum += std::exp(-s * std::log(a + (double)k));
+    const C b  = a + (double)N;
+    const C lb = std::log(b);
+    const C x  = std::exp(-s * lb);
+    sum += b * x / (s - 1.0) + 0.5 * x;
+    C poly = s, power = x / b;
+    double fact = 2;
+    for (int k = 1; k <= ZETA_EM_ORDER; k++)
+    {
+        const C term = ZETA_BERNOULLI[k - 1] / fact * poly * power;
+        sum += term;
+        if (std::abs(term) <= ZETA_EPS * std::abs(sum)) break;
+        poly *= (s + (2.0 * k - 1)) * (s + 2.0 * k);
+        power /= b * b;
+        fact *= (2.0 * k + 1) * (2.0 * k + 2);
+    }
+    return sum;
+}
+
+// The Bernoulli polynomial B_n(x).
+inline std::complex<double> BernoulliPolynomial(int n, std::complex<double> x)
+{
+    // B_k from zeta(k) = (-1)^(k/2+1) B_k (2 pi)^k / 2 k! for even k.
+    std::complex<double> sum = 0;
+    double binom             = 1; // n choose k
+    double factK             = 1; // k!
+    for (int k = 0; k <= n; k++)
+    {
+        if (k > 0)
+        {
+            binom = binom * (n - k + 1) / k;
+            factK *= k;
+        }
+        double B;
+        if (k == 0)
+            B = 1;
+        else if (k == 1)
+            B = -0.5;
+        else if (k % 2)
+            continue;
+        else
+            B = (k % 4 ? 2.0 : -2.0) * factK * zeta((double)k) /
+                std::pow(2 * M_PI, k);
+        sum += binom * B * std::pow(x, n - k);
+    }
+    return sum;
+}
+
+// Li_s(z): the defining series for |z| <= 1/2; for integer s and |z| >= 2
+// the inversion formula, which needs a Bernoulli polynomial; otherwise the
+// series in mu = log z, sum zeta(s - k) mu^k / k! plus
+// Gamma(1 - s) (-mu)^(s-1), while |mu| < 4.5, which is |z| < 25 at least;
+// and beyond that Jonquiere's relation with the Hurwitz zeta function. The
+// zeta values depend only on s, so they're kept for the last s seen on each
+// thread.
+inline std::complex<double> PolylogEval(std::complex<double> s,
+                                        std::complex<double> z)
+{
+    typedef std::complex<double> C;
+    const C I(0, 1);
+    const double size = std::abs(z);
+    const bool integer =
+        s.imag() == 0 && s.real() == std::floor(s.real());
+
+    if (size <= 0.5)
+    {
+        C sum = 0, power = z;
+        for (size_t k = 1; k < 10000; k++)
+        {
+            const C term = power * std::exp(-s * ZetaLog(k));
+            sum += term;
+            if (std::abs(term) <= 1e-17 * std::abs(sum) && k > 2) break;
+            power *= z;
+        }
+        return sum;
+    }
+    if (integer && s.real() == 0) return z / (1.0 - z);
+
+    if (size >= 2 && integer)
+    {
+        // Li_n(z) + (-1)^n Li_n(1/z) = -(2 pi i)^n / n! B_n(1/2 + l/2pi i),
+        // where the right side vanishes for n < 0.
+        const int n = (int)s.real();
+        const C inverse = -(n % 2 ? -1.0 : 1.0) * PolylogEval(s, 1.0 / z);
+        if (n < 0) return inverse;
+        double fact = 1;
+        for (int k = 2; k <= n; k++)
+            fact *= k;
+        return inverse - std::pow(2 * M_PI * I, n) / fact *
+                             BernoulliPolynomial(n, 0.5 + std::log(-z) /
+                                                            (2 * M_PI * I));
+    }
+
+    const C mu = std::log(z);
+    if (std::abs(mu) >= 4.5)
+    {
+        const C a  = 0.5 + std::log(-z) / (2 * M_PI * I);
+        const C g  = std::exp(ZetaLogGamma(1.0 - s));
+        const C ip = std::exp((1.0 - s) * (M_PI / 2 * I)); // i^(1-s)
+        return g * std::pow(2 * M_PI, s - 1.0) *
+               (ip * HurwitzZeta(1.0 - s, a) +
+                1.0 / ip * HurwitzZeta(1.0 - s, 1.0 - a));
+    }
+
+    if (mu == 0.0) return zeta(s);
+    constexpr int TERMS = 128;
+    struct Coefficients
+    {
+        C s = NAN;
+        C c[TERMS]; // zeta(s - k) / k!
+    };
+    thread_local Coefficients cache;
+    if (cache.s != s)
+    {
+        double fact = 1;
+        for (int k = 0; k < TERMS; k++)
+        {
+            if (k > 0) fact *= k;
+            // For integer s the pole at s - k = 1 cancels Gamma(1 - s)'s,
+            // and that term is handled below.
+            const C zs = s - (double)k;
+            cache.c[k] = zs == 1.0 ? 0.0 : zeta(zs) / fact;
+        }
+        cache.s = s;
+    }
+
+    C sum = 0, power = 1;
+    for (int k = 0; k < TERMS; k++)
+    {
+        sum += cache.c[k] * power;
+        power *= mu;
+    }
+    if (IsPositiveInteger(s))
+    {
+        // mu^(n-1) / (n-1)! (H_(n-1) - log(-mu))
+        const int n = (int)s.real();
+        double harmonic = 0, fact = 1;
+        for (int k = 1; k < n; k++)
+        {
+            harmonic += 1.0 / k;
+            fact *= k;
+        }
+        return sum + std::pow(mu, n - 1) / fact * (harmonic - std::log(-mu));
+    }
+    return sum + std::exp(ZetaLogGamma(1.0 - s)) * std::pow(-mu, s - 1.0);
+}
+
+// K(m) and E(m) by the arithmetic-geometric mean, taking at each step the
+// square root closer to the arithmetic mean, which gives the principal
+// branches with the cut along m > 1, continuous from above on the cut.
+inline void EllipticEval(std::complex<double> m, std::complex<double>& K,
+                         std::complex<double>& E)
+{
+    typedef std::complex<double> C;
+    if (m == 1.0)
+    {
+        K = INFINITY;
+        E = 1;
+        return;
+    }
+    C a = 1, b = std::sqrt(1.0 - m);
+    C sum        = 0.5 * m; // sum 2^(n-1) c_n^2
+    double power = 0.5;
+    for (int k = 0; k < 64; k++)
+    {
+        const C c    = 0.5 * (a - b);
+        const C mean = 0.5 * (a + b);
+        C g          = std::sqrt(a * b);
+        if (std::abs(mean - g) > std::abs(mean + g)) g = -g;
+        power *= 2;
+        sum += power * c * c;
+        a = mean;
+        b = g;
+        // Convergence is quadratic, so the next c^2 is below rounding.
+        if (std::abs(c) <= 1e-9 * std::abs(a)) break;
+    }
+    K = M_PI / (2.0 * a);
+    E = K * (1.0 - sum);
+}
+
+// Real T is evaluated as complex, and the real part returned.
+template <typename T, typename F> inline T SpecialAsComplex(T z, F f)
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return (T)f(std::complex<double>(z)).real();
+    else
+    {
+        auto w = f(std::complex<double>(z.real(), z.imag()));
+        return T(w.real(), w.imag());
+    }
+}
+
+template <typename T> T Gamma(T z)
+{
+    return SpecialAsComplex(z, [](std::complex<double> w) {
+        double r, i;
+        GammaKernel(w.real(), w.imag(), r, i);
+        return std::complex<double>(r, i);
+    });
+}
+
+template <typename T> T LogGamma(T z)
+{
+    return SpecialAsComplex(z, [](std::complex<double> w) {
+        double r, i;
+        LogGammaKernel(w.real(), w.imag(), r, i);
+        return std::complex<double>(r, i);
+    });
+}
+
+template <typename T> T Digamma(T z)
+{
+    return SpecialAsComplex(z, [](std::complex<double> w) {
+        double r, i;
+        DigammaKernel(w.real(), w.imag(), r, i);
+        return std::complex<double>(r, i);
+    });
+}
+
+// psi'(z), for the derivative of Digamma.
+template <typename T> T Trigamma(T z)
+{
+    return SpecialAsComplex(z, TrigammaEval);
+}
+
+template <typename T> T Erf(T z)
+{
+    return SpecialAsComplex(
+        z, [](std::complex<double> w) { return ErfEval(w, false); });
+}
+
+template <typename T> T Erfc(T z)
+{
+    return SpecialAsComplex(
+        z, [](std::complex<double> w) { return ErfEval(w, true); });
+}
+
+template <typename T> T EllipticK(T m)
+{
+    return SpecialAsComplex(m, [](std::complex<double> w) {
+        std::complex<double> K, E;
+        EllipticEval(w, K, E);
+        return K;
+    });
+}
+
+template <typename T> T EllipticE(T m)
+{
+    return SpecialAsComplex(m, [](std::complex<double> w) {
+        std::complex<double> K, E;
+        EllipticEval(w, K, E);
+        return E;
+    });
+}
+
+// The order is rounded to the nearest integer.
+inline int BesselOrder(std::complex<double> n)
+{
+    return (int)std::lround(std::clamp(n.real(), -1e6, 1e6));
+}
+
+template <typename T> T BesselJ(T n, T z)
+{
+    const int order = BesselOrder(SpecialAsComplex(
+        n, [](std::complex<double> w) { return w; }));
+    return SpecialAsComplex(
+        z, [order](std::complex<double> w) { return BesselJEval(order, w); });
+}
+
+template <typename T> T BesselI(T n, T z)
+{
+    const int order = BesselOrder(SpecialAsComplex(
+        n, [](std::complex<double> w) { return w; }));
+    return SpecialAsComplex(
+        z, [order](std::complex<double> w) { return BesselIEval(order, w); });
+}
+
+template <typename T> T Polylog(T s, T z)
+{
+    std::complex<double> order;
+    if constexpr (std::is_floating_point_v<T>)
+        order = s;
+    else
+        order = std::complex<double>(s.real(), s.imag());
+    return SpecialAsComplex(
+        z, [order](std::complex<double> w) { return PolylogEval(order, w); });
+}
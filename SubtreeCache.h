@@ -0,0 +1,168 @@
+#pragma once
+#include "Program.h"
+
+#include <algorithm>
+#include <complex>
+#include <type_traits>
+#include <vector>
+
+// Remembers, for one set of points, the values of the parts of a function
+// which don't depend on its parameters, e.g. exp(z)*sin(z) in
+// exp(z)*sin(z) + a*z. Evaluating at the same points again with only the
+// parameters changed, as in an animation, then only runs the rest. See
+// Program<T>::SplitByParameters().
+//
+// Values are only cached once the same points come round a second time, so
+// callers whose points change every time pay next to nothing extra. A ready
+// native kernel is used instead, and only std::complex<double> is cached;
+// anything else, including points needing more than double precision, is
+// simply evaluated.
+template <typename T> class SubtreeCache
+{
+public:
+    // Call before evaluating at the n points pts, with context's program and
+    // independent variable, in precision p, normally ChoosePrecision() for
+    // all n points. pts is copied, so it may be overwritten by the results.
+    void Prepare(const EvalContext<T>& context, const T* pts, size_t n,
+                 Precision p);
+
+    // Evaluates points [first, first + count) of those given to Prepare(),
+    // with context's parameter values, into out[first] onwards. Every point
+    // must be evaluated before the next Prepare(). Separate ranges can be
+    // done on different threads, each with its own context.
+    void EvalRange(EvalContext<T>& context, T* out, size_t first,
+                   size_t count);
+
+    void EvalBatch(EvalContext<T>& context, const T* in, T* out, size_t n)
+    {
+        Prepare(context, in, n, context.ChoosePrecision(in, n));
+        EvalRange(context, out, 0, n);
+    }
+
+    void Clear() { *this = SubtreeCache(); }
+
+private:
+    enum class State
+    {
+        empty,  // Nothing known about the points.
+        seen,   // Points stored, values not yet cached.
+        cached, // Values cached for the stored points.
+    };
+    enum class Mode
+    {
+        plain, // Evaluate the whole function.
+        fill,  // Cache parameter-free values, then finish.
+        reuse, // Only evaluate the parameter part.
+    };
+
+    unsigned long long programId = 0;
+    int ivSlot                   = -1;
+    bool split                   = false;
+    Program<T> ivPart;
+    Program<T> paramPart;
+    unsigned int leafCount   = 0; // Registers shared by all three programs.
+    unsigned int firstPassed = 0; // ivPart's register for cached value 0.
+    unsigned int passedCount = 0; // Values cached per point.
+
+    State state         = State::empty;
+    Mode mode           = Mode::plain;
+    Precision precision = Precision::normal;
+    std::vector<T> points;
+    // Cached value k at point i is at k * points.size() + i.
+    std::vector<double> cachedRe;
+    std::vector<double> cachedIm;
+};
+
+template <typename T>
+inline void SubtreeCache<T>::Prepare(const EvalContext<T>& context,
+                                     const T* pts, size_t n, Precision p)
+{
+    const Program<T>& P = context.GetProgram();
+    if (P.GetId() != programId || context.GetIVSlot() != ivSlot)
+    {
+        programId = P.GetId();
+        ivSlot    = context.GetIVSlot();
+        split     = false;
+        if constexpr (std::is_same_v<T, std::complex<double>>)
+            split = P.SplitByParameters(ivSlot, ivPart, paramPart);
+        leafCount =
+            P.GetFirstVarSlot() + (unsigned int)P.GetVarNames().size();
+        firstPassed = P.GetRegisterCount();
+        passedCount = split ? (unsigned int)(paramPart.GetVarNames().size() -
+                                             P.GetVarNames().size())
+                            : 0;
+        state = State::empty;
+    }
+
+    mode      = Mode::plain;
+    precision = p;
+    if (state == State::empty || points.size() != n ||
+        !std::equal(pts, pts + n, points.begin()))
+    {
+        points.assign(pts, pts + n);
+        state = State::seen;
+        return;
+    }
+    if (!split || context.UsesNativeKernel()) return;
+    // Cached values are only double precision.
+    if (p != Precision::normal) return;
+    if (state == State::seen)
+    {
+        cachedRe.resize((size_t)passedCount * n);
+        cachedIm.resize((size_t)passedCount * n);
+        mode  = Mode::fill;
+        state = State::cached;
+    }
+    else
+        mode = Mode::reuse;
+}
+
+template <typename T>
+inline void SubtreeCache<T>::EvalRange(EvalContext<T>& context, T* out,
+                                       size_t first, size_t count)
+{
+    if constexpr (std::is_same_v<T, std::complex<double>>)
+    {
+        if (mode != Mode::plain)
+        {
+            const size_t n = points.size();
+            auto p         = reinterpret_cast<const double*>(points.data());
+            auto o         = reinterpret_cast<double*>(out);
+            std::vector<double> scratch;
+            std::vector<BatchInput> in;
+            std::vector<BatchOutput> cached;
+            if (ivSlot >= 0)
+            {
+                in.push_back({(unsigned int)ivSlot, p + 2 * first,
+                              p + 2 * first + 1, 2});
+            }
+            for (unsigned int k = 0; k < passedCount; k++)
+            {
+                cached.push_back({firstPassed + k,
+                                  cachedRe.data() + k * n + first,
+                                  cachedIm.data() + k * n + first, 1});
+            }
+
+            const std::vector<T>& regs = context.GetRegisters();
+            if (mode == Mode::fill)
+            {
+                ivPart.RunBatch(regs.data(), in.data(), in.size(),
+                                cached.data(), cached.size(), count, scratch);
+            }
+
+            // Cached values go in as the extra variables.
+            std::vector<T> leaves(regs.begin(), regs.begin() + leafCount);
+            leaves.resize(leafCount + passedCount);
+            for (unsigned int k = 0; k < passedCount; k++)
+            {
+                in.push_back({leafCount + k, cached[k].re, cached[k].im, 1});
+            }
+            BatchOutput result{paramPart.GetResultRegister(), o + 2 * first,
+                               o + 2 * first + 1, 2};
+            paramPart.RunBatch(leaves.data(), in.data(), in.size(), &result,
+                               1, count, scratch);
+            return;
+        }
+    }
+    context.EvalBatch(points.data() + first, out + first, count, precision);
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <complex>
 #include <functional>
@@ -25,18 +26,75 @@ enum precedence_list
     sym_comma  = -1
 };
 
+// Operations understood by the Program<T> interpreter. Symbols which can be
+// compiled report one of these through GetOpCode(). Functions registered by
+// the user without a dedicated opcode are compiled as OpCode::call.
+enum class OpCode : unsigned char
+{
+    none = 0,
+    add,
+    sub,
+    mul,
+    div,
+    pow,
+    powr, // pow with a real exponent
+    neg,
+    exp,
+    log,
+    sqrt,
+    sin,
+    cos,
+    tan,
+    sinh,
+    cosh,
+    tanh,
+    asin,
+    acos,
+    atan,
+    asinh,
+    acosh,
+    atanh,
+    sec,
+    csc,
+    cot,
+    sech,
+    csch,
+    coth,
+    asec,
+    acsc,
+    acot,
+    asech,
+    acsch,
+    acoth,
+    zeta,
+    gamma,
+    loggamma,
+    digamma,
+    erf,
+    erfc,
+    ellipk,
+    ellipe,
+    besselj, // Two arguments, as are the rest
+    besseli,
+    polylog,
+    sum,  // a is the index of a Program<T>::Loop
+    prod, // Same as sum
+    call
+};
+
 #define DEF_CLONE_FUNC(X)                                                      \
-    virtual X<T>* Clone() noexcept { return new X<T>(*this); };
+    virtual X<T>* Clone() const noexcept { return new X<T>(*this); };
 
-// Base class for parsed symbols. Symbol pointers are stored in a vector, and
-// each symbol has a pointer "src" to that vector. Symbols recursively
-// evaluate themselves, pulling their arguments from the vector. Any valid
-// calculation will return a SymbolNum<T> unique pointer.
+// Base class for parsed symbols. Symbol pointers are stored in a vector in
+// postfix order, and each symbol has a pointer to the ParsedFunc which owns
+// it. The vector is compiled into a Program<T> (see Program.h) using the
+// opcode and arity each symbol reports; numbers, constants and variables
+// become registers.
 template <typename T> class Symbol
 {
 
 public:
-    virtual Symbol<T>* Clone() noexcept = 0;
+    virtual Symbol<T>* Clone() const noexcept = 0;
     // Various flags and virtual "members" used by the parser.
     virtual int GetPrecedence() const    = 0;
     virtual std::string GetToken() const = 0;
@@ -47,6 +105,11 @@ public:
         return false;
      }*/
     virtual bool IsVar() const { return false; }
+    virtual OpCode GetOpCode() const { return OpCode::none; }
+    virtual int GetArity() const { return 0; }
+    // Only needed for OpCode::call. Arguments are passed in the order they
+    // are popped from the symbol stack.
+    virtual std::function<T(const T*)> GetCallable() const { return nullptr; }
 
     Symbol(){};
     virtual ~Symbol(){};
@@ -67,31 +130,7 @@ template <typename T> class Dyad : public Symbol<T>
 {
 
 public:
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1, SymbolNum<T> t2) const = 0;
-    virtual SymbolNum<T> eval() const
-    {
-        try
-        {
-            if (this->parent->itr < this->parent->GetMinItr() + 1)
-                throw std::invalid_argument("Error: Mismatched operations.");
-        }
-        catch (std::invalid_argument)
-        {
-            throw;
-        }
-        SymbolNum<T> s1 = (*(--this->parent->itr))->eval();
-        try
-        {
-            if (this->parent->itr < this->parent->GetMinItr() + 1)
-                throw std::invalid_argument("Error: Mismatched operations.");
-        }
-        catch (std::invalid_argument)
-        {
-            throw;
-        }
-        SymbolNum<T> s2 = (*(--this->parent->itr))->eval();
-        return Apply(std::move(s1), std::move(s2));
-    }
+    int GetArity() const { return 2; }
     bool IsDyad() const { return true; }
 };
 
@@ -100,20 +139,7 @@ template <typename T> class Monad : public Symbol<T>
 {
 
 public:
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1) const = 0;
-    virtual SymbolNum<T> eval() const
-    {
-        try
-        {
-            if (this->parent->itr < this->parent->GetMinItr() + 1)
-                throw std::invalid_argument("Error: Mismatched operations.");
-        }
-        catch (std::invalid_argument)
-        {
-            throw;
-        }
-        return Apply(std::move((*(--this->parent->itr))->eval()));
-    }
+    int GetArity() const { return 1; }
     bool IsMonad() const { return true; }
 };
 
@@ -151,43 +177,54 @@ template <typename T, typename... Ts> class SymbolFunc : public Symbol<T>
 {
 
 public:
-    virtual SymbolFunc<T, Ts...>* Clone() noexcept
+    virtual SymbolFunc<T, Ts...>* Clone() const noexcept
     {
         return new SymbolFunc<T, Ts...>(*this);
     };
     SymbolFunc() noexcept {};
-    SymbolFunc(const std::function<T(Ts...)>& g, const std::string& s) noexcept
-        : f(g), name(s){};
+    SymbolFunc(const std::function<T(Ts...)>& g, const std::string& s,
+               OpCode code = OpCode::call) noexcept
+        : f(g), name(s), op(code){};
 
     std::function<T(Ts...)> f;
-    virtual SymbolNum<T> Apply(std::array<T, sizeof...(Ts)>& args) const
+    virtual int GetPrecedence() const { return sym_func; }
+    virtual std::string GetToken() const { return name; }
+    virtual OpCode GetOpCode() const { return op; }
+    virtual int GetArity() const { return sizeof...(Ts); }
+    virtual std::function<T(const T*)> GetCallable() const
     {
-        return SymbolNum<T>(callByArray(f, args));
+        auto g = f;
+        return [g](const T* args) {
+            std::array<T, sizeof...(Ts)> a;
+            std::copy(args, args + sizeof...(Ts), a.begin());
+            return callByArray(g, a);
+        };
     }
-    virtual SymbolNum<T> eval() const
+
+private:
+    std::string name = "f";
+    OpCode op        = OpCode::call;
+};
+
+// sum(k, a, b, expr) and prod(k, a, b, expr): the sum or product of expr
+// for k = a, a + 1, ..., b. The index k can be any name, and only means the
+// index inside expr. ProgramBuilder<T> compiles the body into a loop rather
+// than expanding it.
+template <typename T> class SymbolLoop : public Symbol<T>
+{
+public:
+    DEF_CLONE_FUNC(SymbolLoop)
+    SymbolLoop(const std::string& s, OpCode code) noexcept : name(s), op(code)
     {
-        std::array<T, sizeof...(Ts)> s;
-        for (size_t i = 0; i < sizeof...(Ts); i++)
-        {
-            try
-            {
-                if (this->parent->itr < this->parent->GetMinItr() + 1)
-                    throw std::invalid_argument(
-                        "Error: Mismatched operations.");
-            }
-            catch (std::invalid_argument)
-            {
-                throw;
-            }
-            s[i] = (*(--this->parent->itr))->eval().GetVal();
-        }
-        return Apply(s);
     }
     virtual int GetPrecedence() const { return sym_func; }
     virtual std::string GetToken() const { return name; }
+    virtual OpCode GetOpCode() const { return op; }
+    virtual int GetArity() const { return 4; }
 
 private:
-    std::string name = "f";
+    std::string name;
+    OpCode op;
 };
 
 // Used for parsing strings. Should never make it to the output queue
@@ -232,7 +269,7 @@ public:
     SymbolNum(const T& v) noexcept : val(v) {}
     SymbolNum(const SymbolNum<T>&& S) noexcept { val = S.val; }
     SymbolNum(const SymbolNum<T>* ptr) noexcept { val = ptr->val; }
-    SymbolNum(SymbolNum<T>& S) noexcept : val(S.val){};
+    SymbolNum(const SymbolNum<T>& S) noexcept : val(S.val){};
 
     virtual int GetPrecedence() const { return sym_num; }
 
@@ -272,7 +309,7 @@ template <typename T> class SymbolVar : public SymbolNum<T>
 {
 public:
     DEF_CLONE_FUNC(SymbolVar)
-    SymbolVar(SymbolVar<T>& S) noexcept : name(S.name)
+    SymbolVar(const SymbolVar<T>& S) noexcept : name(S.name)
     {
         this->val = S.GetVal();
     };
@@ -292,7 +329,7 @@ template <typename T> class SymbolConst : public SymbolNum<T>
 {
 public:
     DEF_CLONE_FUNC(SymbolConst);
-    SymbolConst(SymbolConst<T>& S) noexcept : name(S.name)
+    SymbolConst(const SymbolConst<T>& S) noexcept : name(S.name)
     {
         this->val = S.GetVal();
     };
@@ -318,7 +355,6 @@ public:
     virtual int GetPrecedence() const { return sym_comma; }
     virtual std::string GetToken() const { return ","; }
     virtual bool IsPunctuation() const { return true; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1) const { return this->eval(); }
 };
 
 template <typename T> class SymbolError : public SymbolNum<T>
@@ -337,10 +373,7 @@ public:
     DEF_CLONE_FUNC(SymbolAdd)
     virtual int GetPrecedence() const { return sym_add; }
     virtual std::string GetToken() const { return "+"; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1, SymbolNum<T> t2) const
-    {
-        return SymbolNum<T>(t2.GetVal() + t1.GetVal());
-    }
+    virtual OpCode GetOpCode() const { return OpCode::add; }
 };
 
 template <typename T> class SymbolSub : public Dyad<T>
@@ -350,10 +383,7 @@ public:
     DEF_CLONE_FUNC(SymbolSub)
     virtual int GetPrecedence() const { return sym_sub; }
     virtual std::string GetToken() const { return "-"; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1, SymbolNum<T> t2) const
-    {
-        return SymbolNum<T>(t2.GetVal() - t1.GetVal());
-    }
+    virtual OpCode GetOpCode() const { return OpCode::sub; }
 };
 
 template <typename T> class SymbolMul : public Dyad<T>
@@ -363,10 +393,7 @@ public:
     DEF_CLONE_FUNC(SymbolMul)
     virtual int GetPrecedence() const { return sym_mul; }
     virtual std::string GetToken() const { return "*"; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1, SymbolNum<T> t2) const
-    {
-        return SymbolNum<T>(t2.GetVal() * t1.GetVal());
-    }
+    virtual OpCode GetOpCode() const { return OpCode::mul; }
 };
 
 template <typename T> class SymbolDiv : public Dyad<T>
@@ -376,10 +403,7 @@ public:
     DEF_CLONE_FUNC(SymbolDiv)
     virtual int GetPrecedence() const { return sym_div; }
     virtual std::string GetToken() const { return "/"; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1, SymbolNum<T> t2) const
-    {
-        return SymbolNum<T>(t2.GetVal() / t1.GetVal());
-    }
+    virtual OpCode GetOpCode() const { return OpCode::div; }
 };
 
 template <typename T> class SymbolPow : public Dyad<T>
@@ -390,10 +414,7 @@ public:
     virtual int GetPrecedence() const { return sym_pow; }
     virtual bool IsLeftAssoc() const { return false; }
     virtual std::string GetToken() const { return "^"; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1, SymbolNum<T> t2) const
-    {
-        return SymbolNum<T>(pow(t2.GetVal(), t1.GetVal()));
-    }
+    virtual OpCode GetOpCode() const { return OpCode::pow; }
 };
 
 template <typename T> class SymbolNeg : public Monad<T>
@@ -403,8 +424,5 @@ public:
     DEF_CLONE_FUNC(SymbolNeg)
     virtual int GetPrecedence() const { return sym_neg; }
     virtual std::string GetToken() const { return "~"; }
-    virtual SymbolNum<T> Apply(SymbolNum<T> t1) const
-    {
-        return SymbolNum<T>(-t1.GetVal());
-    }
+    virtual OpCode GetOpCode() const { return OpCode::neg; }
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "VectorMathKernels.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Built in VectorMathAVX2.cpp, with AVX2 code generation.
+const VectorMath& VectorMathAVX2();
+
+namespace
+{
+// Whether the processor has AVX2 and FMA, and the OS saves the AVX registers.
+bool HasAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool fma     = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx     = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+} // namespace
+
+const VectorMath& VectorMath::Get()
+{
+    static const VectorMath SSE2    = MakeVectorMath<PackSSE2>("SSE2");
+    static const VectorMath& chosen = HasAVX2() ? VectorMathAVX2() : SSE2;
+    return chosen;
+}
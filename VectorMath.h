@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+
+// Complex elementary functions over arrays, evaluated several points at a
+// time with SIMD instructions. Arguments and results are split into real and
+// imaginary arrays, as in Program<T>::ExecBatch; the outputs may alias the
+// inputs. Get() picks the widest build the processor supports, AVX2 with FMA
+// or else SSE2, the first time it is called.
+//
+// Worst errors found against long double, over random points with parts up
+// to 2e5 (pow: up to 8), in ulps of each part of the result, or of the
+// larger part where the other is under a thousandth of it. glibc's
+// std::complex functions, for comparison:
+//
+//                   SIMD    std::complex
+//   exp              3.1    1.9
+//   log              4.1    2.9
+//   sqrt             2.2    2.1
+//   sin, cos         3.0    2.8
+//   sinh, cosh       3.2    2.7
+//   tan, tanh        5.9    5.5
+//   pow, powr        1.5    1.3    ulps of |a^b| per unit of |b log a| + 1
+//
+// Points the kernels don't reduce themselves -- non-finite values,
+// trigonometric arguments beyond 1e5, anything near overflow, square roots
+// of subnormals and pow with a = 0 -- are passed to the std::complex
+// functions instead.
+struct VectorMath
+{
+    typedef void (*Unary)(const double* re, const double* im, double* outRe,
+                          double* outIm, size_t n);
+    typedef void (*Binary)(const double* aRe, const double* aIm,
+                           const double* bRe, const double* bIm, double* outRe,
+                           double* outIm, size_t n);
+
+    Unary exp, log, sqrt, sin, cos, tan, sinh, cosh, tanh;
+    Binary pow;
+    Binary powr; // pow with the real part of b as exponent
+    const char* name;
+
+    static const VectorMath& Get();
+};
@@ -0,0 +1,13 @@
+// Compiled with AVX2 code generation, and only called once VectorMath::Get()
+// has found the processor supports it.
+#include "VectorMathKernels.h"
+
+#ifndef __AVX2__
+#error VectorMathAVX2.cpp must be compiled with AVX2 enabled (/arch:AVX2)
+#endif
+
+const VectorMath& VectorMathAVX2()
+{
+    static const VectorMath M = MakeVectorMath<PackAVX2>("AVX2");
+    return M;
+}
@@ -0,0 +1,650 @@
+#pragma once
+#include "VectorMath.h"
+
+#include <immintrin.h>
+
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// The kernels behind VectorMath, written once over a pack of doubles and
+// built for each instruction set by its own translation unit:
+// VectorMath.cpp for SSE2 and VectorMathAVX2.cpp for AVX2. Only those
+// include this. Everything here has internal linkage, so the linker can't
+// substitute one build's inline functions for the other's.
+namespace
+{
+
+// Operators and helpers for a pack type P whose intrinsics are PREFIX_*
+// (_mm or _mm256), with integer type INT.
+#define PACK_BINARY(P, OP, FN)                                                 \
+    inline P operator OP(P a, P b) { return FN(a.v, b.v); }
+#define PACK_COMMON(P, PREFIX, INT)                                            \
+    PACK_BINARY(P, +, PREFIX##_add_pd)                                         \
+    PACK_BINARY(P, -, PREFIX##_sub_pd)                                         \
+    PACK_BINARY(P, *, PREFIX##_mul_pd)                                         \
+    PACK_BINARY(P, /, PREFIX##_div_pd)                                         \
+    PACK_BINARY(P, &, PREFIX##_and_pd)                                         \
+    PACK_BINARY(P, |, PREFIX##_or_pd)                                          \
+    PACK_BINARY(P, ^, PREFIX##_xor_pd)                                         \
+    /* ~a & b */                                                               \
+    inline P AndNot(P a, P b) { return PREFIX##_andnot_pd(a.v, b.v); }        \
+    inline P Min(P a, P b) { return PREFIX##_min_pd(a.v, b.v); }               \
+    inline P Max(P a, P b) { return PREFIX##_max_pd(a.v, b.v); }               \
+    inline P Sqrt(P a) { return PREFIX##_sqrt_pd(a.v); }                       \
+    inline int MoveMask(P a) { return PREFIX##_movemask_pd(a.v); }             \
+    inline P operator-(P a) { return PREFIX##_xor_pd(a.v, P(-0.0).v); }        \
+    inline P AddInt(P a, int64_t b)                                            \
+    {                                                                          \
+        return P::Real(PREFIX##_add_epi64(P::Int(a), PREFIX##_set1_epi64x(b)));\
+    }                                                                          \
+    inline P ShiftLeft(P a, int bits)                                          \
+    {                                                                          \
+        return P::Real(PREFIX##_slli_epi64(P::Int(a), bits));                  \
+    }                                                                          \
+    inline P ShiftRight(P a, int bits)                                         \
+    {                                                                          \
+        return P::Real(PREFIX##_srli_epi64(P::Int(a), bits));                  \
+    }                                                                          \
+    /* All ones in each lane whose sign bit is set. */                         \
+    inline P SignMask(P a)                                                     \
+    {                                                                          \
+        const INT high = PREFIX##_srai_epi32(P::Int(a), 31);                   \
+        return P::Real(PREFIX##_shuffle_epi32(high, _MM_SHUFFLE(3, 3, 1, 1))); \
+    }
+
+// Two doubles in an SSE2 register.
+struct PackSSE2
+{
+    static constexpr size_t N    = 2;
+    static constexpr bool HAS_FMA = false;
+    __m128d v;
+
+    PackSSE2() = default;
+    PackSSE2(__m128d x) : v(x) {}
+    PackSSE2(double x) : v(_mm_set1_pd(x)) {}
+
+    static PackSSE2 Load(const double* p) { return _mm_loadu_pd(p); }
+    void Store(double* p) const { _mm_storeu_pd(p, v); }
+    static __m128i Int(PackSSE2 a) { return _mm_castpd_si128(a.v); }
+    static PackSSE2 Real(__m128i a) { return _mm_castsi128_pd(a); }
+};
+
+PACK_COMMON(PackSSE2, _mm, __m128i)
+PACK_BINARY(PackSSE2, <, _mm_cmplt_pd)
+PACK_BINARY(PackSSE2, >, _mm_cmpgt_pd)
+PACK_BINARY(PackSSE2, <=, _mm_cmple_pd)
+PACK_BINARY(PackSSE2, ==, _mm_cmpeq_pd)
+// SSE2 has no fused multiply-add.
+inline PackSSE2 Fma(PackSSE2 a, PackSSE2 b, PackSSE2 c) { return a * b + c; }
+
+#ifdef __AVX2__
+// Four doubles in an AVX register.
+struct PackAVX2
+{
+    static constexpr size_t N    = 4;
+    static constexpr bool HAS_FMA = true;
+    __m256d v;
+
+    PackAVX2() = default;
+    PackAVX2(__m256d x) : v(x) {}
+    PackAVX2(double x) : v(_mm256_set1_pd(x)) {}
+
+    static PackAVX2 Load(const double* p) { return _mm256_loadu_pd(p); }
+    void Store(double* p) const { _mm256_storeu_pd(p, v); }
+    static __m256i Int(PackAVX2 a) { return _mm256_castpd_si256(a.v); }
+    static PackAVX2 Real(__m256i a) { return _mm256_castsi256_pd(a); }
+};
+
+#define PACK_COMPARE(OP, PREDICATE)                                            \
+    inline PackAVX2 operator OP(PackAVX2 a, PackAVX2 b)                        \
+    {                                                                          \
+        return _mm256_cmp_pd(a.v, b.v, PREDICATE);                             \
+    }
+PACK_COMMON(PackAVX2, _mm256, __m256i)
+PACK_COMPARE(<, _CMP_LT_OQ)
+PACK_COMPARE(>, _CMP_GT_OQ)
+PACK_COMPARE(<=, _CMP_LE_OQ)
+PACK_COMPARE(==, _CMP_EQ_OQ)
+#undef PACK_COMPARE
+inline PackAVX2 Fma(PackAVX2 a, PackAVX2 b, PackAVX2 c)
+{
+    return _mm256_fmadd_pd(a.v, b.v, c.v);
+}
+#endif
+
+#undef PACK_BINARY
+#undef PACK_COMMON
+
+// Everything below is written for either pack.
+
+// A double with the given bit pattern, in every lane.
+template <typename V> inline V Bits(uint64_t bits)
+{
+    double d;
+    std::memcpy(&d, &bits, sizeof d);
+    return V(d);
+}
+
+template <typename V> inline V Select(V mask, V a, V b)
+{
+    return (mask & a) | AndNot(mask, b);
+}
+template <typename V> inline V Not(V mask)
+{
+    return AndNot(mask, Bits<V>(~0ull));
+}
+template <typename V> inline V Abs(V a)
+{
+    return AndNot(V(-0.0), a);
+}
+// |a| with the sign of b.
+template <typename V> inline V CopySign(V a, V b)
+{
+    return AndNot(V(-0.0), a) | (V(-0.0) & b);
+}
+template <typename V> inline bool Any(V mask) { return MoveMask(mask) != 0; }
+
+// Adding and subtracting 1.5 * 2^52 rounds to the nearest integer, which
+// is then in the low bits of the sum, for |a| < 2^51.
+constexpr double ROUNDING_MAGIC = 6755399441055744.0;
+template <typename V> inline V Round(V a)
+{
+    return (a + V(ROUNDING_MAGIC)) - V(ROUNDING_MAGIC);
+}
+// 2^k for integer-valued k in [-1022, 1023], built in the exponent field.
+template <typename V> inline V Pow2(V k)
+{
+    return ShiftLeft(AddInt(k + V(ROUNDING_MAGIC), 1023), 52);
+}
+// -0.0 in lanes where bit b of the integer-valued k is set, else 0.0.
+template <typename V> inline V BitAsSign(V k, int b)
+{
+    return ShiftLeft(k + V(ROUNDING_MAGIC), 63 - b) & V(-0.0);
+}
+
+constexpr double PI     = 3.14159265358979323846;
+constexpr double LN2    = 0.69314718055994530942;
+constexpr double LN2_HI = 6.93147180369123816490e-01;
+constexpr double LN2_LO = 1.90821492927058770002e-10;
+
+// e^x, within 1 ulp.
+template <typename V> inline V ExpReal(V x)
+{
+    const V k = Round(x * V(1.4426950408889634));
+    V r       = Fma(k, V(-LN2_HI), x);
+    r         = Fma(k, V(-LN2_LO), r);
+    // Taylor series to r^13 on |r| <= ln(2)/2.
+    V p = V(1.0 / 6227020800.0);
+    p   = Fma(p, r, V(1.0 / 479001600.0));
+    p   = Fma(p, r, V(1.0 / 39916800.0));
+    p   = Fma(p, r, V(1.0 / 3628800.0));
+    p   = Fma(p, r, V(1.0 / 362880.0));
+    p   = Fma(p, r, V(1.0 / 40320.0));
+    p   = Fma(p, r, V(1.0 / 5040.0));
+    p   = Fma(p, r, V(1.0 / 720.0));
+    p   = Fma(p, r, V(1.0 / 120.0));
+    p   = Fma(p, r, V(1.0 / 24.0));
+    p   = Fma(p, r, V(1.0 / 6.0));
+    p   = Fma(p, r, V(0.5));
+    p   = Fma(p, r * r, r) + V(1.0);
+    // Scaling in two steps reaches subnormal results and 2^1024.
+    const V half = Round(k * V(0.5));
+    V result     = p * Pow2(half) * Pow2(k - half);
+    result       = Select(x > V(709.782712893384), V(INFINITY), result);
+    return Select(x < V(-745.2), V(0.0), result);
+}
+
+// log x for x >= 0, within 1 ulp; the reduction and polynomial are
+// fdlibm's.
+template <typename V> inline V LogReal(V x)
+{
+    const V subnormal = x < V(DBL_MIN);
+    const V xs        = Select(subnormal, x * V(18014398509481984.0), x);
+    // The exponent, converted by placing it in the mantissa of 2^52.
+    V e = (ShiftRight(xs, 52) | V(4503599627370496.0)) -
+          V(4503599627370496.0 + 1023);
+    e   = e - (subnormal & V(54.0));
+    V m = (xs & Bits<V>(0x000fffffffffffffull)) | V(1.0);
+    const V big = m > V(1.4142135623730951);
+    m           = Select(big, m * V(0.5), m);
+    e           = e + (big & V(1.0));
+
+    const V f    = m - V(1.0);
+    const V hfsq = V(0.5) * f * f;
+    const V s    = f / (V(2.0) + f);
+    const V z    = s * s;
+    const V w    = z * z;
+    V t1         = Fma(w, V(1.531383769920937332e-01),
+                       V(2.222219843214978396e-01));
+    t1           = w * Fma(w, t1, V(3.999999999940941908e-01));
+    V t2         = Fma(w, V(1.479819860511658591e-01),
+                       V(1.818357216161805012e-01));
+    t2           = Fma(w, t2, V(2.857142874366239149e-01));
+    t2           = z * Fma(w, t2, V(6.666666666666735130e-01));
+    const V R    = t1 + t2;
+    V result     = (hfsq - (s * (hfsq + R) + e * V(LN2_LO))) - f;
+    result       = e * V(LN2_HI) - result;
+
+    result = Select(x == V(0.0), V(-INFINITY), result);
+    result = Select(x < V(0.0), V(NAN), result);
+    result = Select(x == V(INFINITY), x, result);
+    return Select(x == x, result, x);
+}
+
+// atan2(y, x), within 2 ulp, using Cephes' rational approximation of atan.
+template <typename V> inline V Atan2(V y, V x)
+{
+    const V ax = Abs(x), ay = Abs(y);
+    const V hi = Max(ax, ay), lo = Min(ax, ay);
+    V a        = Select(hi == V(0.0), V(0.0), lo / hi);
+
+    // atan(a) = pi/4 + atan((a - 1) / (a + 1))
+    const V MOREBITS = V(6.123233995736765886130e-17); // pi/2 - PIO2
+    const V big      = a > V(0.66);
+    const V t        = Select(big, (a - V(1.0)) / (a + V(1.0)), a);
+    const V z        = t * t;
+    V p              = V(-8.750608600031904122785e-01);
+    p                = Fma(p, z, V(-1.615753718733365076637e+01));
+    p                = Fma(p, z, V(-7.500855792314704667340e+01));
+    p                = Fma(p, z, V(-1.228866684490136173410e+02));
+    p                = Fma(p, z, V(-6.485021904942025371773e+01));
+    V q              = z + V(2.485846490142306297962e+01);
+    q                = Fma(q, z, V(1.650270098316988542046e+02));
+    q                = Fma(q, z, V(4.328810604912902668951e+02));
+    q                = Fma(q, z, V(4.853903996359136964868e+02));
+    q                = Fma(q, z, V(1.945506571482613964425e+02));
+    V r              = Fma(t * z, p / q, t);
+    r = (big & V(PI / 4)) + (r + (big & (V(0.5) * MOREBITS)));
+
+    r = Select(ay > ax, (V(PI / 2) - r) + MOREBITS, r);
+    r = Select(SignMask(x), (V(PI) - r) + V(1.2246467991473532e-16), r);
+    return CopySign(r, y);
+}
+
+// The largest argument the trigonometric reduction handles.
+constexpr double TRIG_LIMIT = 1e5;
+
+// sin x and cos x for |x| <= TRIG_LIMIT, within 1 ulp, reduced by a
+// three-part pi/2 and using fdlibm's kernels.
+template <typename V> inline void SinCosReal(V x, V& s, V& c)
+{
+    const V k = Round(x * V(0.63661977236758134308));
+    V r       = Fma(k, V(-1.57079632673412561417e+00), x);
+    r         = Fma(k, V(-6.07710050630396597660e-11), r);
+    r         = Fma(k, V(-2.02226624871116645580e-21), r);
+
+    const V z  = r * r;
+    V ps       = V(1.58969099521155010221e-10);
+    ps         = Fma(ps, z, V(-2.50507602534068634195e-08));
+    ps         = Fma(ps, z, V(2.75573137070700676789e-06));
+    ps         = Fma(ps, z, V(-1.98412698298579493134e-04));
+    ps         = Fma(ps, z, V(8.33333333332248946124e-03));
+    ps         = Fma(ps, z, V(-1.66666666666666324348e-01));
+    const V sr = Fma(z * r, ps, r);
+
+    V pc       = V(-1.13596475577881948265e-11);
+    pc         = Fma(pc, z, V(2.08757232129817482790e-09));
+    pc         = Fma(pc, z, V(-2.75573143513906633035e-07));
+    pc         = Fma(pc, z, V(2.48015872894767294178e-05));
+    pc         = Fma(pc, z, V(-1.38888888888741095749e-03));
+    pc         = Fma(pc, z, V(4.16666666666666019037e-02));
+    const V hz = V(0.5) * z;
+    const V w  = V(1.0) - hz;
+    const V cr = w + (((V(1.0) - w) - hz) + z * z * pc);
+
+    // Quadrant k mod 4.
+    const V odd = SignMask(BitAsSign(k, 0));
+    const V two = BitAsSign(k, 1);
+    s           = Select(odd, cr, sr) ^ two;
+    c           = Select(odd, sr, cr) ^ two ^ BitAsSign(k, 0);
+    s           = Select(x == V(0.0), x, s); // keeps the sign of zero
+}
+
+// cosh y and sinh y.
+template <typename V> inline void CoshSinhReal(V y, V& ch, V& sh)
+{
+    const V ay  = Abs(y);
+    const V e   = ExpReal(ay);
+    const V inv = V(1.0) / e;
+    ch          = V(0.5) * e + V(0.5) * inv;
+    // Below 1 the Taylor series to y^21 avoids the cancellation.
+    const V z = y * y;
+    V p       = V(1.0 / 51090942171709440000.0);
+    p         = Fma(p, z, V(1.0 / 121645100408832000.0));
+    p         = Fma(p, z, V(1.0 / 355687428096000.0));
+    p         = Fma(p, z, V(1.0 / 1307674368000.0));
+    p         = Fma(p, z, V(1.0 / 6227020800.0));
+    p         = Fma(p, z, V(1.0 / 39916800.0));
+    p         = Fma(p, z, V(1.0 / 362880.0));
+    p         = Fma(p, z, V(1.0 / 5040.0));
+    p         = Fma(p, z, V(1.0 / 120.0));
+    p         = Fma(p, z, V(1.0 / 6.0));
+    const V small = Fma(z * y, p, y);
+    sh = Select(ay < V(1.0), small,
+                CopySign(V(0.5) * e - V(0.5) * inv, y));
+}
+
+// Lanes which aren't finite, or are beyond what the kernels reduce, are
+// left to the scalar function instead.
+template <typename V> inline V Unreduced(V a)
+{
+    return Not(Abs(a) <= V(TRIG_LIMIT));
+}
+template <typename V> inline V NotFinite(V a)
+{
+    return Not(Abs(a) <= V(DBL_MAX));
+}
+// Where cosh and sinh are near overflow, and a finite product with them
+// would need more care than exp provides.
+template <typename V> inline V HyperbolicLarge(V a)
+{
+    return Not(Abs(a) <= V(700.0));
+}
+
+template <typename V> inline V ComplexExp(V x, V y, V& u, V& v)
+{
+    V s, c;
+    SinCosReal(y, s, c);
+    const V e = ExpReal(x);
+    u         = e * c;
+    v         = e * s;
+    return HyperbolicLarge(x) | Unreduced(y);
+}
+
+// a^2 = hi + lo exactly: by FMA where there is one, else by Dekker's
+// splitting. (The splitting mustn't be compiled where the compiler may fuse
+// its products.)
+template <typename V> inline void ExactSquare(V a, V& hi, V& lo)
+{
+    hi = a * a;
+    if constexpr (V::HAS_FMA)
+        lo = Fma(a, a, -hi);
+    else
+    {
+        const V t  = a * V(134217729.0); // 2^27 + 1
+        const V ah = t - (t - a);
+        const V al = a - ah;
+        lo         = ((ah * ah - hi) + V(2.0) * ah * al) + al * al;
+    }
+}
+
+// log |z| + i arg z. |z|^2 is scaled by a power of two if it would
+// overflow or underflow. Near the unit circle log |z| is log1p of
+// |z|^2 - 1, found from the exact squares.
+template <typename V> inline V ComplexLog(V x, V y, V& u, V& v)
+{
+    const V m     = Max(Abs(x), Abs(y));
+    const V large = m > V(0x1p500), small = m < V(0x1p-500);
+    const V scale =
+        Select(large, V(0x1p-600), Select(small, V(0x1p600), V(1.0)));
+    const V xs = x * scale, ys = y * scale;
+    const V r2 = Fma(xs, xs, ys * ys);
+    u = Fma(V(0.5), LogReal(r2),
+            (large & V(600 * LN2)) - (small & V(600 * LN2)));
+
+    // p^2 + q^2 - 1, with p >= q, where the subtractions are exact once the
+    // result is small: split as (p^2 - 1/2) + (q^2 - 1/2) when q^2 > 1/4.
+    V hp, lp, hq, lq;
+    ExactSquare(m, hp, lp);
+    ExactSquare(Min(Abs(x), Abs(y)), hq, lq);
+    const V both = hq > V(0.25);
+    const V t    = (Select(both, hp - V(0.5), hp - V(1.0)) +
+                 Select(both, hq - V(0.5), hq)) +
+                (lp + lq);
+    const V w  = V(1.0) + t;
+    const V l1 = Select(w == V(1.0), t, LogReal(w) * (t / (w - V(1.0))));
+    u          = Select((r2 > V(0.5)) & (r2 < V(2.0)), V(0.5) * l1, u);
+    v          = Atan2(y, x);
+    return NotFinite(x) | NotFinite(y);
+}
+
+// The principal root, computed without cancellation:
+// t = sqrt((|x| + |z|) / 2) is one part and y / 2t the other. Subnormal
+// and huge arguments are left to std::sqrt.
+template <typename V> inline V ComplexSqrt(V x, V y, V& u, V& v)
+{
+    const V ax = Abs(x), ay = Abs(y);
+    const V hi = Max(ax, ay), lo = Min(ax, ay);
+    const V q  = Select(hi == V(0.0), V(0.0), lo / hi);
+    const V r  = hi * Sqrt(Fma(q, q, V(1.0)));
+    const V t  = Sqrt(V(0.5) * (ax + r));
+    const V o  = Select(t == V(0.0), V(0.0), ay / (V(2.0) * t));
+    const V negative = x < V(0.0);
+    u                = Select(negative, o, t);
+    v                = CopySign(Select(negative, t, o), y);
+    const V tiny     = (hi < V(0x1p-1000)) & (hi > V(0.0));
+    return NotFinite(x) | NotFinite(y) | (hi > V(0x1p1020)) | tiny;
+}
+
+template <typename V> inline V ComplexSin(V x, V y, V& u, V& v)
+{
+    V s, c, ch, sh;
+    SinCosReal(x, s, c);
+    CoshSinhReal(y, ch, sh);
+    u = s * ch;
+    v = c * sh;
+    return Unreduced(x) | HyperbolicLarge(y);
+}
+
+template <typename V> inline V ComplexCos(V x, V y, V& u, V& v)
+{
+    V s, c, ch, sh;
+    SinCosReal(x, s, c);
+    CoshSinhReal(y, ch, sh);
+    u = c * ch;
+    v = -(s * sh);
+    return Unreduced(x) | HyperbolicLarge(y);
+}
+
+template <typename V> inline V ComplexSinh(V x, V y, V& u, V& v)
+{
+    V s, c, ch, sh;
+    SinCosReal(y, s, c);
+    CoshSinhReal(x, ch, sh);
+    u = sh * c;
+    v = ch * s;
+    return Unreduced(y) | HyperbolicLarge(x);
+}
+
+template <typename V> inline V ComplexCosh(V x, V y, V& u, V& v)
+{
+    V s, c, ch, sh;
+    SinCosReal(y, s, c);
+    CoshSinhReal(x, ch, sh);
+    u = ch * c;
+    v = sh * s;
+    return Unreduced(y) | HyperbolicLarge(x);
+}
+
+// tan z = (sin x cos x + i sinh y cosh y) / (cos^2 x + sinh^2 y), where the
+// denominator keeps its relative accuracy near the poles. Far from the real
+// axis the imaginary part is +-1 to double precision.
+template <typename V> inline V ComplexTan(V x, V y, V& u, V& v)
+{
+    V s, c, ch, sh;
+    SinCosReal(x, s, c);
+    CoshSinhReal(y, ch, sh);
+    const V den = Fma(c, c, sh * sh);
+    u           = s * c / den;
+    v = Select(Abs(y) > V(20.0), CopySign(V(1.0), y), sh * ch / den);
+    return Unreduced(x) | NotFinite(y);
+}
+
+// tanh z = -i tan(iz)
+template <typename V> inline V ComplexTanh(V x, V y, V& u, V& v)
+{
+    V tu, tv;
+    const V bad = ComplexTan(-y, x, tu, tv);
+    u           = tv;
+    v           = -tu;
+    return bad;
+}
+
+// exp(b log a). a = 0 is left to std::pow, whose conventions there differ
+// between libraries.
+template <typename V>
+inline V ComplexPow(V ax, V ay, V bx, V by, V& u, V& v)
+{
+    V lr, li;
+    const V bad  = ComplexLog(ax, ay, lr, li) | NotFinite(bx) | NotFinite(by);
+    const V zero = (ax == V(0.0)) & (ay == V(0.0));
+    const V x    = bx * lr - by * li;
+    const V y    = Fma(bx, li, by * lr);
+    return bad | zero | ComplexExp(x, y, u, v);
+}
+
+// a^b for real b: |a|^b (cos b arg a + i sin b arg a).
+template <typename V>
+inline V ComplexPowReal(V ax, V ay, V bx, V, V& u, V& v)
+{
+    V lr, li;
+    const V bad  = ComplexLog(ax, ay, lr, li) | NotFinite(bx);
+    const V zero = (ax == V(0.0)) & (ay == V(0.0));
+    return bad | zero | ComplexExp(bx * lr, bx * li, u, v);
+}
+
+// Runs f over the arrays a pack at a time, padding the last pack, then
+// recomputes the lanes f couldn't handle with the scalar function g.
+template <typename V, typename F, typename G>
+inline void ForEachUnary(const double* re, const double* im, double* outRe,
+                         double* outIm, size_t n, F f, G g)
+{
+    constexpr size_t N = V::N;
+    for (size_t first = 0; first < n; first += N)
+    {
+        const size_t count = n - first < N ? n - first : N;
+        double x[N] = {}, y[N] = {}, u[N], v[N];
+        for (size_t k = 0; k < count; k++)
+        {
+            x[k] = re[first + k];
+            y[k] = im[first + k];
+        }
+        V pu, pv;
+        const int bad = MoveMask(f(V::Load(x), V::Load(y), pu, pv));
+        pu.Store(u);
+        pv.Store(v);
+        for (size_t k = 0; k < count; k++)
+        {
+            if (bad & (1 << k))
+            {
+                const std::complex<double> z =
+                    g(std::complex<double>(x[k], y[k]));
+                u[k] = z.real();
+                v[k] = z.imag();
+            }
+            outRe[first + k] = u[k];
+            outIm[first + k] = v[k];
+        }
+    }
+}
+
+template <typename V, typename F, typename G>
+inline void ForEachBinary(const double* aRe, const double* aIm,
+                          const double* bRe, const double* bIm, double* outRe,
+                          double* outIm, size_t n, F f, G g)
+{
+    constexpr size_t N = V::N;
+    for (size_t first = 0; first < n; first += N)
+    {
+        const size_t count = n - first < N ? n - first : N;
+        double ax[N] = {}, ay[N] = {}, bx[N] = {}, by[N] = {}, u[N], v[N];
+        for (size_t k = 0; k < count; k++)
+        {
+            ax[k] = aRe[first + k];
+            ay[k] = aIm[first + k];
+            bx[k] = bRe[first + k];
+            by[k] = bIm[first + k];
+        }
+        V pu, pv;
+        const int bad = MoveMask(f(V::Load(ax), V::Load(ay), V::Load(bx),
+                                   V::Load(by), pu, pv));
+        pu.Store(u);
+        pv.Store(v);
+        for (size_t k = 0; k < count; k++)
+        {
+            if (bad & (1 << k))
+            {
+                const std::complex<double> z =
+                    g(std::complex<double>(ax[k], ay[k]),
+                      std::complex<double>(bx[k], by[k]));
+                u[k] = z.real();
+                v[k] = z.imag();
+            }
+            outRe[first + k] = u[k];
+            outIm[first + k] = v[k];
+        }
+    }
+}
+
+#define VECTOR_MATH_UNARY(NAME, KERNEL, SCALAR)                                \
+    template <typename V>                                                      \
+    void NAME(const double* re, const double* im, double* outRe,               \
+              double* outIm, size_t n)                                         \
+    {                                                                          \
+        ForEachUnary<V>(                                                       \
+            re, im, outRe, outIm, n,                                           \
+            [](V x, V y, V& u, V& v) { return KERNEL(x, y, u, v); },           \
+            [](std::complex<double> z) { return SCALAR(z); });                 \
+    }
+VECTOR_MATH_UNARY(VectorExp, ComplexExp, std::exp)
+VECTOR_MATH_UNARY(VectorLog, ComplexLog, std::log)
+VECTOR_MATH_UNARY(VectorSqrt, ComplexSqrt, std::sqrt)
+VECTOR_MATH_UNARY(VectorSin, ComplexSin, std::sin)
+VECTOR_MATH_UNARY(VectorCos, ComplexCos, std::cos)
+VECTOR_MATH_UNARY(VectorTan, ComplexTan, std::tan)
+VECTOR_MATH_UNARY(VectorSinh, ComplexSinh, std::sinh)
+VECTOR_MATH_UNARY(VectorCosh, ComplexCosh, std::cosh)
+VECTOR_MATH_UNARY(VectorTanh, ComplexTanh, std::tanh)
+#undef VECTOR_MATH_UNARY
+
+template <typename V>
+void VectorPow(const double* aRe, const double* aIm, const double* bRe,
+               const double* bIm, double* outRe, double* outIm, size_t n)
+{
+    ForEachBinary<V>(
+        aRe, aIm, bRe, bIm, outRe, outIm, n,
+        [](V ax, V ay, V bx, V by, V& u, V& v) {
+            return ComplexPow(ax, ay, bx, by, u, v);
+        },
+        [](std::complex<double> a, std::complex<double> b) {
+            return std::pow(a, b);
+        });
+}
+
+template <typename V>
+void VectorPowReal(const double* aRe, const double* aIm, const double* bRe,
+                   const double* bIm, double* outRe, double* outIm, size_t n)
+{
+    ForEachBinary<V>(
+        aRe, aIm, bRe, bIm, outRe, outIm, n,
+        [](V ax, V ay, V bx, V by, V& u, V& v) {
+            return ComplexPowReal(ax, ay, bx, by, u, v);
+        },
+        [](std::complex<double> a, std::complex<double> b) {
+            return std::pow(a, b.real());
+        });
+}
+
+template <typename V> VectorMath MakeVectorMath(const char* name)
+{
+    VectorMath M;
+    M.name = name;
+    M.exp  = VectorExp<V>;
+    M.log  = VectorLog<V>;
+    M.sqrt = VectorSqrt<V>;
+    M.sin  = VectorSin<V>;
+    M.cos  = VectorCos<V>;
+    M.tan  = VectorTan<V>;
+    M.sinh = VectorSinh<V>;
+    M.cosh = VectorCosh<V>;
+    M.tanh = VectorTanh<V>;
+    M.pow  = VectorPow<V>;
+    M.powr = VectorPowReal<V>;
+    return M;
+}
+
+} // namespace
@@ -1,176 +1,520 @@
 #pragma once
 
-#include <array>
-#include <boost/multiprecision/cpp_bin_float.hpp>
-#include <boost/multiprecision/cpp_int.hpp>
+#include <algorithm>
+#include <cmath>
 #include <complex>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-using int128_t   = boost::multiprecision::int128_t;
-using float128_t = boost::multiprecision::cpp_bin_float_quad;
+// The Riemann zeta function, accurate to about double precision anywhere in
+// the plane. Each point uses whichever method is cheapest there:
+//
+//  - Re s > 10.5: the Dirichlet series itself, which needs at most about 60
+//    terms that far right.
+//  - |Im s| >= ZETA_RS_HEIGHT, within 10 of the critical line:
+//    Riemann-Siegel. zeta(s) = R(s) + chi(s) conj(R(1 - conj(s))), where
+//    R(s) is the first sqrt(|Im s| / 2pi) terms of the series plus an
+//    integral along the line of steepest descent through the saddle point,
+//    which the trapezoid rule does very accurately. The cost grows as
+//    sqrt(|Im s|), not |Im s|.
+//  - Elsewhere: Euler-Maclaurin summation, with Re s < 0 first reflected by
+//    the functional equation.
+//
+// n^-s is always exp(-s log n), with log n from a table built once. Use
+// zeta_batch() for many points at once; it runs the series for all of them
+// together, which vectorizes.
 
-// Constexpr integer power function
-template <typename T> constexpr long long int ipow(T num, unsigned int exp)
+constexpr double ZETA_EPS            = 1e-17;
+constexpr double ZETA_RS_HEIGHT      = 400;
+constexpr double ZETA_RS_BAND        = 10; // Around Re s = 1/2.
+constexpr size_t ZETA_LOG_TABLE_SIZE = 1 << 16;
+constexpr size_t ZETA_BATCH          = 64;
+
+// log n for n < ZETA_LOG_TABLE_SIZE.
+inline const double* ZetaLogTable()
 {
-    if (exp >= sizeof(T) * 8)
-        return 0;
-    else if (exp == 0)
-        return 1;
-    else
-        return num * ipow(num, exp - 1);
+    static const std::vector<double> table = [] {
+        std::vector<double> t(ZETA_LOG_TABLE_SIZE);
+        for (size_t n = 1; n < ZETA_LOG_TABLE_SIZE; n++)
+            t[n] = std::log((double)n);
+        return t;
+    }();
+    return table.data();
 }
 
-constexpr int ZETA_TERMS = 32;
+inline double ZetaLog(size_t n)
+{
+    return n < ZETA_LOG_TABLE_SIZE ? ZetaLogTable()[n] : std::log((double)n);
+}
+
+// B(2k) for k = 1 to 15.
+constexpr double ZETA_BERNOULLI[] = {
+    1.0 / 6,
+    -1.0 / 30,
+    1.0 / 42,
+    -1.0 / 30,
+    5.0 / 66,
+    -691.0 / 2730,
+    7.0 / 6,
+    -3617.0 / 510,
+    43867.0 / 798,
+    -174611.0 / 330,
+    854513.0 / 138,
+    -236364091.0 / 2730,
+    8553103.0 / 6,
+    -23749461029.0 / 870,
+    8615841276005.0 / 14322,
+};
+constexpr int ZETA_EM_ORDER = 15;
+
+// log Gamma(z), up to a multiple of 2 pi i. Only used away from the poles.
+inline std::complex<double> ZetaLogGamma(std::complex<double> z)
+{
+    typedef std::complex<double> C;
+    C shift      = 1;
+    bool shifted = false;
+    while (std::abs(z) < 15)
+    {
+        shift *= z;
+        z += 1.0;
+        shifted = true;
+    }
+    C r      = 1.0 / z;
+    C r2     = r * r;
+    C series = 0;
+    for (int k = 8; k >= 1; k--)
+        series = series * r2 + ZETA_BERNOULLI[k - 1] / (2.0 * k * (2 * k - 1));
+    C lg = (z - 0.5) * std::log(z) - z + 0.5 * std::log(2 * M_PI) + series * r;
+    return shifted ? lg - std::log(shift) : lg;
+}
+
+// Gamma'(z) / Gamma(z).
+inline std::complex<double> ZetaDigamma(std::complex<double> z)
+{
+    typedef std::complex<double> C;
+    C shift = 0;
+    while (std::abs(z) < 15)
+    {
+        shift += 1.0 / z;
+        z += 1.0;
+    }
+    C r      = 1.0 / z;
+    C r2     = r * r;
+    C series = 0;
+    for (int k = 8; k >= 1; k--)
+        series = series * r2 + ZETA_BERNOULLI[k - 1] / (2.0 * k);
+    return std::log(z) - 0.5 * r - series * r2 - shift;
+}
 
-// Based on Borwein's algorithm 2.
-template <typename T> constexpr T d_k(long n, long k)
+// chi(s) = 2^s pi^(s-1) sin(pi s / 2) Gamma(1 - s), so that
+// zeta(s) = chi(s) zeta(1 - s), and optionally chi'(s). Im s >= 0.
+inline std::complex<double> ZetaChi(std::complex<double> s,
+                                    std::complex<double>* deriv = nullptr)
 {
-    T res = 1;
-    for (long i = 1; i <= k; i++)
+    typedef std::complex<double> C;
+    const C I(0, 1);
+    const C w = M_PI / 2 * s;
+    if (s.imag() < 1)
     {
-        T fac = 1;
-        for (long j = 1; j < 2 * i; j++)
+        // Small enough to multiply out, which keeps the zeros at the
+        // negative even integers exact.
+        C a   = std::exp(s * std::log(2 * M_PI) + ZetaLogGamma(1.0 - s)) / M_PI;
+        C chi = a * std::sin(w);
+        if (deriv)
         {
-            fac *= (n - i + j) * 2.0 / j;
+            C da   = a * (std::log(2 * M_PI) - ZetaDigamma(1.0 - s));
+            *deriv = da * std::sin(w) + a * (M_PI / 2) * std::cos(w);
         }
-        res += fac;
+        return chi;
+    }
+    // sin(w) = e^-iw (e^2iw - 1) / 2i, where e^-iw is huge and e^2iw tiny.
+    C e2     = std::exp(2.0 * I * w);
+    C logChi = s * std::log(2 * M_PI) - std::log(M_PI) - I * w +
+               std::log((e2 - 1.0) / (2.0 * I)) + ZetaLogGamma(1.0 - s);
+    C chi    = std::exp(logChi);
+    if (deriv)
+    {
+        C cot  = I * (e2 + 1.0) / (e2 - 1.0);
+        *deriv = chi * (std::log(2 * M_PI) + M_PI / 2 * cot -
+                        ZetaDigamma(1.0 - s));
     }
+    return chi;
+}
 
-    return n * res;
+// sum[k] += n^-w[k] for n = 1 to terms[k], for count values of w, given as
+// real and imaginary parts. Runs across the points, so that it vectorizes.
+inline void ZetaPartialSums(const double* wr, const double* wi,
+                            const size_t* terms, size_t count, double* sumRe,
+                            double* sumIm)
+{
+    size_t most = 0;
+    for (size_t k = 0; k < count; k++)
+        most = std::max(most, terms[k]);
+    for (size_t n = 1; n <= most; n++)
+    {
+        const double L = ZetaLog(n);
+        for (size_t k = 0; k < count; k++)
+        {
+            const double m = std::exp(-wr[k] * L);
+            const double c = std::cos(wi[k] * L);
+            const double s = std::sin(wi[k] * L);
+            const bool on  = n <= terms[k];
+            sumRe[k] += on ? m * c : 0.0;
+            sumIm[k] -= on ? m * s : 0.0;
+        }
+    }
 }
 
-template <typename T> constexpr T zetaCoeff(int j)
+// The same for one point, with the derivative -sum log(n) n^-w as well.
+inline std::complex<double> ZetaPartialSum(std::complex<double> w,
+                                           size_t terms,
+                                           std::complex<double>& deriv)
 {
-    T res = d_k<T>(ZETA_TERMS, j) - d_k<T>(ZETA_TERMS, ZETA_TERMS);
+    std::complex<double> sum = 0;
+    deriv                    = 0;
+    for (size_t n = 1; n <= terms; n++)
+    {
+        const double L         = ZetaLog(n);
+        std::complex<double> t = std::exp(-w * L);
+        sum += t;
+        deriv -= L * t;
+    }
+    return sum;
+}
 
-    if (j % 2) return -res;
-    return res;
+enum class ZetaMethod
+{
+    direct,
+    eulerMaclaurin,
+    riemannSiegel,
+};
+
+// How one point is evaluated: at s, after taking the conjugate and
+// reflecting as needed, from partial sums of n^-w[j] for n = 1 to terms[j].
+struct ZetaPlan
+{
+    ZetaMethod method = ZetaMethod::direct;
+    bool conjugated   = false; // Im s was negative.
+    bool reflected    = false; // zeta(s) = chi(s) zeta(1 - s).
+    std::complex<double> s;
+    std::complex<double> w[2];
+    size_t terms[2]   = {0, 0};
+    unsigned int sums = 1;
+};
+
+inline ZetaPlan ZetaPlanFor(std::complex<double> s)
+{
+    ZetaPlan p;
+    if (s.imag() < 0)
+    {
+        s            = std::conj(s);
+        p.conjugated = true;
+    }
+    const bool rs =
+        s.imag() >= ZETA_RS_HEIGHT && std::abs(s.real() - 0.5) <= ZETA_RS_BAND;
+    if (s.real() < 0 && !rs)
+    {
+        s           = 1.0 - s;
+        p.reflected = true;
+    }
+    p.s    = s;
+    p.w[0] = s;
+
+    const double sigma = s.real();
+    if (sigma > 0.5 + ZETA_RS_BAND)
+    {
+        // The tail after N terms is below N^(1-sigma) / (sigma-1).
+        p.method   = ZetaMethod::direct;
+        p.terms[0] = (size_t)std::ceil(
+            std::pow(ZETA_EPS * (sigma - 1), 1 / (1 - sigma)));
+    }
+    else if (rs)
+    {
+        p.method   = ZetaMethod::riemannSiegel;
+        p.sums     = 2;
+        p.w[1]     = 1.0 - std::conj(s);
+        p.terms[0] = p.terms[1] =
+            (size_t)std::floor(std::sqrt(s.imag() / (2 * M_PI)));
+    }
+    else
+    {
+        // The corrections shrink by about (|s| / 2 pi N)^2 each, so
+        // ZETA_EM_ORDER of them are enough once N is about |s| / 2.
+        p.method   = ZetaMethod::eulerMaclaurin;
+        p.terms[0] = (size_t)std::ceil(0.55 * std::abs(s)) + 10;
+    }
+    return p;
 }
 
-template <typename T, int N> struct zeta_coeff_table
+// Euler-Maclaurin from the sum of the first N-1 terms.
+inline std::complex<double> ZetaEulerMaclaurin(std::complex<double> s,
+                                               size_t N,
+                                               std::complex<double> sum,
+                                               std::complex<double> dsum,
+                                               std::complex<double>* deriv)
 {
-    constexpr zeta_coeff_table() : values()
+    typedef std::complex<double> C;
+    const double L = ZetaLog(N);
+    const C x      = std::exp(-s * L); // N^-s
+    const C head   = (double)N * x / (s - 1.0);
+    C z  = sum + head + 0.5 * x;
+    C dz = dsum - L * head - head / (s - 1.0) - 0.5 * L * x;
+
+    // B(2k) / (2k)! s (s+1) ... (s+2k-2) N^(-s-2k+1)
+    C poly = s, dpoly = 1;
+    C power     = x / (double)N;
+    double fact = 2;
+    for (int k = 1; k <= ZETA_EM_ORDER; k++)
     {
-        for (auto i = 0; i < N; ++i)
+        const double c = ZETA_BERNOULLI[k - 1] / fact;
+        const C term   = c * poly * power;
+        const C dterm  = c * (dpoly - L * poly) * power;
+        z += term;
+        dz += dterm;
+        if (std::abs(term) <= ZETA_EPS * std::abs(z) &&
+            std::abs(dterm) <= ZETA_EPS * std::abs(dz))
+            break;
+        const C a = s + (2.0 * k - 1), b = s + 2.0 * k;
+        dpoly     = dpoly * a * b + poly * (a + b);
+        poly *= a * b;
+        power /= (double)N * N;
+        fact *= (2.0 * k + 1) * (2.0 * k + 2);
+    }
+    if (deriv) *deriv = dz;
+    return z;
+}
+
+constexpr double ZETA_RS_STEP = 1.0 / 12;
+constexpr int ZETA_RS_POINTS  = 73; // Out to 3 either side.
+
+// Trapezoid weights for the Riemann-Siegel integrals, which only depend on
+// the distance r along the line: e^(-pi r^2) / cos(pi r e^(i pi/4)).
+struct ZetaRSWeights
+{
+    double r[ZETA_RS_POINTS];
+    double re[ZETA_RS_POINTS];
+    double im[ZETA_RS_POINTS];
+};
+
+inline const ZetaRSWeights& ZetaRiemannSiegelWeights()
+{
+    static const ZetaRSWeights weights = [] {
+        ZetaRSWeights W;
+        const std::complex<double> omega = std::polar(1.0, M_PI / 4);
+        for (int j = 0; j < ZETA_RS_POINTS; j++)
         {
-            values[i] = zetaCoeff<T>(i);
+            const double r = (j - ZETA_RS_POINTS / 2) * ZETA_RS_STEP;
+            std::complex<double> k =
+                std::exp(-M_PI * r * r) / std::cos(M_PI * r * omega);
+            W.r[j]  = r;
+            W.re[j] = k.real();
+            W.im[j] = k.imag();
         }
+        return W;
+    }();
+    return weights;
+}
+
+// The Riemann-Siegel integrals of x^-w e^(pi i x^2) / (e^(pi i x) -
+// e^(-pi i x)) for w[0] = s and w[1] = 1 - conj(s), and optionally their
+// derivatives. They're taken from upper right to lower left along the line
+// x = N + 1/2 + r e^(i pi/4), which passes close to the saddle point at
+// sqrt(Im s / 2 pi). Along it the integrand falls off like e^(-2 pi r^2),
+// and the nearest poles are 1 / (2 sqrt 2) from it, which sets the step.
+inline void ZetaRiemannSiegelIntegrals(const std::complex<double>* w,
+                                       size_t N, std::complex<double>* out,
+                                       std::complex<double>* deriv)
+{
+    typedef std::complex<double> C;
+    constexpr int P        = ZETA_RS_POINTS;
+    const ZetaRSWeights& W = ZetaRiemannSiegelWeights();
+    const double c         = N + 0.5;
+    const double a         = M_SQRT2 * M_PI * c;
+
+    // log x, relative to log c.
+    double lr[P], la[P];
+    for (int j = 0; j < P; j++)
+    {
+        const double xr = 1 + W.r[j] * M_SQRT1_2 / c;
+        const double xi = W.r[j] * M_SQRT1_2 / c;
+        lr[j]           = 0.5 * std::log(xr * xr + xi * xi);
+        la[j]           = std::atan2(xi, xr);
     }
-    T values[N];
-};
+    const double logc = std::log(c);
 
-template <typename T> T zeta(T s)
+    for (int i = 0; i < 2; i++)
+    {
+        // e^(pi i x^2) is e^(i pi/4) e^(sqrt2 pi c r (i - 1)) e^(-pi r^2),
+        // and the last part is in the weights.
+        const double wr = w[i].real(), wi = w[i].imag();
+        double sr = 0, si = 0, dr = 0, di = 0;
+        for (int j = 0; j < P; j++)
+        {
+            const double er = -a * W.r[j] - wr * lr[j] + wi * la[j];
+            const double ei = a * W.r[j] - wr * la[j] - wi * lr[j];
+            const double m  = std::exp(er);
+            const double fr = m * std::cos(ei), fi = m * std::sin(ei);
+            const double gr = fr * W.re[j] - fi * W.im[j];
+            const double gi = fr * W.im[j] + fi * W.re[j];
+            sr += gr;
+            si += gi;
+            if (deriv)
+            {
+                dr -= lr[j] * gr - la[j] * gi;
+                di -= lr[j] * gi + la[j] * gr;
+            }
+        }
+        // dx = e^(i pi/4) dr, the denominator is 2i (-1)^N cos(pi r
+        // e^(i pi/4)), and the direction is backwards, so with e^(i pi/4)
+        // from e^(pi i c^2) the factor is -i/2i = -1/2.
+        const C scale =
+            -0.5 * ZETA_RS_STEP * (N % 2 ? -1.0 : 1.0) * std::exp(-w[i] * logc);
+        out[i] = scale * C(sr, si);
+        if (deriv) deriv[i] = scale * (C(dr, di) - logc * C(sr, si));
+    }
+}
+
+// zeta(p.s), and its derivative, from the partial sums the plan asked for.
+inline std::complex<double> ZetaFinish(const ZetaPlan& p,
+                                       const std::complex<double>* sums,
+                                       const std::complex<double>* dsums,
+                                       std::complex<double>* deriv)
 {
-    typedef std::complex<long double> U;
-    U res = 0;
-    U z   = s;
+    typedef std::complex<double> C;
+    const C s = p.s;
+    C z, dz;
+    switch (p.method)
+    {
+    case ZetaMethod::direct:
+        z  = sums[0];
+        dz = dsums ? dsums[0] : C();
+        break;
+    case ZetaMethod::eulerMaclaurin:
+    {
+        // terms[0] is N, but the method wants the sum to N - 1.
+        const C last  = std::exp(-s * ZetaLog(p.terms[0]));
+        const C dlast = -ZetaLog(p.terms[0]) * last;
+        z = ZetaEulerMaclaurin(s, p.terms[0], sums[0] - last,
+                               dsums ? dsums[0] - dlast : C(),
+                               deriv ? &dz : nullptr);
+        break;
+    }
+    case ZetaMethod::riemannSiegel:
+    {
+        C R[2], dR[2];
+        ZetaRiemannSiegelIntegrals(p.w, p.terms[0], R, deriv ? dR : nullptr);
+        for (int i = 0; i < 2; i++)
+        {
+            R[i] += sums[i];
+            if (deriv) dR[i] += dsums[i];
+        }
+        C dchi;
+        const C chi = ZetaChi(s, deriv ? &dchi : nullptr);
+        z  = R[0] + chi * std::conj(R[1]);
+        dz = dR[0] + dchi * std::conj(R[1]) - chi * std::conj(dR[1]);
+        break;
+    }
+    }
+
+    if (p.reflected)
+    {
+        // Evaluated at 1 - s.
+        C dchi;
+        const C chi = ZetaChi(1.0 - s, deriv ? &dchi : nullptr);
+        dz          = dchi * z - chi * dz;
+        z           = chi * z;
+    }
+    if (p.conjugated)
+    {
+        z  = std::conj(z);
+        dz = std::conj(dz);
+    }
+    if (deriv) *deriv = dz;
+    return z;
+}
 
-    static constexpr auto zCoeff = zeta_coeff_table<long double, ZETA_TERMS>();
-    static constexpr auto d_n    = d_k<long double>(ZETA_TERMS, ZETA_TERMS);
+// zeta(s) and zeta'(s) at one point.
+inline std::complex<double> ZetaEval(std::complex<double> s,
+                                     std::complex<double>* deriv = nullptr)
+{
+    const ZetaPlan p = ZetaPlanFor(s);
+    std::complex<double> sums[2], dsums[2];
+    for (unsigned int j = 0; j < p.sums; j++)
+    {
+        if (deriv)
+            sums[j] = ZetaPartialSum(p.w[j], p.terms[j], dsums[j]);
+        else
+        {
+            double re = 0, im = 0;
+            const double wr = p.w[j].real(), wi = p.w[j].imag();
+            ZetaPartialSums(&wr, &wi, &p.terms[j], 1, &re, &im);
+            sums[j] = {re, im};
+        }
+    }
+    return ZetaFinish(p, sums, deriv ? dsums : nullptr, deriv);
+}
 
-    for (int i = 0; i < ZETA_TERMS; i++)
+// out[k] = zeta(s[k]) for k < n. The same values as zeta(), computed
+// together.
+inline void zeta_batch(const std::complex<double>* s, std::complex<double>* out,
+                       size_t n)
+{
+    constexpr size_t B = ZETA_BATCH;
+    ZetaPlan plans[B];
+    double wr[2 * B], wi[2 * B], sr[2 * B], si[2 * B];
+    size_t terms[2 * B];
+    for (size_t first = 0; first < n; first += B)
     {
-        res += (U)zCoeff.values[i] / pow(i + 1.0, z);
+        const size_t count = std::min(B, n - first);
+        size_t m           = 0;
+        for (size_t k = 0; k < count; k++)
+        {
+            plans[k] = ZetaPlanFor(s[first + k]);
+            for (unsigned int j = 0; j < plans[k].sums; j++, m++)
+            {
+                wr[m]    = plans[k].w[j].real();
+                wi[m]    = plans[k].w[j].imag();
+                terms[m] = plans[k].terms[j];
+                sr[m] = si[m] = 0;
+            }
+        }
+        ZetaPartialSums(wr, wi, terms, m, sr, si);
+        m = 0;
+        for (size_t k = 0; k < count; k++)
+        {
+            std::complex<double> sums[2];
+            for (unsigned int j = 0; j < plans[k].sums; j++, m++)
+                sums[j] = {sr[m], si[m]};
+            out[first + k] = ZetaFinish(plans[k], sums, nullptr, nullptr);
+        }
     }
-    res *=
-        (U)-1.0 / (d_n * ((U)1 - pow(static_cast<long double>(2), (U)1 - z)));
+}
 
+template <typename T> T zeta(T s)
+{
     if constexpr (std::is_floating_point_v<T>)
-        return (T)res.real();
+        return (T)ZetaEval(std::complex<double>(s)).real();
     else
-        return (T)res;
+    {
+        auto z = ZetaEval(std::complex<double>(s.real(), s.imag()));
+        return T(z.real(), z.imag());
+    }
 }
 
-// Same but using float_128_t. Slow.
-
-// template <typename T> T zeta(T s)
-//{
-//    typedef std::complex<float128_t> U;
-//    U res{0, 0};
-//    U z;
-//    if constexpr (std::is_arithmetic_v<T>)
-//        z = s;
-//    else
-//        z = U{s.real(), s.imag()};
-//
-//    static auto zCoeff = zeta_coeff_table<float128_t, ZETA_PRECISION>();
-//    static auto d_n    = d_k<float128_t>(ZETA_PRECISION, ZETA_PRECISION);
-//
-//    for (int i = 0; i < ZETA_PRECISION; i++)
-//    {
-//        res += (U)zCoeff.values[i] / (U)pow(static_cast<double>(i + 1.0), s);
-//    }
-//    res *= (U)-1.0 / (d_n * ((U)1 - (U)pow(2.0, (std::complex<double>)1 -
-//    s))); if constexpr (std::is_arithmetic_v<T>)
-//        return (T)res.real();
-//    else
-//        return T{static_cast<double>(res.real()),
-//                 static_cast<double>(res.imag())};
-//    ;
-//}
-
-// Based on Borwein's Algorithm 3. Has some problems with diverging from
-// The correct value near the negative real axis, but seems to do better than
-// algorithm 2 on the critical line.
-
-// template <typename T> constexpr T binomCoeff(int n, int k)
-//{
-//    T res = 1;
-//    for (int i = 1; i < k; i++)
-//    {
-//        res *= n + 1 - i;
-//        res /= i;
-//    }
-//    return res;
-//}
-
-// constexpr long double zetaCoeff(int j)
-//{
-//    long double res = -1;
-//    if (j > ZETA_PRECISION)
-//    {
-//        int last = j - ZETA_PRECISION;
-//
-//        for (int k = 0; k <= last; k++)
-//        {
-//            res += static_cast<long double>(
-//                static_cast<float128_t>(binomCoeff<int128_t>(ZETA_PRECISION,
-//                k)) / static_cast<float128_t>(pow(2, ZETA_PRECISION)));
-//        }
-//    }
-//    if (j % 2)
-//        return -res;
-//    return res;
-//}
-//
-// template <int N> struct zeta_coeff_table
-//{
-//    constexpr zeta_coeff_table() : values()
-//    {
-//        for (auto i = 0; i < N; ++i)
-//        {
-//            values[i] = zetaCoeff(i);
-//        }
-//    }
-//    long double values[N];
-//};
-//
-// template <typename T> T zeta(T s)
-//{
-//    typedef std::complex<long double> U;
-//    U res              = 0;
-//    U z                = s;
-//    constexpr int last = 2 * ZETA_PRECISION - 1;
-//
-//    static auto zCoeff = zeta_coeff_table<last>();
-//
-//    for (int i = 0; i < last; i++)
-//    {
-//        res += (U)zCoeff.values[i] / pow(i + 1.0, z);
-//    }
-//    res *= (U)-1.0 / ((U)1 - pow(static_cast<long double>(2), (U)1 - z));
-//
-//    if constexpr (std::is_floating_point_v<T>)
-//        return (T)res.real();
-//    else
-//        return (T)res;
-//}
\ No newline at end of file
+// zeta(s) and zeta'(s).
+template <typename T> std::pair<T, T> zeta_with_derivative(T s)
+{
+    std::complex<double> d;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        auto z = ZetaEval(std::complex<double>(s), &d);
+        return {(T)z.real(), (T)d.real()};
+    }
+    else
+    {
+        auto z = ZetaEval(std::complex<double>(s.real(), s.imag()), &d);
+        return {T(z.real(), z.imag()), T(d.real(), d.imag())};
+    }
+}
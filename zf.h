@@ -1,9 +1,14 @@
 #pragma once
 #include <complex>
 #include <vector>
-#include <unordered_map>
 #include <functional>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <memory>
 //#include <execution>
 
 // Algorithm due to Piotr Kowalczyk,
@@ -27,14 +32,18 @@
 //
 // ULcorner, LRcorner : Upper-left and lower-right corners of the 
 //		rectangular search region.
-// precision: Final length of mesh edges will be less than this.
+// precision: Final length of mesh edges will be less than this, unless the
+//		results are polished instead (see options::mesh_precision).
 // f: Any analytic function.
 // initial_mesh_len: starting length of mesh edges. Smaller is less likely 
 //		to miss a zero, but slower. -1 (default) means the function will
 //		try to choose something appropriate.
 // edge_limit: If the function ever generates more edges than this number,
-// it throws an exception. Default is 50000. Set to 0 to disable and risk 
+// it throws an exception. Default is 500000. Set to 0 to disable and risk 
 // letting memory usage explode.
+// opts (optional, second overload): see options, below. A batch evaluator
+//		for the initial mesh, a flag to cancel the search from another
+//		thread, and a callback for the results of each refinement.
 //
 // Returns:
 // vector of results for each point. first is the location of the zero/pole,
@@ -55,9 +64,8 @@
 // the standard math operations, as well as real(), imag(), and arg().
 // The underlying data type should support comparison operations, standard 
 // math operations, and some common math functions: sin(), atan(), log(), abs(), 
-// trunc(). It also requires a specialization of std::hash, which can be defined
-// by the user if it doesn't exist. Some of these requirements could be eased
-// in the future.
+// trunc(), as well as conversion to long long. Some of these requirements
+// could be eased in the future.
 //
 // So far the algorithm has been tested with std::complex<double>,
 // std::complex<boost::multiprecision::number<boost::multiprecision
@@ -67,14 +75,80 @@ namespace zf
 {
 	template <class cplx> struct get_param;
 
+	// Sets out[i] = f(in[i]) for i < n.
+	template <class cplx>
+	using batch_function = std::function<void(const cplx*, cplx*, size_t)>;
+
+	// Optional extras for solve().
+	template <class cplx>
+	struct options
+	{
+		// Evaluates f at many points in one call. The initial mesh is
+		// evaluated through it all at once, so it can run in parallel or
+		// vectorized.
+		batch_function<cplx> batch_f;
+		// When set, e.g. from another thread, solve() stops at its next
+		// refinement step and throws cancelled.
+		const std::atomic<bool>* cancel = nullptr;
+		// Called with the zeros and poles as estimated after each
+		// refinement but the last, whose results solve() returns.
+		std::function<void(const std::vector<std::pair<cplx, int>>&)>
+			progress;
+		// When coarser than the requested precision, the mesh is only
+		// refined to this, and each zero and pole is then polished to the
+		// requested precision: by Newton's method with df if it is set, by
+		// Muller's method on f otherwise, on 1/f for poles. The orders from
+		// the mesh set the steps for multiple zeros and poles. Far fewer
+		// refinements are needed this way, though zeros and poles closer
+		// together than mesh_precision come out as one.
+		typename get_param<cplx>::type mesh_precision = 0;
+		// Returns f(z) and f'(z).
+		std::function<std::pair<cplx, cplx>(cplx)> df;
+	};
+
+	// Thrown by solve() when options::cancel is set.
+	struct cancelled : std::exception
+	{
+		const char* what() const noexcept override
+		{
+			return "Zero finder cancelled.";
+		}
+	};
+
+	template<typename cplx>
+	inline std::vector<std::pair<cplx, int>>
+		solve(cplx ULcorner, cplx LRcorner,
+			typename get_param<cplx>::type precision,
+			std::function<cplx(cplx)> f,
+			typename get_param<cplx>::type initial_mesh_len
+			= typename get_param<cplx>::type(-1.0),
+			int edge_limit = 500000);
+
 	template<typename cplx>
 	inline std::vector<std::pair<cplx, int>>
 		solve(cplx ULcorner, cplx LRcorner,
 			typename get_param<cplx>::type precision,
 			std::function<cplx(cplx)> f,
+			const options<cplx>& opts,
 			typename get_param<cplx>::type initial_mesh_len
 			= typename get_param<cplx>::type(-1.0),
-			int edge_limit = 50000);
+			int edge_limit = 500000);
+
+	// Follows zeros and poles from where solve() or a previous track() left
+	// them, after f has changed a little, e.g. between animation frames or
+	// for a slightly moved region. df(z) returns f(z) and f'(z). Each point
+	// in the region is moved by Newton's method, on 1/f for poles, and kept
+	// if f winds around zero its order times on a small circle around it.
+	// Points outside the region are dropped. Returns false, leaving points
+	// unchanged, if a point is lost or merges with another, if a point of
+	// order zero is in the region, or if the winding of f around the
+	// region's boundary doesn't match the orders of the points inside, i.e.
+	// some have entered, left or appeared. Only solve() can find them then.
+	template<typename cplx>
+	inline bool track(cplx ULcorner, cplx LRcorner,
+		std::function<cplx(cplx)> f,
+		std::function<std::pair<cplx, cplx>(cplx)> df,
+		std::vector<std::pair<cplx, int>>& points);
 
 	template <typename>
 	class Mesh;
@@ -120,6 +194,17 @@ namespace zf
 		typedef decltype(real(C)) type;
 	};
 
+	// Position of a node on an integer lattice finer than the mesh's finest
+	// refinement level. See Mesh::gen_key().
+	struct LatticeKey
+	{
+		long long x, y;
+		bool operator==(const LatticeKey& k) const
+		{
+			return x == k.x && y == k.y;
+		}
+	};
+
 	// Node for a trianglular mesh of complex numbers. Each node can have up to six
 	// connections to other nodes, represented by Edges.
 	template <typename cplx>
@@ -127,8 +212,15 @@ namespace zf
 	{
 	public:
 		Node(cplx loc, cplx val);
+		// Leaves the quadrant to be set by calc_q().
+		explicit Node(cplx loc);
 		cplx location; // Geometric location of node
-		int q = 0; // Quadrant of value
+		LatticeKey key = {}; // Location in the mesh's node table
+		std::int8_t q = 0; // Quadrant of value
+
+		// q of a value with no argument, i.e. NaN. Edges to the node are
+		// never candidates.
+		static constexpr std::int8_t NO_QUADRANT = INT8_MIN;
 
 		Edge<cplx>* get_edge(int dir);
 		void set_edge(Edge<cplx>* e, int dir);
@@ -185,8 +277,10 @@ namespace zf
 		// Triangles are only needed after adapt_mesh().
 		// tris[0] should be triangle on left side.
 		Triangle<cplx>* tris[2] = {};
-		int direction; // See enum Direction for meaning of values. 
-		int dq = 0; // Difference in quadrant of value for this edge's nodes.
+		// See enum Direction for meaning of values. 
+		std::int8_t direction;
+		// Difference in quadrant of value for this edge's nodes.
+		std::int8_t dq = 0;
 	};
 
 	// Triangles for finding boundary regions. Not used for constructing or
@@ -211,20 +305,66 @@ namespace zf
 	private:
 		Edge<cplx>* edges[3];
 	};
-};
-namespace std
-{
-	template <typename data_t>
-	class hash<std::complex<data_t>> {
+
+	// Arena for the mesh's nodes, edges and triangles. Objects are allocated
+	// from blocks of BLOCK_SIZE, and released ones are reused by later
+	// allocations rather than returned to the heap, so culling the mesh
+	// after each adapt iteration makes room for the next one. The pool
+	// doesn't track which objects are live: any that haven't been released
+	// when it is destroyed must be destroyed by its owner first.
+	template <typename T>
+	class Pool
+	{
 	public:
-		size_t operator()(const std::complex<data_t>& k) const
+		Pool() = default;
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		template <typename... Args>
+		T* make(Args&&... args);
+		// Destroys obj and keeps its memory for reuse.
+		void release(T* obj);
+
+		static constexpr size_t BLOCK_SIZE = 1024;
+	private:
+		union Slot
 		{
-			return hash<data_t>()(real(k)) ^ hash<data_t>()(imag(k));
-		}
+			Slot* next;
+			alignas(T) unsigned char object[sizeof(T)];
+		};
+		std::vector<std::unique_ptr<Slot[]>> blocks;
+		size_t used = BLOCK_SIZE; // Slots handed out from the last block
+		Slot* free_list = nullptr;
 	};
-};
-namespace zf
-{
+
+	// Open-addressing hash table of the mesh's nodes by their keys, with
+	// linear probing. The capacity is a power of two, and the table is kept
+	// at most half full.
+	template <typename cplx>
+	class NodeTable
+	{
+	public:
+		// The node with key, or nullptr if there isn't one.
+		Node<cplx>* find(const LatticeKey& key) const;
+		// Adds node, which must not have the same key as one in the table.
+		void insert(Node<cplx>* node);
+		// Makes room for count nodes without rehashing.
+		void reserve(size_t count);
+		// Removes the nodes for which pred(node) is true, and shrinks the
+		// table to fit the rest.
+		template <typename Pred>
+		void remove_if(Pred pred);
+		// Calls visit(node) for every node.
+		template <typename Visit>
+		void for_each(Visit visit) const;
+	private:
+		static size_t hash(const LatticeKey& key);
+		void rehash(size_t capacity);
+
+		std::vector<Node<cplx>*> slots;
+		size_t count = 0;
+	};
+
 	template <typename cplx>
 	class Mesh
 	{
@@ -235,8 +375,14 @@ namespace zf
 			typename get_param<cplx>::type init_prec,
 			typename get_param<cplx>::type final_prec,
 			std::function<cplx(cplx)> func,
-			int edge_limit = 0);
-
+			int edge_limit = 0,
+			batch_function<cplx> batch_f = nullptr,
+			const std::atomic<bool>* cancel = nullptr);
+		~Mesh();
+		Mesh(const Mesh&) = delete;
+		Mesh& operator=(const Mesh&) = delete;
+
+		// Returns the node at location, creating it if there isn't one.
 		Node<cplx>* insert_node(cplx location);
 
 		// Creates a get_node at the midpoint of this edge. Chosen edge will run
@@ -263,6 +409,10 @@ namespace zf
 		// or a zero/pole pair).
 		std::vector<std::pair<cplx, int>> find_zeros_and_poles();
 
+		// Removes the triangles find_zeros_and_poles() creates, so the mesh
+		// can be refined further.
+		void remove_triangles();
+
 		// Increases the resolution of the mesh around the candidate edges to
 		// improve the accuracy of the estimation. Call repeatedly as necessary.
 		void adapt_mesh();
@@ -285,11 +435,15 @@ namespace zf
 		void clear_flags();
 
 		// Removes all edges that are not marked as split (and therefore not
-		// in a candidate region). Some edges near but outside the region will
-		// remain.
+		// in a candidate region), and the nodes left without edges. Some
+		// edges near but outside the region will remain.
 		void cull_edges();
 
-		cplx gen_key(cplx z);
+		// Coordinates of z in units of a quarter of the final precision,
+		// relative to the top left corner. Nodes closer together than that
+		// are taken to be the same node.
+		LatticeKey gen_key(cplx z);
+		static LatticeKey gen_key(cplx z, cplx origin, data_t precision);
 
 		size_t get_edge_count() { return edges.size(); }
 
@@ -297,22 +451,33 @@ namespace zf
 		// accurate.
 		inline static const data_t PI = 4 * atan(data_t(1.0));
 		inline static const data_t PI_2 = 2 * atan(data_t(1.0));
+		// Largest ratio of the region's width or height to the final
+		// precision. Beyond it, lattice keys could overflow, even with the
+		// mesh extended well outside the region.
+		inline static const data_t MAX_SPAN = data_t(1e17);
 	private:
-		std::unordered_map<cplx, std::unique_ptr<Node<cplx>>> nodes;
-		std::vector<std::unique_ptr<Edge<cplx>>> edges;
-		std::vector<std::unique_ptr<Triangle<cplx>>> triangles;
+		Pool<Node<cplx>> node_pool;
+		Pool<Edge<cplx>> edge_pool;
+		Pool<Triangle<cplx>> triangle_pool;
+		NodeTable<cplx> nodes;
+		std::vector<Edge<cplx>*> edges;
+		std::vector<Triangle<cplx>*> triangles;
 
 		std::function<cplx(cplx)> f;
 		data_t precision;
+		cplx origin; // Top left corner
 		int edge_limit;
+		const std::atomic<bool>* cancel;
 	};
 
 	template<typename cplx>
 	inline Mesh<cplx>::Mesh(cplx corner1, cplx corner2,
 		typename get_param<cplx>::type edge_width,
 		typename get_param<cplx>::type final_prec,
-		std::function<cplx(cplx)> func, int edge_lim)
-		: precision(final_prec), f(func), edge_limit(edge_lim)
+		std::function<cplx(cplx)> func, int edge_lim,
+		batch_function<cplx> batch_f, const std::atomic<bool>* cancel_flag)
+		: precision(final_prec), f(func), edge_limit(edge_lim),
+		cancel(cancel_flag)
 	{
 		typedef typename get_param<cplx>::type T;
 		// ensures corner1 is the top left and corner2 is bottom right.
@@ -329,6 +494,7 @@ namespace zf
 			corner2 = cplx(real(corner2), temp_imag);
 		}
 
+		origin = corner1;
 		const T width = real(corner2) - real(corner1);
 		const T height = imag(corner1) - imag(corner2);
 
@@ -350,95 +516,137 @@ namespace zf
 		T loc_y = imag(corner1);
 		T loc_x;
 
-		// Lambdas for readability in the following get_node connection section.
-
-		auto connect_R = [=](T loc_x, T loc_y)
+		// The lattice is traversed twice: first to collect the distinct node
+		// locations, which are then evaluated all at once, and then to connect
+		// the nodes. visit(n1, n2, dir) is called for each edge.
+		auto for_each_edge = [&](auto&& visit)
 		{
-			connect(insert_node(cplx(loc_x, loc_y)),
-				insert_node(cplx(loc_x + edge_width, loc_y)),
-				(int)Direction::right);
-		};
+			// Lambdas for readability in the following get_node connection
+			// section.
 
-		auto connect_DL = [=](T loc_x, T loc_y)
-		{
-			connect(insert_node(cplx(loc_x, loc_y)),
-				insert_node(cplx(loc_x - half_edge_width,
-					loc_y - row_width)),
-					(int)Direction::down_left);
-		};
+			auto connect_R = [&](T loc_x, T loc_y)
+			{
+				visit(cplx(loc_x, loc_y), cplx(loc_x + edge_width, loc_y),
+					(int)Direction::right);
+			};
 
-		auto connect_DR = [=](T loc_x, T loc_y)
-		{
-			connect(insert_node(cplx(loc_x, loc_y)),
-				insert_node(cplx(loc_x + half_edge_width,
-					loc_y - row_width)),
-					(int)Direction::down_right);
-		};
+			auto connect_DL = [&](T loc_x, T loc_y)
+			{
+				visit(cplx(loc_x, loc_y), cplx(loc_x - half_edge_width,
+					loc_y - row_width), (int)Direction::down_left);
+			};
 
-		// Nodes are connected in an equilateral triangular grid, with the bases
-		// aligned with the horizontal axis.
-
-		//  <----------->   Repeat as necessary
-		//   ----- ----- $ 
-		//  / \   / \   $   <--- Even rows
-		// /   \ /   \ $
-		// ~~~~~ ----- #
-		//  ~   / \   # #   <--- Odd rows
-		//   ~ /   \ #   #
-		//     ***** *****  <--- Last row
-		//      <->   Repeat as necessary
-		int x, y;
-		loc_y = imag(corner1);
-		for (y = 0; y < row_count - 1; y++)
-		{
-			x = 0;
+			auto connect_DR = [&](T loc_x, T loc_y)
+			{
+				visit(cplx(loc_x, loc_y), cplx(loc_x + half_edge_width,
+					loc_y - row_width), (int)Direction::down_right);
+			};
+
+			// Nodes are connected in an equilateral triangular grid, with the
+			// bases aligned with the horizontal axis.
+
+			//  <----------->   Repeat as necessary
+			//   ----- ----- $ 
+			//  / \   / \   $   <--- Even rows
+			// /   \ /   \ $
+			// ~~~~~ ----- #
+			//  ~   / \   # #   <--- Odd rows
+			//   ~ /   \ #   #
+			//     ***** *****  <--- Last row
+			//      <->   Repeat as necessary
+			int x, y;
+			loc_y = imag(corner1);
+			for (y = 0; y < row_count - 1; y++)
+			{
+				x = 0;
+				if (y % 2) loc_x = real(corner1) - half_edge_width;
+				else loc_x = real(corner1);
+				if (y % 2)
+				{
+					//  ~~~~~
+					//   ~
+					//    ~ 
+					connect_R(loc_x, loc_y);
+					connect_DR(loc_x, loc_y);
+					x++;
+					loc_x += edge_width;
+				}
+				for (x; x < col_count - 1; x++)
+				{
+					//   -----
+					//  / \
+					// /   \ 
+					connect_R(loc_x, loc_y);
+					connect_DL(loc_x, loc_y);
+					connect_DR(loc_x, loc_y);
+					loc_x += edge_width;
+				}
+				if (y % 2)
+				{
+					//   #
+					//  # #
+					// #   #
+					connect_DR(loc_x, loc_y);
+					connect_DL(loc_x, loc_y);
+				}
+				else
+					//   $
+					//  $
+					// $
+					connect_DL(loc_x, loc_y);
+				loc_y -= row_width;
+			}
 			if (y % 2) loc_x = real(corner1) - half_edge_width;
 			else loc_x = real(corner1);
-			if (y % 2)
+			for (x = 0; x < col_count - 1; x++)
 			{
-				//  ~~~~~
-				//   ~
-				//    ~ 
+				//
+				// *****
+				//
 				connect_R(loc_x, loc_y);
-				connect_DR(loc_x, loc_y);
-				x++;
 				loc_x += edge_width;
 			}
-			for (x; x < col_count - 1; x++)
+		};
+
+		// The nodes are created first, and their quadrants set once the batch
+		// is done.
+		std::vector<Node<cplx>*> new_nodes;
+		std::vector<cplx> locations;
+		new_nodes.reserve(node_count + col_count);
+		locations.reserve(node_count + col_count);
+		auto add_location = [&](cplx z)
+		{
+			const LatticeKey key = gen_key(z);
+			if (!nodes.find(key))
 			{
-				//   -----
-				//  / \
-				// /   \ 
-				connect_R(loc_x, loc_y);
-				connect_DL(loc_x, loc_y);
-				connect_DR(loc_x, loc_y);
-				loc_x += edge_width;
+				Node<cplx>* node = node_pool.make(z);
+				node->key = key;
+				nodes.insert(node);
+				new_nodes.push_back(node);
+				locations.push_back(z);
 			}
-			if (y % 2)
+		};
+		for_each_edge([&](cplx n1, cplx n2, int)
 			{
-				//   #
-				//  # #
-				// #   #
-				connect_DR(loc_x, loc_y);
-				connect_DL(loc_x, loc_y);
-			}
-			else
-				//   $
-				//  $
-				// $
-				connect_DL(loc_x, loc_y);
-			loc_y -= row_width;
-		}
-		if (y % 2) loc_x = real(corner1) - half_edge_width;
-		else loc_x = real(corner1);
-		for (x = 0; x < col_count - 1; x++)
-		{
-			//
-			// *****
-			//
-			connect_R(loc_x, loc_y);
-			loc_x += edge_width;
-		}
+				add_location(n1);
+				add_location(n2);
+			});
+
+		std::vector<cplx> values(locations.size());
+		if (batch_f)
+			batch_f(locations.data(), values.data(), locations.size());
+		else
+			std::transform(locations.begin(), locations.end(),
+				values.begin(), f);
+		for (size_t i = 0; i < new_nodes.size(); i++)
+			new_nodes[i]->calc_q(values[i]);
+		if (cancel && cancel->load(std::memory_order_relaxed))
+			throw cancelled();
+
+		for_each_edge([&](cplx n1, cplx n2, int dir)
+			{
+				connect(insert_node(n1), insert_node(n2), dir);
+			});
 
 		extend_mesh();
 	}
@@ -446,10 +654,23 @@ namespace zf
 	template<typename cplx>
 	inline Node<cplx>* Mesh<cplx>::insert_node(cplx location)
 	{
-		return nodes.insert({
-			gen_key(location),
-			std::make_unique<Node<cplx>>(
-			location, f(location)) }).first->second.get();
+		const LatticeKey key = gen_key(location);
+		Node<cplx>* node = nodes.find(key);
+		if (!node)
+		{
+			node = node_pool.make(location, f(location));
+			node->key = key;
+			nodes.insert(node);
+		}
+		return node;
+	}
+
+	template<typename cplx>
+	inline Mesh<cplx>::~Mesh()
+	{
+		for (auto t : triangles) triangle_pool.release(t);
+		for (auto e : edges) edge_pool.release(e);
+		nodes.for_each([&](Node<cplx>* n) { node_pool.release(n); });
 	}
 
 	template<typename cplx>
@@ -467,9 +688,9 @@ namespace zf
 	template<typename cplx>
 	inline void Mesh<cplx>::connect(Node<cplx>* n1, Node<cplx>* n2, int dir)
 	{
-		edges.push_back(std::make_unique<Edge<cplx>>(n1, n2, mod(dir, 6)));
-		n1->set_edge(edges.back().get(), dir);
-		n2->set_edge(edges.back().get(), dir + 3);
+		edges.push_back(edge_pool.make(n1, n2, mod(dir, 6)));
+		n1->set_edge(edges.back(), dir);
+		n2->set_edge(edges.back(), dir + 3);
 	}
 
 	template<typename cplx>
@@ -528,14 +749,14 @@ namespace zf
 					//	std::cout << "X";
 					connect(e->get_node(n_0), N, e->get_dir()
 						+ neg * dir_change);
-					recurse_if_candidate(edges.back().get());
+					recurse_if_candidate(edges.back());
 				}
 				else
 				{
 					e2 = e2->get_continuation();
 					connect(e->get_node(n_0), e2->get_node(0),
 						e->get_dir() + neg * dir_change);
-					recurse_if_candidate(edges.back().get());
+					recurse_if_candidate(edges.back());
 				}
 			};
 
@@ -557,9 +778,9 @@ namespace zf
 				//	* cplx(cos(angle), sin(angle)));
 
 				connect(e->get_node(n0), N, e->get_dir() + neg * dir_change1);
-				recurse_if_candidate(edges.back().get());
+				recurse_if_candidate(edges.back());
 				connect(e->get_node(n1), N, e->get_dir() + neg * dir_change2);
-				recurse_if_candidate(edges.back().get());
+				recurse_if_candidate(edges.back());
 			}
 			else if (!e->get_next_CW(n0))
 			{
@@ -646,7 +867,7 @@ namespace zf
 						}
 					}
 				};
-				next_tri(triangle.get());
+				next_tri(triangle);
 
 				if (boundarysize)
 				{
@@ -658,6 +879,18 @@ namespace zf
 		return points;
 	}
 
+	template<typename cplx>
+	inline void Mesh<cplx>::remove_triangles()
+	{
+		for (auto e : edges)
+		{
+			e->set_tri(Side::left, nullptr);
+			e->set_tri(Side::right, nullptr);
+		}
+		for (auto t : triangles) triangle_pool.release(t);
+		triangles.clear();
+	}
+
 	template<typename cplx>
 	inline void Mesh<cplx>::adapt_mesh()
 	{
@@ -668,7 +901,7 @@ namespace zf
 		// Splits the candidate edges in half.
 		for (int i = 0; i < dist; i++)
 		{
-			auto e = edges[i].get();
+			auto e = edges[i];
 			split(e);
 			e->boundary = true;
 			e->get_continuation()->boundary = true;
@@ -770,6 +1003,8 @@ namespace zf
 				throw std::exception("Edge count exceeded! Specify a higher "
 					"value (uses more memory), reduce "
 					"precision, or set a smaller region.");
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				throw cancelled();
 		}
 	}
 
@@ -803,7 +1038,7 @@ namespace zf
 				// one the last valid mesh would have produced.
 				if (!e1)
 				{
-					complete_quad(e.get());
+					complete_quad(e);
 					e1 = e->get_next_CW(0);
 				}
 				Side e1_side;
@@ -816,7 +1051,7 @@ namespace zf
 				auto e2 = e->get_next_CCW(1);
 				if (!e2)
 				{
-					complete_quad(e.get());
+					complete_quad(e);
 					e2 = e->get_next_CCW(1);
 				}
 				if (e2->get_node(1) == e->get_node(1))
@@ -828,7 +1063,7 @@ namespace zf
 				auto e3 = e->get_next_CW(1);
 				if (!e3)
 				{
-					complete_quad(e.get());
+					complete_quad(e);
 					e3 = e->get_next_CW(1);
 				}
 				if (e3->get_node(1) == e->get_node(1))
@@ -840,7 +1075,7 @@ namespace zf
 				auto e4 = e->get_next_CCW(0);
 				if (!e4)
 				{
-					complete_quad(e.get());
+					complete_quad(e);
 					e4 = e->get_next_CCW(0);
 				}
 				if (e4->get_node(0) == e->get_node(0))
@@ -848,11 +1083,11 @@ namespace zf
 				else
 					e4_side = Side::left;
 				if (!e->get_tri(1))
-					triangles.push_back(std::make_unique<Triangle<cplx>>(
-						e.get(), Side::right, e1, e1_side, e2, e2_side));
+					triangles.push_back(triangle_pool.make(
+						e, Side::right, e1, e1_side, e2, e2_side));
 				if (!e->get_tri(0))
-					triangles.push_back(std::make_unique<Triangle<cplx>>(
-						e.get(), Side::left, e3, e3_side, e4, e4_side));
+					triangles.push_back(triangle_pool.make(
+						e, Side::left, e3, e3_side, e4, e4_side));
 			});
 
 		return candidate_end;
@@ -865,7 +1100,7 @@ namespace zf
 		auto dist = std::distance(edges.begin(), C);
 		for (int i = 0; i < dist; i++)
 		{
-			auto e = edges[i].get();
+			auto e = edges[i];
 			if (!(e->get_next_CW(0) && e->get_next_CCW(1) &&
 				e->get_next_CCW(0) && e->get_next_CW(1)))
 				complete_quad(e);
@@ -887,33 +1122,40 @@ namespace zf
 	template<typename cplx>
 	inline void Mesh<cplx>::cull_edges()
 	{
-		edges.erase(std::remove_if(edges.begin(), edges.end(), [](auto&& e)
-			{
-				return !e->is_split;
-			}), edges.end());
+		size_t kept = 0;
+		for (size_t i = 0; i < edges.size(); i++)
+		{
+			if (edges[i]->is_split) edges[kept++] = edges[i];
+			else edge_pool.release(edges[i]);
+		}
+		edges.resize(kept);
 
 		// Remove unused nodes, i.e. ones with no edges connected.
 		// Keeps memory usage down somewhat.
-		//auto itr = nodes.begin();
-		//auto end = nodes.end();
-		//while (itr != end)
-		//{
-		//	auto n = (*itr).second.get();
-		//	if (!n->get_edge(0) && !n->get_edge(1)
-		//		&& !n->get_edge(2) && !n->get_edge(3)
-		//		&& !n->get_edge(4) && !n->get_edge(5))
-		//		itr = nodes.erase(itr);
-		//	else itr++;
-		//}
-		//nodes.rehash(0);
+		nodes.remove_if([&](Node<cplx>* n)
+			{
+				for (int dir = 0; dir < 6; dir++)
+					if (n->get_edge(dir)) return false;
+				node_pool.release(n);
+				return true;
+			});
 	}
 
 	template<typename cplx>
-	inline cplx Mesh<cplx>::gen_key(cplx z)
+	inline LatticeKey Mesh<cplx>::gen_key(cplx z)
 	{
-		data_t a = trunc(real(z) / precision * data_t(4.0) + data_t(0.5));
-		data_t b = trunc(imag(z) / precision * data_t(4.0) + data_t(0.5));
-		return cplx(a, b);
+		return gen_key(z, origin, precision);
+	}
+
+	template<typename cplx>
+	inline LatticeKey Mesh<cplx>::gen_key(cplx z, cplx origin,
+		data_t precision)
+	{
+		data_t a = trunc((real(z) - real(origin)) / precision * data_t(4.0)
+			+ data_t(0.5));
+		data_t b = trunc((imag(origin) - imag(z)) / precision * data_t(4.0)
+			+ data_t(0.5));
+		return { (long long)a, (long long)b };
 	}
 
 	template<typename cplx>
@@ -1018,11 +1260,222 @@ namespace zf
 	template<typename cplx>
 	inline void Edge<cplx>::calc_dq()
 	{
+		if (nodes[0]->q == Node<cplx>::NO_QUADRANT
+			|| nodes[1]->q == Node<cplx>::NO_QUADRANT)
+		{
+			dq = 0;
+			return;
+		}
 		dq = (nodes[1]->q - nodes[0]->q);
 		if (dq > 2) dq -= 4;
 		else if (dq < -2) dq += 4;
 	}
 
+	// Newton's method for a zero of f of the given order, or a pole if order
+	// is negative, starting from z. Stops once steps are below tol or stop
+	// getting smaller, so the result still needs checking.
+	template<typename cplx>
+	inline cplx newton(
+		const std::function<std::pair<cplx, cplx>(cplx)>& df, int order,
+		cplx z, typename get_param<cplx>::type tol)
+	{
+		typedef typename get_param<cplx>::type data_t;
+		constexpr int MAX_STEPS = 50;
+		data_t last_step = std::numeric_limits<data_t>::infinity();
+		for (int i = 0; i < MAX_STEPS; i++)
+		{
+			std::pair<cplx, cplx> w = df(z);
+			if (w.first == cplx(0)) break;
+			// A zero of order m is a simple zero of f^(1/m), which gives
+			// z - m f/f'. A pole of order m is a zero of 1/f, whose Newton
+			// step works out as z + m f/f'.
+			cplx step = data_t(order) * w.first / w.second;
+			// Also stops on NaN.
+			if (!(abs(step) < last_step)) break;
+			z -= step;
+			last_step = abs(step);
+			if (last_step <= tol) break;
+		}
+		return z;
+	}
+
+	// Muller's method for a zero of f, or a pole if order is negative,
+	// starting from z and points h either side of it. Unlike newton() it
+	// needs no derivative, but it only converges linearly on points of
+	// higher order. Returns the point where |f|, or |1/f| for a pole, was
+	// smallest.
+	template<typename cplx>
+	inline cplx muller(const std::function<cplx(cplx)>& f, int order,
+		cplx z, typename get_param<cplx>::type h,
+		typename get_param<cplx>::type tol)
+	{
+		typedef typename get_param<cplx>::type data_t;
+		constexpr int MAX_STEPS = 50;
+		auto g = [&](cplx x)
+		{
+			return order < 0 ? cplx(1) / f(x) : f(x);
+		};
+		cplx x0 = z - h, x1 = z + h, x2 = z;
+		cplx g0 = g(x0), g1 = g(x1), g2 = g(x2);
+		cplx best = x2;
+		data_t best_abs = abs(g2);
+		for (int i = 0; i < MAX_STEPS && g2 != cplx(0); i++)
+		{
+			// Steps to the nearer root of the parabola through the last
+			// three points.
+			cplx d1 = (g1 - g0) / (x1 - x0);
+			cplx d2 = (g2 - g1) / (x2 - x1);
+			cplx a = (d2 - d1) / (x2 - x0);
+			cplx b = d2 + (x2 - x1) * a;
+			cplx root = sqrt(b * b - data_t(4.0) * g2 * a);
+			cplx den = abs(b + root) >= abs(b - root) ? b + root : b - root;
+			cplx step = data_t(2.0) * g2 / den;
+			// Also stops on NaN.
+			if (!(abs(step) < std::numeric_limits<data_t>::infinity()))
+				break;
+			x0 = x1;
+			g0 = g1;
+			x1 = x2;
+			g1 = g2;
+			x2 -= step;
+			g2 = g(x2);
+			if (abs(g2) < best_abs)
+			{
+				best = x2;
+				best_abs = abs(g2);
+			}
+			if (abs(step) <= tol) break;
+		}
+		return best;
+	}
+
+	// Number of times f winds around zero as z goes once around the closed
+	// polygon through vertices, counter-clockwise being positive. Sides are
+	// split until f turns by at most an eighth of a turn between samples.
+	// Returns false if that takes more than max_evals evaluations, or if f is
+	// zero or NaN at a sample.
+	template<typename cplx>
+	inline bool winding_number(const std::function<cplx(cplx)>& f,
+		const std::vector<cplx>& vertices, int max_evals, int& winding)
+	{
+		typedef typename get_param<cplx>::type data_t;
+		static const data_t PI = 4 * atan(data_t(1.0));
+		struct Sample
+		{
+			cplx z;
+			data_t arg;
+		};
+		int evals = 0;
+		auto sample = [&](cplx z)
+		{
+			evals++;
+			cplx w = f(z);
+			// Also false for NaN.
+			return Sample{z, abs(w) > data_t(0.0) ? arg(w) : data_t(NAN)};
+		};
+
+		const Sample first = sample(vertices[0]);
+		Sample a = first;
+		data_t turned = 0;
+		// Samples between a and the next vertex, nearest last.
+		std::vector<Sample> ahead;
+		for (size_t i = 1; i <= vertices.size(); i++)
+		{
+			ahead.push_back(i < vertices.size() ? sample(vertices[i]) : first);
+			while (!ahead.empty())
+			{
+				const Sample b = ahead.back();
+				data_t step = b.arg - a.arg;
+				if (step > PI) step -= 2 * PI;
+				else if (step < -PI) step += 2 * PI;
+				if (!(step <= PI / data_t(4.0) && step >= -PI / data_t(4.0)))
+				{
+					if (step != step || evals >= max_evals) return false;
+					ahead.push_back(sample((a.z + b.z) / data_t(2.0)));
+					continue;
+				}
+				turned += step;
+				a = b;
+				ahead.pop_back();
+			}
+		}
+		winding = (int)floor(turned / (2 * PI) + data_t(0.5));
+		return true;
+	}
+
+	// Refines the zeros and poles the mesh found to within radius, by
+	// newton() if df is set or by muller() otherwise. Points of order zero
+	// are left alone, as are any the iteration takes further than radius
+	// or nearer another point's estimate than its own, since it may have
+	// gone to a different zero or pole. Coarse meshes can get the order of
+	// a multiple zero or pole wrong, so it is checked by the winding of f
+	// around a circle, and the point polished again if the order was wrong.
+	// The circle is kept to a third of the distance to the nearest other
+	// point, so its order never takes in a neighbour's.
+	template<typename cplx>
+	inline void polish(std::vector<std::pair<cplx, int>>& points,
+		const std::function<cplx(cplx)>& f,
+		const std::function<std::pair<cplx, cplx>(cplx)>& df,
+		typename get_param<cplx>::type radius,
+		typename get_param<cplx>::type tol)
+	{
+		typedef typename get_param<cplx>::type data_t;
+		static const data_t PI = 4 * atan(data_t(1.0));
+		constexpr int CIRCLE_SAMPLES = 12;
+		constexpr int CIRCLE_EVALS = 256;
+		auto refine = [&](cplx z, int order)
+		{
+			return df ? newton(df, order, z, tol)
+				: muller(f, order, z, radius / data_t(8.0), tol);
+		};
+
+		std::vector<cplx> estimates;
+		for (auto& p : points)
+			estimates.push_back(p.first);
+		// Distance from z to the nearest estimate other than the i-th.
+		auto nearest_other = [&](size_t i, cplx z)
+		{
+			data_t nearest = std::numeric_limits<data_t>::infinity();
+			for (size_t j = 0; j < estimates.size(); j++)
+				if (j != i)
+					nearest = std::min(nearest, abs(estimates[j] - z));
+			return nearest;
+		};
+		auto acceptable = [&](size_t i, cplx z)
+		{
+			// Also false for NaN.
+			const data_t moved = abs(z - estimates[i]);
+			return moved <= radius && moved < nearest_other(i, z);
+		};
+
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			auto& p = points[i];
+			if (p.second == 0) continue;
+			cplx z = refine(p.first, p.second);
+			if (!acceptable(i, z)) continue;
+
+			const data_t circle_radius =
+				std::min(radius, nearest_other(i, z) / data_t(3.0));
+			std::vector<cplx> circle;
+			for (int k = 0; k < CIRCLE_SAMPLES; k++)
+				circle.push_back(z + circle_radius * exp(cplx(0,
+					2 * PI * data_t(k) / data_t(CIRCLE_SAMPLES))));
+			int order;
+			if (winding_number(f, circle, CIRCLE_EVALS, order)
+				&& order != 0 && order != p.second)
+			{
+				cplx z2 = refine(z, order);
+				if (acceptable(i, z2))
+				{
+					p.second = order;
+					z = z2;
+				}
+			}
+			p.first = z;
+		}
+	}
+
 	template<typename cplx>
 	inline std::vector<std::pair<cplx, int>>
 		solve(cplx ULcorner, cplx LRcorner,
@@ -1030,9 +1483,27 @@ namespace zf
 			std::function<cplx(cplx)> f,
 			typename get_param<cplx>::type initial_mesh_len,
 			int edge_limit)
+	{
+		return solve(ULcorner, LRcorner, precision, f, options<cplx>(),
+			initial_mesh_len, edge_limit);
+	}
+
+	template<typename cplx>
+	inline std::vector<std::pair<cplx, int>>
+		solve(cplx ULcorner, cplx LRcorner,
+			typename get_param<cplx>::type precision,
+			std::function<cplx(cplx)> f,
+			const options<cplx>& opts,
+			typename get_param<cplx>::type initial_mesh_len,
+			int edge_limit)
 	{
 		typedef typename get_param<cplx>::type data_t;
 
+		// Polishing takes the points from the mesh to the precision asked for.
+		const data_t polish_precision = precision;
+		const bool polishing = opts.mesh_precision > precision;
+		if (polishing) precision = opts.mesh_precision;
+
 		// If the specified precision is too fine to actually be usable with
 		// the given data type over the specified range, grow it until it works.
 		// This is very crude but at least it does not depend on any details of
@@ -1049,11 +1520,12 @@ namespace zf
 			avg(ULcorner, LRcorner, 1.2345), avg(ULcorner, LRcorner, 3.4567)};
 
 		static const data_t PI = 4 * atan(data_t(1.0));
+		// Keys as the mesh makes them, relative to its top left corner.
+		const cplx origin(std::min(real(ULcorner), real(LRcorner)),
+			std::max(imag(ULcorner), imag(LRcorner)));
 		auto gen_key = [&](cplx z)
 		{
-			data_t a = trunc(real(z) / precision * data_t(4.0) + data_t(0.5));
-			data_t b = trunc(imag(z) / precision * data_t(4.0) + data_t(0.5));
-			return cplx(a, b);
+			return Mesh<cplx>::gen_key(z, origin, precision);
 		};
 
 		auto verify_precision = [&]()
@@ -1078,11 +1550,17 @@ namespace zf
 					* PI / data_t(3.0)));
 				auto key2 = gen_key(pt2 + p_4 * exp(cplx(0, -1)
 					* PI / data_t(3.0)));
-				if (key1 != key2) return false;
+				if (!(key1 == key2)) return false;
 			}
 			return true;
 		};
 
+		// Mesh nodes are keyed by integer coordinates, which limits how fine
+		// the precision can be relative to the region.
+		const data_t span = std::max(abs(real(ULcorner) - real(LRcorner)),
+			abs(imag(ULcorner) - imag(LRcorner)));
+		while (span / precision > Mesh<cplx>::MAX_SPAN) precision *= 2;
+
 		while (!verify_precision()) precision *= 2;
 
 
@@ -1093,18 +1571,123 @@ namespace zf
 					- imag(LRcorner)) / data_t(30.0));
 		int iterations = (int)ceil(log(data_t(log(2.0))
 			* initial_mesh_len / precision));
+		// Each iteration halves the edges, so the count above leaves fine
+		// meshes well short of precision. Polishing needs the edges to
+		// really get there, or nearby points would share a region.
+		if (polishing)
+			for (data_t len = initial_mesh_len / std::pow(2, iterations);
+				len > precision; len /= 2)
+				iterations++;
 
 		Mesh<cplx> mesh(ULcorner, LRcorner, initial_mesh_len, precision, f,
-			edge_limit);
+			edge_limit, opts.batch_f, opts.cancel);
 
 		for (int i = 0; i < iterations; i++)
 		{
 			mesh.adapt_mesh();
 			mesh.cull_edges();
 			mesh.clear_flags();
+			if (opts.progress && i + 1 < iterations)
+			{
+				opts.progress(mesh.find_zeros_and_poles());
+				mesh.remove_triangles();
+				mesh.clear_flags();
+			}
+		}
+		std::vector<std::pair<cplx, int>> results = mesh.find_zeros_and_poles();
+		if (polishing)
+		{
+			// A region's center is usually within an edge of its zero or
+			// pole, so 4 is generous.
+			data_t edge_len = initial_mesh_len;
+			for (int i = 0; i < iterations; i++)
+				edge_len /= 2;
+			polish(results, f, opts.df,
+				data_t(4.0) * std::max(edge_len, precision),
+				polish_precision);
+		}
+		return results;
+	}
+
+	template<typename cplx>
+	inline bool track(cplx ULcorner, cplx LRcorner,
+		std::function<cplx(cplx)> f,
+		std::function<std::pair<cplx, cplx>(cplx)> df,
+		std::vector<std::pair<cplx, int>>& points)
+	{
+		typedef typename get_param<cplx>::type data_t;
+		static const data_t PI = 4 * atan(data_t(1.0));
+		// Evaluation budgets for the winding numbers. Sides are split into
+		// pieces of SIDE_SAMPLES to start with, circles into CIRCLE_SAMPLES.
+		constexpr int SIDE_SAMPLES = 8;
+		constexpr int CIRCLE_SAMPLES = 12;
+		constexpr int BOUNDARY_EVALS = 4096;
+		constexpr int CIRCLE_EVALS = 256;
+		// Two points closer than this fraction of the region's size have
+		// merged, or were the same one to begin with.
+		const data_t MERGED = data_t(1e-9);
+
+		const data_t left = std::min(real(ULcorner), real(LRcorner));
+		const data_t right = std::max(real(ULcorner), real(LRcorner));
+		const data_t bottom = std::min(imag(ULcorner), imag(LRcorner));
+		const data_t top = std::max(imag(ULcorner), imag(LRcorner));
+		const data_t span = std::max(right - left, top - bottom);
+		auto inside = [&](cplx z)
+		{
+			return real(z) > left && real(z) < right && imag(z) > bottom
+				&& imag(z) < top;
+		};
+
+		const data_t eps = std::numeric_limits<data_t>::epsilon();
+		std::vector<std::pair<cplx, int>> tracked;
+		for (auto& p : points)
+		{
+			if (!inside(p.first)) continue;
+			if (p.second == 0) return false;
+			const data_t tol = 4 * eps * std::max(abs(p.first), span);
+			cplx z = newton(df, p.second, p.first, tol);
+			if (inside(z)) tracked.emplace_back(z, p.second);
 		}
-		return mesh.find_zeros_and_poles();
+
+		int order_sum = 0;
+		for (size_t i = 0; i < tracked.size(); i++)
+		{
+			// The circle must not reach any other point.
+			data_t radius = span / data_t(50.0);
+			for (size_t j = 0; j < tracked.size(); j++)
+				if (j != i)
+					radius = std::min(radius,
+						abs(tracked[j].first - tracked[i].first) / 3);
+			if (radius < MERGED * span) return false;
+
+			std::vector<cplx> circle;
+			for (int k = 0; k < CIRCLE_SAMPLES; k++)
+				circle.push_back(tracked[i].first + radius * exp(cplx(0,
+					2 * PI * data_t(k) / data_t(CIRCLE_SAMPLES))));
+			int winding;
+			if (!winding_number(f, circle, CIRCLE_EVALS, winding)
+				|| winding != tracked[i].second)
+				return false;
+			order_sum += winding;
+		}
+
+		// Counter-clockwise from the bottom left corner.
+		const cplx corners[4] = {cplx(left, bottom), cplx(right, bottom),
+			cplx(right, top), cplx(left, top)};
+		std::vector<cplx> boundary;
+		for (int side = 0; side < 4; side++)
+			for (int k = 0; k < SIDE_SAMPLES; k++)
+				boundary.push_back(corners[side] + (corners[(side + 1) % 4]
+					- corners[side]) * data_t(k) / data_t(SIDE_SAMPLES));
+		int winding;
+		if (!winding_number(f, boundary, BOUNDARY_EVALS, winding)
+			|| winding != order_sum)
+			return false;
+
+		points = std::move(tracked);
+		return true;
 	}
+
 	template<typename cplx>
 	inline Triangle<cplx>::Triangle(Edge<cplx>* a, Side a_side, Edge<cplx>* b,
 		Side b_side, Edge<cplx>* c, Side c_side)
@@ -1161,6 +1744,11 @@ namespace zf
 		calc_q(val);
 	}
 	template<typename cplx>
+	inline Node<cplx>::Node(cplx loc)
+		: location(loc)
+	{
+	}
+	template<typename cplx>
 	inline Edge<cplx>* Node<cplx>::get_edge(int dir)
 	{
 		return edges[mod(dir, 6)];
@@ -1174,8 +1762,120 @@ namespace zf
 	inline void Node<cplx>::calc_q(cplx z)
 	{
 		typedef typename get_param<cplx>::type data_t;
-		if (data_t a = arg(z); a >= 0)
+		data_t a = arg(z);
+		if (a >= 0)
 			q = (int)ceil(a / Mesh<cplx>::PI_2);
-		else q = 4 + (int)ceil(a / Mesh<cplx>::PI_2);
+		else if (a < 0)
+			q = 4 + (int)ceil(a / Mesh<cplx>::PI_2);
+		else q = NO_QUADRANT;
+	}
+
+	template <typename T>
+	template <typename... Args>
+	inline T* Pool<T>::make(Args&&... args)
+	{
+		if (!free_list && used == BLOCK_SIZE)
+		{
+			blocks.push_back(std::make_unique<Slot[]>(BLOCK_SIZE));
+			used = 0;
+		}
+		// The object overwrites next, and the slot is only taken once it has
+		// been constructed.
+		Slot* slot = free_list ? free_list : &blocks.back()[used];
+		Slot* next = free_list ? free_list->next : nullptr;
+		T* obj = new (slot->object) T(std::forward<Args>(args)...);
+		if (slot == free_list) free_list = next;
+		else used++;
+		return obj;
+	}
+
+	template <typename T>
+	inline void Pool<T>::release(T* obj)
+	{
+		obj->~T();
+		Slot* slot = reinterpret_cast<Slot*>(obj);
+		slot->next = free_list;
+		free_list = slot;
+	}
+
+	template <typename cplx>
+	inline Node<cplx>* NodeTable<cplx>::find(const LatticeKey& key) const
+	{
+		if (slots.empty()) return nullptr;
+		const size_t mask = slots.size() - 1;
+		for (size_t i = hash(key) & mask; slots[i]; i = (i + 1) & mask)
+			if (slots[i]->key == key) return slots[i];
+		return nullptr;
+	}
+
+	template <typename cplx>
+	inline void NodeTable<cplx>::insert(Node<cplx>* node)
+	{
+		if (2 * (count + 1) > slots.size())
+			rehash(std::max<size_t>(16, 2 * slots.size()));
+		const size_t mask = slots.size() - 1;
+		size_t i = hash(node->key) & mask;
+		while (slots[i]) i = (i + 1) & mask;
+		slots[i] = node;
+		count++;
+	}
+
+	template <typename cplx>
+	inline void NodeTable<cplx>::reserve(size_t n)
+	{
+		size_t capacity = std::max<size_t>(16, slots.size());
+		while (capacity < 2 * n) capacity *= 2;
+		if (capacity > slots.size()) rehash(capacity);
+	}
+
+	template <typename cplx>
+	template <typename Pred>
+	inline void NodeTable<cplx>::remove_if(Pred pred)
+	{
+		auto end = std::remove_if(slots.begin(), slots.end(),
+			[&](Node<cplx>* node)
+			{
+				return !node || pred(node);
+			});
+		count = end - slots.begin();
+		slots.erase(end, slots.end());
+		size_t capacity = 16;
+		while (capacity < 2 * count) capacity *= 2;
+		rehash(capacity);
+	}
+
+	template <typename cplx>
+	template <typename Visit>
+	inline void NodeTable<cplx>::for_each(Visit visit) const
+	{
+		for (auto node : slots)
+			if (node) visit(node);
+	}
+
+	template <typename cplx>
+	inline size_t NodeTable<cplx>::hash(const LatticeKey& key)
+	{
+		// Mixes the coordinates unevenly, so that (a, b) and (b, a) differ.
+		std::uint64_t h = std::uint64_t(key.x) * 0x9E3779B97F4A7C15ull
+			^ std::uint64_t(key.y);
+		h ^= h >> 32;
+		h *= 0xD6E8FEB86659FD93ull;
+		h ^= h >> 32;
+		return size_t(h);
+	}
+
+	template <typename cplx>
+	inline void NodeTable<cplx>::rehash(size_t capacity)
+	{
+		std::vector<Node<cplx>*> old(capacity);
+		old.swap(slots);
+		const size_t mask = capacity - 1;
+		for (auto node : old)
+		{
+			if (!node) continue;
+			size_t i = hash(node->key) & mask;
+			while (slots[i]) i = (i + 1) & mask;
+			slots[i] = node;
+		}
 	}
 }